@@ -42,6 +42,7 @@ using shader_bool  = LiteMath::uint;
 #endif
 
 #define IOR 1.45f
+#define SHADOW_CASCADES_MAX 4
 
 struct UniformParams
 {
@@ -59,6 +60,23 @@ struct UniformParams
   shader_uint  ssaoKernelSize;
   shader_vec3  camPosition;
   shader_float screenSpaceBlendingWidth;
+  shader_mat4  projView;
+  shader_mat4  projInverse; // G-buffer positions are reconstructed from depth with it
+  shader_uint  ssaoDownscale; // 1, 2 or 4, SSAO targets are that many times smaller than the frame
+  shader_uint  shadowCascadesNum;
+  shader_uvec2 pad0;
+  shader_vec4  shadowCascadeSplits; // view space distance where each cascade ends
+  shader_mat4  shadowCascadeMatrices[SHADOW_CASCADES_MAX]; // lightMatrix cropped to every cascade
+};
+
+struct CullingParams
+{
+  shader_mat4 projView;
+  shader_mat4 occlusionProjView; // matrix the depth pyramid was rendered with
+  shader_uint instancesNum;
+  shader_uint firstCommand;      // output range start in the culled commands buffer
+  shader_uint countIdx;
+  shader_bool occlusionEnabled;
 };
 
 #endif // VK_GRAPHICS_BASIC_COMMON_H
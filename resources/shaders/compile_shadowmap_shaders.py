@@ -6,8 +6,9 @@ if __name__ == '__main__':
     glslang_cmd = "glslangValidator"
 
     shader_list = ["render_scene.vert", "prepare_gbuffer.frag", "resolve_gbuffer.vert", "resolve_gbuffer.frag",
-                   "fullscreen_quad.vert", "ssao.frag", "gaussian_blur.comp",
-                   "transparency.vert", "transparency.frag", "resolve_transparency.vert", "resolve_transparency.frag"]
+                   "fullscreen_quad.vert", "ssao.comp", "bilateral_blur.comp", "ssao_upsample.frag",
+                   "transparency.vert", "transparency.frag",
+                   "cull_instances.comp", "depth_pyramid.comp"]
 
     for shader in shader_list:
         subprocess.run([glslang_cmd, "-V", shader, "-o", "{}.spv".format(shader)])
@@ -0,0 +1,42 @@
+#ifndef VK_GRAPHICS_BASIC_GBUFFER_DECODE_H
+#define VK_GRAPHICS_BASIC_GBUFFER_DECODE_H
+
+// The G-buffer keeps no positions: they are reconstructed from the main view depth and the inverse projection.
+// View space normals are stored octahedrally in an RG16 snorm target.
+
+vec2 octahedral_wrap(vec2 v)
+{
+  return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// n must be normalized, the result is in [-1, 1]
+vec2 encode_normal(vec3 n)
+{
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  return n.z >= 0.0 ? n.xy : octahedral_wrap(n.xy);
+}
+
+vec3 decode_normal(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  const float t = clamp(-n.z, 0.0, 1.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+// uv is the texture coordinate of the depth sample, the projection maps NDC xy in [-1, 1] to it linearly
+vec3 reconstruct_view_pos(vec2 uv, float depth, mat4 projInverse)
+{
+  const vec4 pos = projInverse * vec4(uv * 2.0 - 1.0, depth, 1.0);
+  return pos.xyz / pos.w;
+}
+
+// view space z only, x and y of NDC don't affect it for perspective and orthographic projections
+float reconstruct_view_z(float depth, mat4 projInverse)
+{
+  const vec4 pos = projInverse * vec4(0.0, 0.0, depth, 1.0);
+  return pos.z / pos.w;
+}
+
+#endif // VK_GRAPHICS_BASIC_GBUFFER_DECODE_H
@@ -3,25 +3,19 @@
 #extension GL_GOOGLE_include_directive : require
 
 #include "common.h"
+#include "gbuffer_decode.h"
 
-layout (location = 0) out vec3 position;
-layout (location = 1) out vec3 normal;
-layout (location = 2) out vec3 albedo;
+layout (location = 0) out vec2 normal;
+layout (location = 1) out vec3 albedo;
 
 layout (location = 0) in VS_OUT
 {
   vec3 wPos;
   vec3 wNorm;
   vec2 texCoord;
+  flat uint colorNo;
 } vsOut;
 
-layout (push_constant) uniform params_t
-{
-    mat4 mProjView;
-    mat4 mModel;
-    uint colorNo;
-} PushConstant;
-
 layout (binding = 0, set = 0) uniform AppData
 {
   UniformParams Params;
@@ -29,9 +23,8 @@ layout (binding = 0, set = 0) uniform AppData
 
 void main()
 {
-  position = (Params.view * vec4(vsOut.wPos, 1.0)).xyz;
-  normal = (Params.view * vec4(vsOut.wNorm, 0.0)).xyz;
-  switch(PushConstant.colorNo)
+  normal = encode_normal(normalize((Params.view * vec4(vsOut.wNorm, 0.0)).xyz));
+  switch(vsOut.colorNo)
   {
     case 0: // Room walls
       albedo = vec3(0.733f, 1.f, 0.596f); break;            
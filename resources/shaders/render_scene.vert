@@ -2,24 +2,35 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_GOOGLE_include_directive : require
 
+#include "common.h"
 #include "unpack_attributes.h"
 
 layout (location = 0) in vec4 vPosNorm;
 layout (location = 1) in vec4 vTexCoordAndTang;
 
+// matrices come from the uniform buffer, so recorded command buffers stay valid when the camera moves
+layout (binding = 0, set = 0) uniform AppData
+{
+    UniformParams Params;
+};
+
 layout (push_constant) uniform params_t
 {
-    mat4 mProjView;
-    mat4 mModel;
-    uint colorNo;
+    uint lightMatrixIdx; // 0 for the main view, shadow cascade + 1
 } PushConstant;
 
+// indexed with gl_InstanceIndex, firstInstance of every indirect command is the instance id
+layout (std430, binding = 1, set = 0) readonly buffer InstanceMatrices
+{
+    mat4 instanceMatrices[];
+};
+
 layout (location = 0) out VS_OUT
 { 
     vec3 wPos;
     vec3 wNorm;
     vec2 texCoord;
-
+    flat uint colorNo;
 } vOut;
 
 out gl_PerVertex { vec4 gl_Position; };
@@ -28,9 +39,14 @@ void main(void)
     const vec4 wNorm = vec4(DecodeNormal(floatBitsToInt(vPosNorm.w)),         0.0f);
     const vec4 wTang = vec4(DecodeNormal(floatBitsToInt(vTexCoordAndTang.z)), 0.0f);
 
-    vOut.wPos     = (PushConstant.mModel * vec4(vPosNorm.xyz, 1.0f)).xyz;
-    vOut.wNorm    = normalize(mat3(transpose(inverse(PushConstant.mModel))) * wNorm.xyz);
+    const mat4 mModel = instanceMatrices[gl_InstanceIndex];
+
+    vOut.wPos     = (mModel * vec4(vPosNorm.xyz, 1.0f)).xyz;
+    vOut.wNorm    = normalize(mat3(transpose(inverse(mModel))) * wNorm.xyz);
     vOut.texCoord = vTexCoordAndTang.xy;
+    vOut.colorNo  = gl_InstanceIndex;
 
-    gl_Position   = PushConstant.mProjView * vec4(vOut.wPos, 1.0);
+    const mat4 mProjView = PushConstant.lightMatrixIdx != 0
+      ? Params.shadowCascadeMatrices[PushConstant.lightMatrixIdx - 1] : Params.projView;
+    gl_Position   = mProjView * vec4(vOut.wPos, 1.0);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #extension GL_GOOGLE_include_directive : require
 
 #include "common.h"
+#include "gbuffer_decode.h"
 
 layout (location = 0) out vec4 frameBeforeTransparency;
 
@@ -18,8 +19,8 @@ layout(binding = 0, set = 0) uniform AppData
   UniformParams Params;
 };
 
-layout (binding = 1) uniform sampler2D shadowMap;
-layout (binding = 2) uniform sampler2D positionMap;
+layout (binding = 1) uniform sampler2DArray shadowMap; // a layer per cascade
+layout (binding = 2) uniform sampler2D depthMap;
 layout (binding = 3) uniform sampler2D normalMap;
 layout (binding = 4) uniform sampler2D albedoMap;
 layout (binding = 5) uniform sampler2D ssaoMap;
@@ -28,17 +29,27 @@ layout (binding = 7) uniform samplerCube environmentMap;
 
 void main()
 {
-  const vec3 wPos = (Params.viewInverse * vec4(texture(positionMap, vsOut.texCoord).xyz, 1.0)).xyz;
-  const vec4 posLightClipSpace = Params.lightMatrix*vec4(wPos, 1.0f);
-  const vec3 posLightSpaceNDC  = posLightClipSpace.xyz/posLightClipSpace.w;    // for orto matrix, we don't need perspective division, you can remove it if you want; this is general case;
-  vec2 shadowTexCoord    = posLightSpaceNDC.xy*0.5f + vec2(0.5f, 0.5f);  // just shift coords from [-1,1] to [0,1]               
+  const vec3 viewPos = reconstruct_view_pos(vsOut.texCoord, texture(depthMap, vsOut.texCoord).r, Params.projInverse);
+  const vec3 wPos = (Params.viewInverse * vec4(viewPos, 1.0)).xyz;
+  // the first cascade that reaches the pixel, beyond the last one nothing is shadowed
+  int cascade = 0;
+  while (cascade < int(Params.shadowCascadesNum) && -viewPos.z > Params.shadowCascadeSplits[cascade])
+    ++cascade;
+
+  float shadow = 1.0f;
+  if (cascade < int(Params.shadowCascadesNum))
+  {
+    const vec4 posLightClipSpace = Params.shadowCascadeMatrices[cascade] * vec4(wPos, 1.0f);
+    const vec3 posLightSpaceNDC  = posLightClipSpace.xyz / posLightClipSpace.w;
+    const vec2 shadowTexCoord    = posLightSpaceNDC.xy * 0.5f + vec2(0.5f, 0.5f);
 
-  const bool  outOfView = (shadowTexCoord.x < 0.0001f || shadowTexCoord.x > 0.9999f || shadowTexCoord.y < 0.0091f || shadowTexCoord.y > 0.9999f);
-  const float shadow    = ((posLightSpaceNDC.z < textureLod(shadowMap, shadowTexCoord, 0).x + 0.001f) || outOfView) ? 1.0f : 0.0f;
+    const bool outOfView = (shadowTexCoord.x < 0.0001f || shadowTexCoord.x > 0.9999f || shadowTexCoord.y < 0.0091f || shadowTexCoord.y > 0.9999f);
+    shadow = ((posLightSpaceNDC.z < textureLod(shadowMap, vec3(shadowTexCoord, cascade), 0).x + 0.001f) || outOfView) ? 1.0f : 0.0f;
+  }
 
   const vec4 lightColor1 = vec4(1.f, 1.f, 1.f, 1.f);
 
-  const vec3 normal = (Params.viewInverse * texture(normalMap, vsOut.texCoord)).xyz;
+  const vec3 normal = (Params.viewInverse * vec4(decode_normal(texture(normalMap, vsOut.texCoord).xy), 0.0)).xyz;
   vec4 albedo = texture(albedoMap, vsOut.texCoord);
   if (albedo.xyz == vec3(0.f))
     frameBeforeTransparency = texture(environmentMap, forwards);
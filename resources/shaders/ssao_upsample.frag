@@ -0,0 +1,56 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.h"
+#include "gbuffer_decode.h"
+
+// Joint bilateral upsampling of the reduced resolution SSAO: the four closest SSAO pixels are weighted bilinearly
+// and by how close the depth they were computed with is to the depth of the full resolution pixel,
+// so occlusion doesn't leak across depth discontinuities.
+
+layout(location = 0) out float out_fragColor;
+
+layout (location = 0 ) in VS_OUT
+{
+  vec2 texCoord;
+} vsOut;
+
+layout(binding = 0, set = 0) uniform AppData
+{
+  UniformParams Params;
+};
+
+layout (binding = 1) uniform sampler2D gDepth;
+layout (binding = 2) uniform sampler2D ssaoMap;
+
+#define DEPTH_EPSILON 0.01f
+
+void main()
+{
+  const int downscale = int(Params.ssaoDownscale);
+  const ivec2 texel = ivec2(gl_FragCoord.xy);
+  const ivec2 depthSize = textureSize(gDepth, 0);
+  const ivec2 ssaoSize = textureSize(ssaoMap, 0);
+  const float depth = reconstruct_view_z(texelFetch(gDepth, texel, 0).r, Params.projInverse);
+
+  // SSAO pixel i was computed at full resolution texel i * downscale, see ssao.comp
+  const ivec2 base = texel / downscale;
+  const vec2 fraction = vec2(texel - base * downscale) / float(downscale);
+
+  float occlusion = 0.f;
+  float weightSum = 0.f;
+  for (int i = 0; i < 4; ++i)
+  {
+    const ivec2 offset = ivec2(i & 1, i >> 1);
+    const ivec2 ssaoTexel = min(base + offset, ssaoSize - 1);
+    const vec2 bilinear = mix(1.f - fraction, fraction, vec2(offset));
+    const float sampleDepth = reconstruct_view_z(texelFetch(gDepth, min(ssaoTexel * downscale, depthSize - 1), 0).r,
+      Params.projInverse);
+    // pixels with a zero bilinear weight still count a little, in case none of the others is on the same surface
+    const float weight = max(bilinear.x * bilinear.y, 1e-3f) / (abs(sampleDepth - depth) + DEPTH_EPSILON);
+    occlusion += texelFetch(ssaoMap, ssaoTexel, 0).r * weight;
+    weightSum += weight;
+  }
+  out_fragColor = occlusion / weightSum;
+}
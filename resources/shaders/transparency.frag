@@ -19,7 +19,6 @@ layout(binding = 0, set = 0) uniform AppData
 };
 
 layout (binding = 1) uniform sampler2D frameBeforeTransparency;
-layout (binding = 2) uniform sampler2D positionMap;
 layout (binding = 3) uniform sampler2D albedoMap;
 layout (binding = 4) uniform samplerCube environmentMap;
 
@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "render/frustum_culling.h"
+
+// Frustum culling of 100k instances scattered around the camera, AVX2 path against the scalar one.
+int main()
+{
+  constexpr uint32_t INSTANCES_NUM = 100000;
+  constexpr uint32_t ITERATIONS    = 200;
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> extent(0.5f, 5.0f);
+
+  std::vector<LiteMath::Box4f> boxes(INSTANCES_NUM);
+  for (auto& box : boxes)
+  {
+    const LiteMath::float4 center(position(gen), position(gen), position(gen), 1.0f);
+    const float halfSize = extent(gen);
+    box.boxMin = center - LiteMath::float4(halfSize, halfSize, halfSize, 0.0f);
+    box.boxMax = center + LiteMath::float4(halfSize, halfSize, halfSize, 0.0f);
+  }
+
+  FrustumCuller culler;
+  culler.SetBoxes(boxes);
+
+  const auto proj = LiteMath::perspectiveMatrix(60.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+  std::vector<uint32_t> visible, reference;
+
+  auto measure = [&](auto&& cull)
+  {
+    double totalMs = 0.0;
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+    {
+      const float angle = 6.2831853f * float(i) / float(ITERATIONS);
+      const auto view = LiteMath::lookAt(LiteMath::float3(0.0f, 0.0f, 0.0f),
+        LiteMath::float3(std::cos(angle), 0.0f, std::sin(angle)), LiteMath::float3(0.0f, 1.0f, 0.0f));
+
+      const auto start = std::chrono::high_resolution_clock::now();
+      cull(proj * view);
+      const auto end = std::chrono::high_resolution_clock::now();
+      totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    return totalMs / ITERATIONS;
+  };
+
+  const double scalarMs = measure([&](const LiteMath::float4x4& projView) { culler.CullScalar(projView, reference); });
+  const double simdMs   = measure([&](const LiteMath::float4x4& projView) { culler.Cull(projView, visible); });
+
+  std::cout << "Instances: " << INSTANCES_NUM << ", visible in the last view: " << visible.size() << std::endl;
+  std::cout << "Scalar: " << scalarMs << " ms, Cull: " << simdMs << " ms, speedup " << scalarMs / simdMs << "x" << std::endl;
+
+  if (visible != reference)
+  {
+    std::cout << "ERROR: SIMD and scalar paths disagree" << std::endl;
+    return 1;
+  }
+  return 0;
+}
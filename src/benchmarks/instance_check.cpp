@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "render/frustum_culling.h"
+#include "render/scene_bvh.h"
+
+using LiteMath::float3;
+using LiteMath::float4;
+using LiteMath::float4x4;
+using LiteMath::Box4f;
+
+// Scripted runtime instance edits on the CPU side structures, the way the renderer applies them every frame:
+// FrustumCuller gets SetBox for updated instances and the instance BVH is refitted (rebuilt when Refit refuses).
+// After every step both are compared with ones built from scratch and with a brute force test of all boxes.
+namespace
+{
+  constexpr uint32_t INSTANCES_NUM  = 10000;
+  constexpr uint32_t STEPS          = 4096;
+  constexpr uint32_t EDITS_PER_STEP = 8;
+
+  // an empty box, like the ones SceneManager keeps for removed and unmarked instances
+  Box4f empty_box() { return Box4f(); }
+  bool is_empty(const Box4f& box) { return !(box.boxMin.x <= box.boxMax.x); }
+
+  bool overlaps(const float3& aMin, const float3& aMax, const float3& bMin, const float3& bMax)
+  {
+    return aMin.x <= bMax.x && aMin.y <= bMax.y && aMin.z <= bMax.z &&
+           bMin.x <= aMax.x && bMin.y <= aMax.y && bMin.z <= aMax.z;
+  }
+
+  float3 xyz(const float4& v) { return float3(v.x, v.y, v.z); }
+
+  // primitives whose boxes overlap a_box, found through the tree
+  void query_box(const Bvh& a_bvh, const std::vector<Box4f>& a_boxes, const Box4f& a_box, std::vector<uint32_t>& a_found)
+  {
+    a_found.clear();
+    if (a_bvh.Empty())
+      return;
+
+    const float3 boxMin = xyz(a_box.boxMin);
+    const float3 boxMax = xyz(a_box.boxMax);
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+      const Bvh::Node& node = a_bvh.Nodes()[stack.back()];
+      stack.pop_back();
+      if (!overlaps(node.boxMin, node.boxMax, boxMin, boxMax))
+        continue;
+
+      if (node.primsNum == 0)
+      {
+        stack.push_back(node.first);
+        stack.push_back(node.first + 1);
+        continue;
+      }
+
+      for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+      {
+        const uint32_t prim = a_bvh.PrimIndices()[i];
+        const Box4f& box = a_boxes[prim];
+        if (!is_empty(box) && overlaps(xyz(box.boxMin), xyz(box.boxMax), boxMin, boxMax))
+          a_found.push_back(prim);
+      }
+    }
+    std::sort(a_found.begin(), a_found.end());
+  }
+
+  // every node box has to contain its children, otherwise a query may skip primitives
+  bool bounds_valid(const Bvh& a_bvh, const std::vector<Box4f>& a_boxes)
+  {
+    auto contains = [](const Bvh::Node& node, const float3& bMin, const float3& bMax)
+    {
+      return node.boxMin.x <= bMin.x && node.boxMin.y <= bMin.y && node.boxMin.z <= bMin.z &&
+             bMax.x <= node.boxMax.x && bMax.y <= node.boxMax.y && bMax.z <= node.boxMax.z;
+    };
+
+    for (const Bvh::Node& node : a_bvh.Nodes())
+    {
+      if (node.primsNum == 0)
+      {
+        for (uint32_t child = node.first; child <= node.first + 1; ++child)
+        {
+          const Bvh::Node& c = a_bvh.Nodes()[child];
+          if (c.boxMin.x <= c.boxMax.x && !contains(node, c.boxMin, c.boxMax))
+            return false;
+        }
+        continue;
+      }
+      for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+      {
+        const Box4f& box = a_boxes[a_bvh.PrimIndices()[i]];
+        if (!is_empty(box) && !contains(node, xyz(box.boxMin), xyz(box.boxMax)))
+          return false;
+      }
+    }
+    return true;
+  }
+}
+
+int main()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> extent(0.5f, 5.0f);
+  std::uniform_real_distribution<float> offset(-50.0f, 50.0f);
+  auto pick = [&gen](size_t a_num) { return std::uniform_int_distribution<size_t>(0, a_num - 1)(gen); };
+
+  auto randomBox = [&]()
+  {
+    const float4 center(position(gen), position(gen), position(gen), 1.0f);
+    const float halfSize = extent(gen);
+    Box4f box;
+    box.boxMin = center - float4(halfSize, halfSize, halfSize, 0.0f);
+    box.boxMax = center + float4(halfSize, halfSize, halfSize, 0.0f);
+    return box;
+  };
+
+  // the boxes SceneManager would hand out, removed ids are reused by the next add like in InstanceMesh
+  std::vector<Box4f> boxes(INSTANCES_NUM);
+  std::vector<Box4f> unmarkedBoxes(INSTANCES_NUM); // what an unmarked instance gets back when marked again
+  std::vector<uint8_t> removed(INSTANCES_NUM, 0), unmarked(INSTANCES_NUM, 0);
+  std::vector<uint32_t> freeIds;
+  for (auto& box : boxes)
+    box = randomBox();
+
+  FrustumCuller culler;
+  culler.SetBoxes(boxes);
+  Bvh bvh;
+  bvh.Build(boxes);
+
+  std::vector<uint32_t> updated;
+  std::vector<uint32_t> expected, actual, rebuiltFound;
+  uint32_t cullingMismatches = 0, bvhMismatches = 0, rebuilds = 0;
+
+  const auto proj = LiteMath::perspectiveMatrix(60.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+
+  for (uint32_t step = 0; step < STEPS; ++step)
+  {
+    // adding an instance or marking one again makes Refit refuse, every other step leaves them out
+    // so that the refit path gets as much coverage as the rebuild one
+    const bool refitOnly = step % 2 == 1;
+    updated.clear();
+    for (uint32_t edit = 0; edit < EDITS_PER_STEP; ++edit)
+    {
+      const uint32_t instId = uint32_t(pick(boxes.size()));
+      switch (refitOnly ? 1 + pick(4) : pick(5))
+      {
+        case 0: // add, reuses the ids removed by case 1
+        {
+          if (freeIds.empty())
+          {
+            boxes.push_back(randomBox());
+            unmarkedBoxes.emplace_back();
+            removed.push_back(0);
+            unmarked.push_back(0);
+            updated.push_back(uint32_t(boxes.size() - 1));
+            break;
+          }
+          const uint32_t freeId = freeIds.back();
+          freeIds.pop_back();
+          boxes[freeId] = randomBox();
+          removed[freeId] = 0;
+          updated.push_back(freeId);
+          break;
+        }
+        case 1: // remove
+        {
+          if (removed[instId])
+            break;
+          boxes[instId] = empty_box();
+          removed[instId]  = 1;
+          unmarked[instId] = 0;
+          freeIds.push_back(instId);
+          updated.push_back(instId);
+          break;
+        }
+        case 2:
+        case 3: // move
+        {
+          if (removed[instId] || unmarked[instId])
+            break;
+          const float4 delta(offset(gen), offset(gen), offset(gen), 0.0f);
+          boxes[instId].boxMin = boxes[instId].boxMin + delta;
+          boxes[instId].boxMax = boxes[instId].boxMax + delta;
+          updated.push_back(instId);
+          break;
+        }
+        default: // unmark or mark again
+        {
+          if (removed[instId] || (refitOnly && unmarked[instId]))
+            break;
+          if (unmarked[instId])
+            boxes[instId] = unmarkedBoxes[instId];
+          else
+          {
+            unmarkedBoxes[instId] = boxes[instId];
+            boxes[instId] = empty_box();
+          }
+          unmarked[instId] ^= 1;
+          updated.push_back(instId);
+          break;
+        }
+      }
+    }
+
+    // the same updates UpdateSceneInstances and SceneBvh::Refit do
+    if (culler.BoxesNum() != boxes.size())
+      culler.SetBoxes(boxes);
+    else
+    {
+      for (uint32_t instId : updated)
+        culler.SetBox(instId, boxes[instId]);
+    }
+    if (!bvh.Refit(boxes))
+    {
+      bvh.Build(boxes);
+      rebuilds++;
+    }
+
+    const float angle = 6.2831853f * float(step) / 64.0f;
+    const auto view = LiteMath::lookAt(float3(0.0f, 0.0f, 0.0f), float3(std::cos(angle), 0.0f, std::sin(angle)),
+      float3(0.0f, 1.0f, 0.0f));
+    FrustumCuller rebuiltCuller;
+    rebuiltCuller.SetBoxes(boxes);
+    rebuiltCuller.Cull(proj * view, expected);
+    culler.Cull(proj * view, actual);
+    if (expected != actual)
+      cullingMismatches++;
+
+    Bvh rebuilt;
+    rebuilt.Build(boxes);
+    // a box around a random point, large enough to catch a few dozen instances
+    Box4f queryBox = randomBox();
+    queryBox.boxMin = queryBox.boxMin - float4(100.0f, 100.0f, 100.0f, 0.0f);
+    queryBox.boxMax = queryBox.boxMax + float4(100.0f, 100.0f, 100.0f, 0.0f);
+
+    expected.clear();
+    for (uint32_t instId = 0; instId < boxes.size(); ++instId)
+    {
+      if (!is_empty(boxes[instId]) && overlaps(xyz(boxes[instId].boxMin), xyz(boxes[instId].boxMax),
+        xyz(queryBox.boxMin), xyz(queryBox.boxMax)))
+        expected.push_back(instId);
+    }
+    query_box(bvh, boxes, queryBox, actual);
+    query_box(rebuilt, boxes, queryBox, rebuiltFound);
+    if (!bounds_valid(bvh, boxes) || actual != expected || rebuiltFound != expected)
+      bvhMismatches++;
+  }
+
+  std::cout << "Steps: " << STEPS << " with " << EDITS_PER_STEP << " edits, instances at the end: " << boxes.size()
+            << ", BVH refits: " << STEPS - rebuilds << ", rebuilds after a refused refit: " << rebuilds << std::endl;
+  std::cout << "Mismatches with a rebuild: culling " << cullingMismatches << ", BVH " << bvhMismatches << std::endl;
+
+  if (cullingMismatches != 0 || bvhMismatches != 0)
+  {
+    std::cout << "ERROR: incremental updates and rebuilds disagree" << std::endl;
+    return 1;
+  }
+  return 0;
+}
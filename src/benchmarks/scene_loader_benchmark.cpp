@@ -0,0 +1,115 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "loader_utils/hydraxml.h"
+#include "loader_utils/hydraxml_stream.h"
+
+// Generates a scene with many instances of a few meshes, mesh files only have to exist
+static std::string generate_scene(const std::filesystem::path& dir, uint32_t meshesNum, uint32_t instancesNum)
+{
+  std::filesystem::create_directories(dir / "data");
+
+  std::ofstream xml(dir / "statex_00001.xml");
+  xml << "<?xml version=\"1.0\"?>\n<textures_lib>\n</textures_lib>\n<materials_lib>\n</materials_lib>\n<geometry_lib>\n";
+  for (uint32_t i = 0; i < meshesNum; ++i)
+  {
+    const std::string loc = "data/mesh_" + std::to_string(i) + ".vsgf";
+    std::ofstream(dir / loc) << "dummy";
+    xml << "  <mesh id=\"" << i << "\" name=\"mesh_" << i << "\" type=\"vsgf\" bytesize=\"5\" loc=\"" << loc << "\" offset=\"0\" "
+        << "vertNum=\"0\" triNum=\"0\" dl=\"0\" path=\"\" bbox=\"0 0 0 0 0 0\">\n    <positions type=\"array4f\" bytesize=\"0\" offset=\"0\" apply=\"vertex\" />\n  </mesh>\n";
+  }
+  xml << "</geometry_lib>\n<lights_lib>\n</lights_lib>\n<cam_lib>\n"
+      << "  <camera id=\"0\" name=\"my camera\" type=\"uvn\">\n    <fov>45</fov>\n    <nearClipPlane>0.01</nearClipPlane>\n"
+      << "    <farClipPlane>100.0</farClipPlane>\n    <up>0 1 0</up>\n    <position>0 0 15</position>\n    <look_at>0 0 0</look_at>\n  </camera>\n"
+      << "</cam_lib>\n<render_lib>\n</render_lib>\n<scenes>\n  <scene id=\"0\" name=\"my scene\" discard=\"1\" bbox=\"0 0 0 0 0 0\">\n";
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  for (uint32_t i = 0; i < instancesNum; ++i)
+    xml << "    <instance id=\"" << i << "\" mesh_id=\"" << gen() % meshesNum << "\" rmap_id=\"-1\" scn_id=\"0\" scn_sid=\"0\" "
+        << "matrix=\"1 0 0 " << position(gen) << " 0 1 0 " << position(gen) << " 0 0 1 " << position(gen) << " 0 0 0 1 \" />\n";
+  xml << "  </scene>\n</scenes>\n";
+
+  return (dir / "statex_00001.xml").string();
+}
+
+// Scene description loading through the pugixml DOM against the streaming reader.
+// Takes a scene path or generates 100k instances of 16 meshes in a temporary directory.
+int main(int argc, char** argv)
+{
+  constexpr uint32_t ITERATIONS = 5;
+
+  std::string scenePath;
+  if (argc > 1)
+    scenePath = argv[1];
+  else
+    scenePath = generate_scene(std::filesystem::temp_directory_path() / "scene_loader_benchmark", 16, 100000);
+
+  auto measure = [&](auto&& load)
+  {
+    double bestMs = 1e30;
+    for (uint32_t i = 0; i < ITERATIONS; ++i)
+    {
+      const auto start = std::chrono::high_resolution_clock::now();
+      load();
+      const auto end = std::chrono::high_resolution_clock::now();
+      bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return bestMs;
+  };
+
+  std::vector<std::string> meshLocs;
+  std::vector<std::vector<LiteMath::float4x4>> instances;
+  std::vector<hydra_xml::Camera> cameras;
+  const double domMs = measure([&]()
+  {
+    hydra_xml::HydraScene scene;
+    scene.LoadState(scenePath);
+    meshLocs.clear();
+    instances.clear();
+    cameras.clear();
+    for (auto loc : scene.MeshFiles())
+    {
+      meshLocs.push_back(loc);
+      instances.push_back(scene.GetAllInstancesOfMeshLoc(loc));
+    }
+    for (auto cam : scene.Cameras())
+      cameras.push_back(cam);
+  });
+
+  hydra_xml::SceneDescription description;
+  const double streamMs = measure([&]()
+  {
+    description = {};
+    hydra_xml::LoadSceneDescription(scenePath, description);
+  });
+
+  std::cout << "Meshes: " << description.meshLocs.size() << ", instances: " << description.instanceMeshes.size() << std::endl;
+  std::cout << "HydraScene: " << domMs << " ms, LoadSceneDescription: " << streamMs << " ms, speedup " << domMs / streamMs << "x" << std::endl;
+
+  bool same = meshLocs == description.meshLocs && cameras.size() == description.cameras.size();
+  for (size_t m = 0; same && m < meshLocs.size(); ++m)
+  {
+    size_t k = 0;
+    for (size_t i = 0; same && i < description.instanceMeshes.size(); ++i)
+    {
+      if (description.instanceMeshes[i] != m)
+        continue;
+      same = k < instances[m].size() && std::memcmp(&instances[m][k], &description.instanceMatrices[i], sizeof(LiteMath::float4x4)) == 0;
+      ++k;
+    }
+    same = same && k == instances[m].size();
+  }
+
+  if (!same)
+  {
+    std::cout << "ERROR: streaming reader and HydraScene disagree" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,314 @@
+#include "hydraxml_stream.h"
+#include "mapped_file.h"
+
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+
+namespace hydra_xml
+{
+  static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+  // Parses up to count floats separated by whitespace, returns how many were read
+  static int read_floats(std::string_view str, float* out, int count)
+  {
+    const char* p   = str.data();
+    const char* end = str.data() + str.size();
+    int read = 0;
+    while(read < count)
+    {
+      while(p < end && (is_space(*p) || *p == '+'))
+        ++p;
+      auto [next, ec] = std::from_chars(p, end, out[read]);
+      if(ec != std::errc())
+        break;
+      p = next;
+      ++read;
+    }
+    return read;
+  }
+
+  static LiteMath::float3 read3f(std::string_view str)
+  {
+    float data[3] = {0.0f, 0.0f, 0.0f};
+    read_floats(str, data, 3);
+    return LiteMath::float3(data[0], data[1], data[2]);
+  }
+
+  static LiteMath::float4x4 read_matrix(std::string_view str)
+  {
+    float data[16] = {};
+    read_floats(str, data, 16);
+
+    LiteMath::float4x4 result;
+    result.set_row(0, LiteMath::float4(data[0],  data[1],  data[2],  data[3]));
+    result.set_row(1, LiteMath::float4(data[4],  data[5],  data[6],  data[7]));
+    result.set_row(2, LiteMath::float4(data[8],  data[9],  data[10], data[11]));
+    result.set_row(3, LiteMath::float4(data[12], data[13], data[14], data[15]));
+    return result;
+  }
+
+  // Only the predefined entities, which is all a path can contain
+  static std::string decode_entities(std::string_view str)
+  {
+    std::string result;
+    result.reserve(str.size());
+    for(size_t i = 0; i < str.size(); ++i)
+    {
+      if(str[i] == '&')
+      {
+        static constexpr std::pair<std::string_view, char> entities[] =
+          {{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+        bool decoded = false;
+        for(const auto& [entity, c] : entities)
+        {
+          if(str.substr(i, entity.size()) == entity)
+          {
+            result.push_back(c);
+            i += entity.size() - 1;
+            decoded = true;
+            break;
+          }
+        }
+        if(decoded)
+          continue;
+      }
+      result.push_back(str[i]);
+    }
+    return result;
+  }
+
+  struct Tag
+  {
+    std::string_view name;
+    std::string_view attributes;
+    bool closing     = false;
+    bool selfClosing = false;
+  };
+
+  static std::string_view find_attribute(std::string_view attributes, std::string_view name)
+  {
+    size_t pos = 0;
+    while(pos < attributes.size())
+    {
+      while(pos < attributes.size() && is_space(attributes[pos]))
+        ++pos;
+      size_t eq = attributes.find('=', pos);
+      if(eq == std::string_view::npos)
+        break;
+      size_t nameEnd = eq;
+      while(nameEnd > pos && is_space(attributes[nameEnd - 1]))
+        --nameEnd;
+
+      size_t quote = eq + 1;
+      while(quote < attributes.size() && is_space(attributes[quote]))
+        ++quote;
+      if(quote >= attributes.size())
+        break;
+      size_t valueEnd = attributes.find(attributes[quote], quote + 1);
+      if(valueEnd == std::string_view::npos)
+        break;
+
+      if(attributes.substr(pos, nameEnd - pos) == name)
+        return attributes.substr(quote + 1, valueEnd - quote - 1);
+      pos = valueEnd + 1;
+    }
+    return {};
+  }
+
+  int LoadSceneDescription(const std::string &path, SceneDescription &scene)
+  {
+    MappedFile file(path, true);
+    if(!file.Valid())
+    {
+      std::cout << "HydraScene ERROR: Error loading scene from: " << path << std::endl;
+      return -1;
+    }
+
+    const std::string libraryRootDir = path.substr(0, path.find_last_of('/'));
+    const std::string_view xml = file.View();
+
+    enum class Lib { NONE, GEOMETRY, CAMERAS, SCENES } lib = Lib::NONE;
+    uint32_t depth = 0;
+    bool geometryLibFound = false, camLibFound = false, scenesFound = false;
+    bool firstSceneDone = false, inFirstScene = false, instancesDone = false;
+    std::string_view cameraField;
+
+    std::unordered_map<std::string_view, uint32_t> meshIndexById;
+    std::vector<std::string_view> instanceMeshIds;
+
+    size_t pos = 0;
+    while(pos < xml.size())
+    {
+      size_t open = xml.find('<', pos);
+      if(open == std::string_view::npos)
+        break;
+
+      // text content is only needed for camera fields like <fov>45</fov>
+      if(lib == Lib::CAMERAS && depth == 3 && !cameraField.empty())
+      {
+        std::string_view text = xml.substr(pos, open - pos);
+        Camera& cam = scene.cameras.back();
+        if(cameraField == "fov")
+          read_floats(text, &cam.fov, 1);
+        else if(cameraField == "nearClipPlane")
+          read_floats(text, &cam.nearPlane, 1);
+        else if(cameraField == "farClipPlane")
+          read_floats(text, &cam.farPlane, 1);
+        else if(cameraField == "position" || cameraField == "look_at" || cameraField == "up")
+        {
+          LiteMath::float3 value = read3f(text);
+          float* dst = cameraField == "position" ? cam.pos : (cameraField == "look_at" ? cam.lookAt : cam.up);
+          dst[0] = value.x; dst[1] = value.y; dst[2] = value.z;
+        }
+      }
+
+      if(xml.compare(open, 4, "<!--") == 0)
+      {
+        size_t close = xml.find("-->", open + 4);
+        pos = close == std::string_view::npos ? xml.size() : close + 3;
+        continue;
+      }
+      if(xml.compare(open, 2, "<?") == 0 || xml.compare(open, 2, "<!") == 0)
+      {
+        size_t close = xml.find('>', open);
+        pos = close == std::string_view::npos ? xml.size() : close + 1;
+        continue;
+      }
+
+      // attribute values may contain '>', so the tag end is searched outside of quotes
+      size_t close = open + 1;
+      char quote = 0;
+      while(close < xml.size() && (quote != 0 || xml[close] != '>'))
+      {
+        if(quote == 0 && (xml[close] == '"' || xml[close] == '\''))
+          quote = xml[close];
+        else if(quote == xml[close])
+          quote = 0;
+        ++close;
+      }
+      if(close >= xml.size())
+        break;
+
+      Tag tag;
+      std::string_view body = xml.substr(open + 1, close - open - 1);
+      tag.closing = !body.empty() && body.front() == '/';
+      if(tag.closing)
+        body.remove_prefix(1);
+      tag.selfClosing = !body.empty() && body.back() == '/';
+      if(tag.selfClosing)
+        body.remove_suffix(1);
+      size_t nameEnd = 0;
+      while(nameEnd < body.size() && !is_space(body[nameEnd]))
+        ++nameEnd;
+      tag.name = body.substr(0, nameEnd);
+      tag.attributes = body.substr(nameEnd);
+      pos = close + 1;
+
+      if(tag.closing)
+      {
+        --depth;
+        if(depth == 0)
+        {
+          lib = Lib::NONE;
+          // nothing else is needed once all three libraries are read
+          if(geometryLibFound && camLibFound && scenesFound)
+            break;
+        }
+        else if(depth == 1 && lib == Lib::SCENES && inFirstScene)
+        {
+          inFirstScene   = false;
+          firstSceneDone = true;
+        }
+        else if(depth == 2 && lib == Lib::CAMERAS)
+          cameraField = {};
+        continue;
+      }
+
+      if(depth == 0)
+      {
+        if(tag.name == "geometry_lib")
+        {
+          lib = Lib::GEOMETRY;
+          geometryLibFound = true;
+        }
+        else if(tag.name == "cam_lib")
+        {
+          lib = Lib::CAMERAS;
+          camLibFound = true;
+        }
+        else if(tag.name == "scenes")
+        {
+          lib = Lib::SCENES;
+          scenesFound = true;
+        }
+      }
+      else if(lib == Lib::GEOMETRY && depth == 1)
+      {
+        meshIndexById[find_attribute(tag.attributes, "id")] = uint32_t(scene.meshLocs.size());
+        scene.meshLocs.push_back(libraryRootDir + "/" + decode_entities(find_attribute(tag.attributes, "loc")));
+      }
+      else if(lib == Lib::CAMERAS)
+      {
+        if(depth == 1)
+          scene.cameras.push_back(Camera{});
+        else if(depth == 2 && !tag.selfClosing)
+          cameraField = tag.name;
+      }
+      else if(lib == Lib::SCENES)
+      {
+        if(depth == 1 && !firstSceneDone)
+          inFirstScene = true;
+        else if(depth == 2 && inFirstScene && !instancesDone)
+        {
+          if(tag.name == "instance_light")
+            instancesDone = true;
+          else if(tag.name == "instance")
+          {
+            instanceMeshIds.push_back(find_attribute(tag.attributes, "mesh_id"));
+            scene.instanceMatrices.push_back(read_matrix(find_attribute(tag.attributes, "matrix")));
+          }
+        }
+      }
+
+      if(!tag.selfClosing)
+        ++depth;
+    }
+
+    if(!geometryLibFound || !camLibFound || !scenesFound)
+    {
+      std::cout << "HydraScene ERROR: Loaded state (" << path << ") doesn't have one of (cam_lib, geometry_lib, scenes)" << std::endl;
+      return -1;
+    }
+
+    // existence is checked once per mesh rather than once per instance
+    std::vector<int> meshExists(scene.meshLocs.size(), -1);
+    size_t kept = 0;
+    scene.instanceMeshes.reserve(instanceMeshIds.size());
+    for(size_t i = 0; i < instanceMeshIds.size(); ++i)
+    {
+      auto found = meshIndexById.find(instanceMeshIds[i]);
+      if(found == meshIndexById.end())
+        continue;
+
+      const uint32_t meshIdx = found->second;
+      if(meshExists[meshIdx] < 0)
+      {
+        meshExists[meshIdx] = std::filesystem::exists(scene.meshLocs[meshIdx]) ? 1 : 0;
+        if(meshExists[meshIdx] == 0)
+          std::cout << "HydraScene ERROR: Mesh not found at: " << scene.meshLocs[meshIdx] << ". Loader will skip it." << std::endl;
+      }
+      if(meshExists[meshIdx] == 0)
+        continue;
+
+      scene.instanceMeshes.push_back(meshIdx);
+      scene.instanceMatrices[kept++] = scene.instanceMatrices[i];
+    }
+    scene.instanceMatrices.resize(kept);
+
+    return 0;
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef HYDRAXML_STREAM_H
+#define HYDRAXML_STREAM_H
+
+#include <string>
+#include <vector>
+
+#include "hydraxml.h"
+
+namespace hydra_xml
+{
+  // Everything SceneManager needs from a scene XML, in compact arrays.
+  struct SceneDescription
+  {
+    std::vector<std::string> meshLocs;             ///< full paths, geometry_lib order
+    std::vector<uint32_t> instanceMeshes;          ///< index into meshLocs, first scene order
+    std::vector<LiteMath::float4x4> instanceMatrices;
+    std::vector<Camera> cameras;
+  };
+
+  // Single pass over the memory-mapped file without building a DOM and without wide strings.
+  // Gives the same meshes, instances and cameras as HydraScene: instances are read from the
+  // first scene up to the first instance_light, instances of meshes missing on disk are skipped.
+  // Returns -1 on error like HydraScene::LoadState.
+  int LoadSceneDescription(const std::string &path, SceneDescription &scene);
+}
+
+#endif //HYDRAXML_STREAM_H
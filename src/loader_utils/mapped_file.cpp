@@ -0,0 +1,62 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string &path, bool sequential)
+{
+#if defined(_WIN32)
+  (void)sequential;
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+    return;
+  m_file = file;
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    return;
+  m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(m_mapping == nullptr)
+    return;
+  m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+  m_size = m_data != nullptr ? size_t(size.QuadPart) : 0;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return;
+  struct stat st = {};
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data != MAP_FAILED)
+    {
+      if(sequential)
+        madvise(data, size_t(st.st_size), MADV_SEQUENTIAL);
+      m_data = static_cast<const char*>(data);
+      m_size = size_t(st.st_size);
+    }
+  }
+  close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+  if(m_data != nullptr)
+    UnmapViewOfFile(m_data);
+  if(m_mapping != nullptr)
+    CloseHandle(m_mapping);
+  if(m_file != nullptr)
+    CloseHandle(m_file);
+#else
+  if(m_data != nullptr)
+    munmap(const_cast<char*>(m_data), m_size);
+#endif
+}
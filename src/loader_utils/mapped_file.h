@@ -0,0 +1,32 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file, empty files are reported as not valid.
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string &path, bool sequential = false);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* Data() const { return m_data; }
+  size_t Size() const { return m_size; }
+  std::string_view View() const { return {m_data, m_size}; }
+  bool Valid() const { return m_data != nullptr; }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+#if defined(_WIN32)
+  void* m_file    = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
+
+#endif //MAPPED_FILE_H
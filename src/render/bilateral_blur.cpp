@@ -0,0 +1,164 @@
+#include <fstream>
+
+#include "bilateral_blur.h"
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+
+
+// workgroup size along the blurred line, see bilateral_blur.comp
+static constexpr uint32_t BLUR_GROUP_SIZE = 128;
+static const char* BLUR_SHADER_PATH = VK_GRAPHICS_BASIC_ROOT "/resources/shaders/bilateral_blur.comp.spv";
+
+BilateralBlur::BilateralBlur(VkDevice a_device, CreateSetFunc a_createSet)
+  : m_device(a_device), m_createSet(std::move(a_createSet))
+{
+  // only reflected here, the descriptor set layout of the pipelines is etna's
+  m_programId = etna::create_program("bilateral_blur", {BLUR_SHADER_PATH});
+  if(!m_createSet)
+  {
+    m_createSet = [](etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff, std::vector<etna::Binding> a_bindings)
+    {
+      return VkDescriptorSet(etna::create_descriptor_set(a_layoutId, a_cmdBuff, std::move(a_bindings)).getVkSet());
+    };
+  }
+}
+
+BilateralBlur::~BilateralBlur()
+{
+  Reload();
+}
+
+void BilateralBlur::Reload()
+{
+  for(const auto& variant : m_variants)
+    vkDestroyPipeline(m_device, variant.pipeline, nullptr);
+  m_variants.clear();
+
+  if(m_pipelineLayout != VK_NULL_HANDLE)
+    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
+  m_pipelineLayout = VK_NULL_HANDLE;
+}
+
+VkPipeline BilateralBlur::GetPipeline(const Config& a_config)
+{
+  for(const auto& variant : m_variants)
+  {
+    if(variant.config == a_config)
+      return variant.pipeline;
+  }
+
+  auto programInfo = etna::get_shader_program(m_programId);
+  if(m_pipelineLayout == VK_NULL_HANDLE)
+  {
+    VkDescriptorSetLayout setLayout = etna::get_context().getDescriptorSetLayouts().getVkLayout(
+      programInfo.getDescriptorLayoutId(0));
+
+    VkPushConstantRange pushConstants = {};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.size       = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount         = 1;
+    layoutInfo.pSetLayouts            = &setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges    = &pushConstants;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(m_device, &layoutInfo, nullptr, &m_pipelineLayout));
+  }
+
+  std::ifstream file(BLUR_SHADER_PATH, std::ios::binary | std::ios::ate);
+  if(!file.is_open())
+    RUN_TIME_ERROR("[BilateralBlur::GetPipeline] can't open bilateral_blur.comp.spv");
+  std::vector<uint32_t> code(size_t(file.tellg()) / sizeof(uint32_t));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(code.data()), std::streamsize(code.size() * sizeof(uint32_t)));
+
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size() * sizeof(uint32_t);
+  moduleInfo.pCode    = code.data();
+  VkShaderModule shaderModule = VK_NULL_HANDLE;
+  VK_CHECK_RESULT(vkCreateShaderModule(m_device, &moduleInfo, nullptr, &shaderModule));
+
+  // constant_id 0, 1 and 2 of bilateral_blur.comp
+  struct
+  {
+    int32_t radius;
+    float sigma;
+    float depthThreshold;
+  } constants = {int32_t(a_config.radius), a_config.sigma > 0.0f ? a_config.sigma : float(a_config.radius) / 3.0f,
+    a_config.depthThreshold};
+  const VkSpecializationMapEntry entries[] =
+  {
+    {0, 0, sizeof(int32_t)},
+    {1, sizeof(int32_t), sizeof(float)},
+    {2, sizeof(int32_t) + sizeof(float), sizeof(float)}
+  };
+  VkSpecializationInfo specialization = {};
+  specialization.mapEntryCount = 3;
+  specialization.pMapEntries   = entries;
+  specialization.dataSize      = sizeof(constants);
+  specialization.pData         = &constants;
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType                     = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType               = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage               = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module              = shaderModule;
+  pipelineInfo.stage.pName               = "main";
+  pipelineInfo.stage.pSpecializationInfo = &specialization;
+  pipelineInfo.layout                    = m_pipelineLayout;
+
+  Variant variant;
+  variant.config = a_config;
+  VK_CHECK_RESULT(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &variant.pipeline));
+  vkDestroyShaderModule(m_device, shaderModule, nullptr);
+
+  m_variants.push_back(variant);
+  return variant.pipeline;
+}
+
+void BilateralBlur::RecordCommands(VkCommandBuffer a_cmdBuff, const Config& a_config, const etna::Image& a_image,
+  const etna::Image& a_temp, VkExtent2D a_extent, const etna::Image& a_depth, uint32_t a_depthScale,
+  const LiteMath::float4x4& a_projInverse, const etna::Sampler& a_sampler)
+{
+  VkPipeline pipeline = GetPipeline(a_config);
+
+  // only z and w of projInverse * (0, 0, d, 1) are needed for the view space depth
+  const LiteMath::float4 row2 = a_projInverse.get_row(2);
+  const LiteMath::float4 row3 = a_projInverse.get_row(3);
+
+  PushConstants params = {};
+  params.depthScale     = int32_t(a_depthScale);
+  params.depthUnproject = LiteMath::float4(row2.z, row2.w, row3.z, row3.w);
+
+  params.direction[0] = 1;
+  params.direction[1] = 0;
+  RecordPass(a_cmdBuff, pipeline, a_image, a_temp, a_extent.width, a_extent.height, params, a_depth, a_sampler);
+
+  params.direction[0] = 0;
+  params.direction[1] = 1;
+  RecordPass(a_cmdBuff, pipeline, a_temp, a_image, a_extent.height, a_extent.width, params, a_depth, a_sampler);
+}
+
+void BilateralBlur::RecordPass(VkCommandBuffer a_cmdBuff, VkPipeline a_pipeline, const etna::Image& a_src,
+  const etna::Image& a_dst, uint32_t a_lineLength, uint32_t a_linesNum, const PushConstants& a_params,
+  const etna::Image& a_depth, const etna::Sampler& a_sampler)
+{
+  auto programInfo = etna::get_shader_program(m_programId);
+  // etna records the transitions of the images, so the second pass waits for the first one
+  VkDescriptorSet vkSet = m_createSet(programInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  {
+    etna::Binding {0, a_src.genBinding(a_sampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+    etna::Binding {1, a_dst.genBinding(a_sampler.get(), vk::ImageLayout::eGeneral)},
+    etna::Binding {2, a_depth.genBinding(a_sampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)}
+  });
+  etna::flush_barriers(a_cmdBuff);
+
+  vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+  vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, a_pipeline);
+  vkCmdPushConstants(a_cmdBuff, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &a_params);
+  // a workgroup per BLUR_GROUP_SIZE pixels of a line
+  vkCmdDispatch(a_cmdBuff, (a_lineLength + BLUR_GROUP_SIZE - 1) / BLUR_GROUP_SIZE, a_linesNum, 1);
+}
@@ -0,0 +1,76 @@
+#ifndef CHIMERA_BILATERAL_BLUR_H
+#define CHIMERA_BILATERAL_BLUR_H
+
+#include <functional>
+#include <vector>
+
+#include <vk_utils.h>
+#include <etna/DescriptorSet.hpp>
+#include <etna/Image.hpp>
+#include <etna/ShaderProgram.hpp>
+#include <etna/Sampler.hpp>
+#include "LiteMath.h"
+
+// Separable depth aware gaussian blur, see resources/shaders/bilateral_blur.comp.
+// The image is blurred in place with a horizontal dispatch into a temporary image and a vertical one back.
+// Kernel radius, sigma and depth threshold are specialization constants, etna's compute pipelines don't take
+// any, so the pipelines are created here, one per Config, with a layout that adds the push constants to the
+// descriptor set layout etna reflects from the shader.
+class BilateralBlur
+{
+public:
+  struct Config
+  {
+    uint32_t radius = 11;
+    float sigma = 0.0f;          // radius / 3 if 0
+    float depthThreshold = 0.1f; // max view space depth difference of the averaged pixels
+    bool operator==(const Config&) const = default;
+  };
+
+  // Reusable command buffers can't reference etna's per frame descriptor sets, so the owner may allocate them
+  using CreateSetFunc = std::function<VkDescriptorSet(etna::DescriptorLayoutId, VkCommandBuffer, std::vector<etna::Binding>)>;
+
+  explicit BilateralBlur(VkDevice a_device, CreateSetFunc a_createSet = {});
+  ~BilateralBlur();
+
+  BilateralBlur(const BilateralBlur&) = delete;
+  BilateralBlur& operator=(const BilateralBlur&) = delete;
+
+  // Destroys the pipelines, they are created from the current SPIR-V the next time they are used.
+  // Call after etna::reload_shaders, none of them may be used by pending command buffers.
+  void Reload();
+
+  // a_image and a_temp: a_extent sized storage images of the same format, the result ends up in a_image.
+  // a_depth texel a_depthScale * p is the depth of pixel p.
+  void RecordCommands(VkCommandBuffer a_cmdBuff, const Config& a_config, const etna::Image& a_image,
+    const etna::Image& a_temp, VkExtent2D a_extent, const etna::Image& a_depth, uint32_t a_depthScale,
+    const LiteMath::float4x4& a_projInverse, const etna::Sampler& a_sampler);
+
+private:
+  struct PushConstants
+  {
+    int32_t direction[2];
+    int32_t depthScale;
+    int32_t pad;
+    LiteMath::float4 depthUnproject; // view z = (x * d + y) / (z * d + w) of depth d
+  };
+
+  struct Variant
+  {
+    Config config;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+  };
+
+  VkPipeline GetPipeline(const Config& a_config);
+  void RecordPass(VkCommandBuffer a_cmdBuff, VkPipeline a_pipeline, const etna::Image& a_src, const etna::Image& a_dst,
+    uint32_t a_lineLength, uint32_t a_linesNum, const PushConstants& a_params, const etna::Image& a_depth,
+    const etna::Sampler& a_sampler);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  CreateSetFunc m_createSet;
+  etna::ShaderProgramId m_programId;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  std::vector<Variant> m_variants;
+};
+
+#endif//CHIMERA_BILATERAL_BLUR_H
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "frame_allocator.h"
+
+#include <etna/GlobalContext.hpp>
+
+
+FrameAllocator::FrameAllocator(VkDeviceSize a_frameSize, uint32_t a_framesInFlight, VkDeviceSize a_alignment)
+  : m_alignment(a_alignment)
+{
+  m_frameSize = vk_utils::getPaddedSize(a_frameSize, m_alignment);
+  m_buffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = m_frameSize * a_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+    .name = "frame_allocator"
+  });
+  m_mapped = reinterpret_cast<char*>(m_buffer.map());
+}
+
+void FrameAllocator::BeginFrame(uint32_t a_frame)
+{
+  m_frameStart = m_frameSize * a_frame;
+  m_used = 0;
+  m_lastSizes.swap(m_sizes);
+  m_sizes.clear();
+}
+
+FrameAllocator::Allocation FrameAllocator::Allocate(VkDeviceSize a_size)
+{
+  const VkDeviceSize paddedSize = vk_utils::getPaddedSize(a_size, m_alignment);
+  if(m_used + paddedSize > m_frameSize)
+    RUN_TIME_ERROR("[FrameAllocator::Allocate] frame segment is exhausted");
+
+  Allocation allocation;
+  allocation.offset = m_frameStart + m_used;
+  allocation.size   = a_size;
+  allocation.data   = m_mapped + allocation.offset;
+
+  m_used += paddedSize;
+  m_peakUsed = std::max(m_peakUsed, m_used);
+  m_sizes.push_back(a_size);
+  return allocation;
+}
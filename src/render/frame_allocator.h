@@ -0,0 +1,70 @@
+#ifndef CHIMERA_FRAME_ALLOCATOR_H
+#define CHIMERA_FRAME_ALLOCATOR_H
+
+#include <cstring>
+#include <vector>
+
+#include <vk_utils.h>
+#include <etna/Buffer.hpp>
+#include <etna/DescriptorSet.hpp>
+
+// Transient data written by the CPU once per frame: uniforms, culling parameters and the like.
+// One persistently mapped buffer is split into a segment per frame in flight, BeginFrame rewinds the segment
+// of the new frame and Allocate hands out aligned ranges of it, so a frame never overwrites data the GPU may
+// still be reading for the previous one.
+// Offsets end up in descriptor sets of recorded command buffers. They stay the same from frame to frame as long
+// as the same sizes are allocated in the same order, LayoutChanged tells when that is not the case.
+class FrameAllocator
+{
+public:
+  struct Allocation
+  {
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* data = nullptr;
+  };
+
+  FrameAllocator(VkDeviceSize a_frameSize, uint32_t a_framesInFlight, VkDeviceSize a_alignment);
+
+  FrameAllocator(const FrameAllocator&) = delete;
+  FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+  // The previous use of the frame slot must be complete on the GPU
+  void BeginFrame(uint32_t a_frame);
+
+  Allocation Allocate(VkDeviceSize a_size);
+
+  template<typename T>
+  Allocation Push(const T& a_value)
+  {
+    Allocation allocation = Allocate(sizeof(T));
+    memcpy(allocation.data, &a_value, sizeof(T));
+    return allocation;
+  }
+
+  etna::BufferBinding genBinding(const Allocation& a_allocation) const
+  {
+    return m_buffer.genBinding(a_allocation.offset, a_allocation.size);
+  }
+
+  // Whether the current frame allocated other sizes than the previous one so far
+  bool LayoutChanged() const { return m_sizes != m_lastSizes; }
+
+  VkDeviceSize FrameSize() const { return m_frameSize; }
+  VkDeviceSize Used() const { return m_used; }
+  VkDeviceSize PeakUsed() const { return m_peakUsed; }
+
+private:
+  etna::Buffer m_buffer;
+  char* m_mapped = nullptr;
+  VkDeviceSize m_frameSize = 0;
+  VkDeviceSize m_alignment = 1;
+
+  VkDeviceSize m_frameStart = 0;
+  VkDeviceSize m_used = 0;
+  VkDeviceSize m_peakUsed = 0;
+  std::vector<VkDeviceSize> m_sizes;
+  std::vector<VkDeviceSize> m_lastSizes;
+};
+
+#endif//CHIMERA_FRAME_ALLOCATOR_H
@@ -0,0 +1,334 @@
+#include "frame_graph.h"
+
+#include <algorithm>
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include <vk_utils.h>
+
+
+namespace
+{
+  struct UsageState
+  {
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout;
+    vk::ImageUsageFlags imageUsage;
+  };
+
+  UsageState usage_state(FrameGraph::Usage a_usage)
+  {
+    switch(a_usage)
+    {
+      case FrameGraph::Usage::COLOR_ATTACHMENT:
+        return {vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+          vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite,
+          vk::ImageLayout::eColorAttachmentOptimal, vk::ImageUsageFlagBits::eColorAttachment};
+      case FrameGraph::Usage::DEPTH_ATTACHMENT:
+        return {vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+          vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+          vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment};
+      case FrameGraph::Usage::SAMPLED_FRAGMENT:
+        return {vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead,
+          vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled};
+      case FrameGraph::Usage::SAMPLED_COMPUTE:
+        return {vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderSampledRead,
+          vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled};
+      case FrameGraph::Usage::STORAGE_COMPUTE:
+        return {vk::PipelineStageFlagBits2::eComputeShader,
+          vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+          vk::ImageLayout::eGeneral, vk::ImageUsageFlagBits::eStorage};
+      case FrameGraph::Usage::TRANSFER_DST:
+        return {vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+          vk::ImageLayout::eTransferDstOptimal, vk::ImageUsageFlagBits::eTransferDst};
+      default:
+        return {vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead,
+          vk::ImageLayout::eTransferSrcOptimal, vk::ImageUsageFlagBits::eTransferSrc};
+    }
+  }
+
+  vk::ImageAspectFlags aspect_of(vk::Format a_format)
+  {
+    switch(a_format)
+    {
+      case vk::Format::eD16Unorm:
+      case vk::Format::eX8D24UnormPack32:
+      case vk::Format::eD32Sfloat:
+        return vk::ImageAspectFlagBits::eDepth;
+      case vk::Format::eD16UnormS8Uint:
+      case vk::Format::eD24UnormS8Uint:
+      case vk::Format::eD32SfloatS8Uint:
+        return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+      default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+  }
+}
+
+void FrameGraph::PassBuilder::Read(ImageId a_image, Usage a_usage)
+{
+  m_graph.m_passes[m_pass].accesses.push_back(Access{a_image, a_usage, false});
+}
+
+void FrameGraph::PassBuilder::Write(ImageId a_image, Usage a_usage)
+{
+  m_graph.m_passes[m_pass].accesses.push_back(Access{a_image, a_usage, true});
+}
+
+void FrameGraph::PassBuilder::SideEffect()
+{
+  m_graph.m_passes[m_pass].sideEffect = true;
+}
+
+void FrameGraph::Reset()
+{
+  m_passes.clear();
+  m_resources.clear();
+}
+
+FrameGraph::ImageId FrameGraph::ImportImage(const std::string& a_name, const etna::Image& a_image, const ImageDesc& a_desc)
+{
+  Resource resource;
+  resource.name     = a_name;
+  resource.desc     = a_desc;
+  resource.imported = &a_image;
+  m_resources.push_back(resource);
+  return ImageId(m_resources.size() - 1);
+}
+
+FrameGraph::ImageId FrameGraph::CreateImage(const std::string& a_name, const ImageDesc& a_desc)
+{
+  Resource resource;
+  resource.name = a_name;
+  resource.desc = a_desc;
+  m_resources.push_back(resource);
+  return ImageId(m_resources.size() - 1);
+}
+
+void FrameGraph::AddPass(const std::string& a_name, const SetupFunc& a_setup, ExecuteFunc a_execute)
+{
+  Pass pass;
+  pass.name    = a_name;
+  pass.execute = std::move(a_execute);
+  m_passes.push_back(std::move(pass));
+
+  PassBuilder builder(*this, uint32_t(m_passes.size() - 1));
+  a_setup(builder);
+}
+
+void FrameGraph::Compile()
+{
+  CullPasses();
+  AssignImages();
+  BuildStateRequests();
+}
+
+void FrameGraph::CullPasses()
+{
+  // readers come after writers, so a single walk from the end finds every pass a kept one depends on
+  std::vector<bool> needed(m_resources.size(), false);
+  m_stats.passes       = uint32_t(m_passes.size());
+  m_stats.culledPasses = 0;
+  for(auto pass = m_passes.rbegin(); pass != m_passes.rend(); ++pass)
+  {
+    bool keep = pass->sideEffect;
+    for(const Access& access : pass->accesses)
+    {
+      if(access.write && (m_resources[access.image].imported != nullptr || needed[access.image]))
+        keep = true;
+    }
+
+    pass->culled = !keep;
+    if(!keep)
+    {
+      m_stats.culledPasses++;
+      continue;
+    }
+    for(const Access& access : pass->accesses)
+    {
+      if(!access.write)
+        needed[access.image] = true;
+    }
+  }
+}
+
+void FrameGraph::AssignImages()
+{
+  for(uint32_t passIdx = 0; passIdx < m_passes.size(); ++passIdx)
+  {
+    if(m_passes[passIdx].culled)
+      continue;
+    for(const Access& access : m_passes[passIdx].accesses)
+    {
+      Resource& resource = m_resources[access.image];
+      resource.usage |= usage_state(access.usage).imageUsage;
+      resource.firstPass = std::min(resource.firstPass, passIdx);
+      resource.lastPass  = std::max(resource.lastPass, passIdx);
+    }
+  }
+
+  // transient images in the order they are first used, each one takes the first image that is free by then
+  std::vector<uint32_t> transient;
+  for(uint32_t i = 0; i < m_resources.size(); ++i)
+  {
+    if(m_resources[i].imported == nullptr && m_resources[i].firstPass != UINT32_MAX)
+      transient.push_back(i);
+  }
+  std::sort(transient.begin(), transient.end(),
+    [this](uint32_t a, uint32_t b) { return m_resources[a].firstPass < m_resources[b].firstPass; });
+
+  std::vector<Physical> planned;
+  for(uint32_t resourceIdx : transient)
+  {
+    Resource& resource = m_resources[resourceIdx];
+    auto free = std::find_if(planned.begin(), planned.end(), [&resource](const Physical& physical) {
+      return physical.desc == resource.desc && physical.lastPass < resource.firstPass;
+    });
+    if(free == planned.end())
+    {
+      planned.emplace_back();
+      free = planned.end() - 1;
+      free->desc = resource.desc;
+    }
+    free->usage   |= resource.usage;
+    free->lastPass = resource.lastPass;
+    resource.physical = uint32_t(free - planned.begin());
+  }
+
+  // images that are planned again are kept, so recompiling an unchanged frame allocates nothing
+  bool released = false;
+  for(Physical& physical : planned)
+  {
+    auto old = std::find_if(m_physical.begin(), m_physical.end(), [&physical](const Physical& candidate) {
+      return candidate.desc == physical.desc && candidate.usage == physical.usage && candidate.image.get();
+    });
+    if(old != m_physical.end())
+    {
+      physical.image = std::move(old->image);
+      continue;
+    }
+
+    std::string name = "frame_graph";
+    for(uint32_t resourceIdx : transient)
+    {
+      if(&planned[m_resources[resourceIdx].physical] == &physical)
+        name += "_" + m_resources[resourceIdx].name;
+    }
+    physical.image = etna::get_context().createImage(etna::Image::CreateInfo
+    {
+      .extent     = physical.desc.extent,
+      .name       = name,
+      .format     = physical.desc.format,
+      .imageUsage = physical.usage,
+      .layers     = physical.desc.layers,
+      .mipLevels  = physical.desc.mipLevels
+    });
+  }
+  for(const Physical& old : m_physical)
+    released = released || old.image.get();
+  if(released)
+    ETNA_ASSERT(etna::get_context().getDevice().waitIdle() == vk::Result::eSuccess);
+  m_physical = std::move(planned);
+
+  const VkDevice device = etna::get_context().getDevice();
+  m_stats.transientImages = uint32_t(transient.size());
+  m_stats.allocatedImages = uint32_t(m_physical.size());
+  m_stats.transientBytes  = 0;
+  m_stats.allocatedBytes  = 0;
+  std::vector<VkDeviceSize> physicalBytes(m_physical.size());
+  for(size_t i = 0; i < m_physical.size(); ++i)
+  {
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, m_physical[i].image.get(), &requirements);
+    physicalBytes[i] = requirements.size;
+    m_stats.allocatedBytes += requirements.size;
+  }
+  for(uint32_t resourceIdx : transient)
+    m_stats.transientBytes += physicalBytes[m_resources[resourceIdx].physical];
+}
+
+void FrameGraph::BuildStateRequests()
+{
+  struct LastRead
+  {
+    uint32_t pass = UINT32_MAX;
+    size_t request = 0;
+  };
+  // the request of the read that started the current run of reads in one layout, per resource
+  std::vector<LastRead> readRuns(m_resources.size());
+
+  m_stats.stateRequests = 0;
+  m_stats.mergedReads   = 0;
+  for(uint32_t passIdx = 0; passIdx < m_passes.size(); ++passIdx)
+  {
+    Pass& pass = m_passes[passIdx];
+    pass.requests.clear();
+    if(pass.culled)
+      continue;
+
+    for(size_t accessIdx = 0; accessIdx < pass.accesses.size(); ++accessIdx)
+    {
+      // the first access of an image sets the state the pass starts with, the pass moves it on by itself
+      const Access& access = pass.accesses[accessIdx];
+      bool seen = false, written = false;
+      for(size_t other = 0; other < pass.accesses.size(); ++other)
+      {
+        if(pass.accesses[other].image != access.image)
+          continue;
+        seen    = seen || other < accessIdx;
+        written = written || pass.accesses[other].write;
+      }
+      if(seen)
+        continue;
+
+      const UsageState state = usage_state(access.usage);
+      LastRead& run = readRuns[access.image];
+      if(!written && run.pass != UINT32_MAX)
+      {
+        StateRequest& first = m_passes[run.pass].requests[run.request];
+        if(first.layout == state.layout)
+        {
+          first.stages |= state.stages;
+          first.access |= state.access;
+          m_stats.mergedReads++;
+          continue;
+        }
+      }
+
+      pass.requests.push_back(StateRequest{access.image, state.stages, state.access, state.layout});
+      m_stats.stateRequests++;
+      run = written ? LastRead{} : LastRead{passIdx, pass.requests.size() - 1};
+    }
+  }
+}
+
+void FrameGraph::Execute(VkCommandBuffer a_cmdBuff) const
+{
+  for(const Pass& pass : m_passes)
+  {
+    if(pass.culled)
+      continue;
+
+    for(const StateRequest& request : pass.requests)
+    {
+      const ImageDesc& desc = m_resources[request.image].desc;
+      etna::set_state(a_cmdBuff, GetImage(request.image).get(), request.stages, request.access, request.layout,
+        vk::ImageSubresourceRange(aspect_of(desc.format), 0, desc.mipLevels, 0, desc.layers));
+    }
+    if(!pass.requests.empty())
+      etna::flush_barriers(a_cmdBuff);
+
+    pass.execute(a_cmdBuff);
+  }
+}
+
+const etna::Image& FrameGraph::GetImage(ImageId a_image) const
+{
+  const Resource& resource = m_resources[a_image];
+  if(resource.imported != nullptr)
+    return *resource.imported;
+  if(resource.physical == UINT32_MAX)
+    RUN_TIME_ERROR(("[FrameGraph::GetImage] " + resource.name + " is not used by any pass that is kept").c_str());
+  return m_physical[resource.physical].image;
+}
@@ -0,0 +1,150 @@
+#ifndef CHIMERA_FRAME_GRAPH_H
+#define CHIMERA_FRAME_GRAPH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Image.hpp>
+
+// A frame declared as a list of passes and the images every one of them reads and writes.
+// Compile culls the passes whose results nothing uses: a pass is kept if it has side effects, writes an imported
+// image or writes a transient image a kept pass reads. Transient images are only allocated for the kept passes,
+// and the ones with the same description whose spans of passes don't overlap share an image. etna allocates every
+// image with memory of its own, so images rather than memory ranges are what gets aliased.
+// Execute requests the declared states from etna before every pass and flushes them as a single barrier.
+// Consecutive reads in the same layout are requested together by the first of them, so the later readers find
+// the image in the state they need.
+class FrameGraph
+{
+public:
+  using ImageId = uint32_t;
+  static constexpr ImageId INVALID_IMAGE = UINT32_MAX;
+
+  struct ImageDesc
+  {
+    vk::Extent3D extent = {1, 1, 1};
+    vk::Format format   = vk::Format::eUndefined;
+    uint32_t layers     = 1;
+    uint32_t mipLevels  = 1;
+    bool operator==(const ImageDesc&) const = default;
+  };
+
+  enum class Usage
+  {
+    COLOR_ATTACHMENT,
+    DEPTH_ATTACHMENT, // depth tests, with or without writes
+    SAMPLED_FRAGMENT,
+    SAMPLED_COMPUTE,
+    STORAGE_COMPUTE,
+    TRANSFER_SRC,
+    TRANSFER_DST
+  };
+
+  // The first access of an image in a pass sets the state the pass starts with. A pass that moves an image through
+  // other states declares them as later accesses, they only count for culling and for the image usage flags.
+  class PassBuilder
+  {
+  public:
+    void Read(ImageId a_image, Usage a_usage);
+    void Write(ImageId a_image, Usage a_usage);
+    // results outside of the graph images, such as buffers or the swapchain image, the pass is never culled
+    void SideEffect();
+
+  private:
+    friend class FrameGraph;
+    PassBuilder(FrameGraph& a_graph, uint32_t a_pass) : m_graph(a_graph), m_pass(a_pass) {}
+
+    FrameGraph& m_graph;
+    uint32_t m_pass;
+  };
+
+  using SetupFunc   = std::function<void(PassBuilder&)>;
+  using ExecuteFunc = std::function<void(VkCommandBuffer)>;
+
+  struct Stats
+  {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    uint32_t transientImages = 0; // used by the kept passes
+    uint32_t allocatedImages = 0;
+    VkDeviceSize transientBytes = 0; // if every transient image had its own
+    VkDeviceSize allocatedBytes = 0;
+    uint32_t stateRequests = 0; // per execution
+    uint32_t mergedReads = 0;   // reads that need no request of their own
+  };
+
+  FrameGraph() = default;
+  ~FrameGraph() = default;
+
+  FrameGraph(const FrameGraph&) = delete;
+  FrameGraph& operator=(const FrameGraph&) = delete;
+
+  // Starts a new declaration, the allocated images are kept for the next Compile
+  void Reset();
+  ImageId ImportImage(const std::string& a_name, const etna::Image& a_image, const ImageDesc& a_desc);
+  ImageId CreateImage(const std::string& a_name, const ImageDesc& a_desc);
+  // Passes are executed in the order they are added
+  void AddPass(const std::string& a_name, const SetupFunc& a_setup, ExecuteFunc a_execute);
+
+  // Waits for the device before it releases images a previous compilation allocated and this one doesn't use
+  void Compile();
+  void Execute(VkCommandBuffer a_cmdBuff) const;
+
+  // Only for the images of the kept passes once the graph is compiled
+  const etna::Image& GetImage(ImageId a_image) const;
+  const Stats& GetStats() const { return m_stats; }
+
+private:
+  struct Access
+  {
+    ImageId image = INVALID_IMAGE;
+    Usage usage = Usage::SAMPLED_FRAGMENT;
+    bool write = false;
+  };
+  struct StateRequest
+  {
+    ImageId image = INVALID_IMAGE;
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+  };
+  struct Pass
+  {
+    std::string name;
+    ExecuteFunc execute;
+    std::vector<Access> accesses;
+    bool sideEffect = false;
+    bool culled = false;
+    std::vector<StateRequest> requests; // filled by Compile
+  };
+  struct Resource
+  {
+    std::string name;
+    ImageDesc desc;
+    const etna::Image* imported = nullptr;
+    vk::ImageUsageFlags usage;   // of all the declared accesses
+    uint32_t firstPass = UINT32_MAX;
+    uint32_t lastPass = 0;
+    uint32_t physical = UINT32_MAX; // transient ones only
+  };
+  struct Physical
+  {
+    ImageDesc desc;
+    vk::ImageUsageFlags usage;
+    etna::Image image;
+    uint32_t lastPass = 0; // while Compile assigns resources
+  };
+
+  void CullPasses();
+  void AssignImages();
+  void BuildStateRequests();
+
+  std::vector<Pass> m_passes;
+  std::vector<Resource> m_resources;
+  std::vector<Physical> m_physical;
+  Stats m_stats;
+};
+
+#endif//CHIMERA_FRAME_GRAPH_H
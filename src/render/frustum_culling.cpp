@@ -0,0 +1,127 @@
+#include "frustum_culling.h"
+
+#include <cstddef>
+#include <limits>
+
+#include "frustum_culling_avx2.h"
+
+#if defined(FRUSTUM_CULLING_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+std::array<LiteMath::float4, 6> ExtractFrustumPlanes(const LiteMath::float4x4& a_projView)
+{
+  const LiteMath::float4 row0 = a_projView.get_row(0);
+  const LiteMath::float4 row1 = a_projView.get_row(1);
+  const LiteMath::float4 row2 = a_projView.get_row(2);
+  const LiteMath::float4 row3 = a_projView.get_row(3);
+
+  return {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2};
+}
+
+void FrustumCuller::SetBoxes(const std::vector<LiteMath::Box4f>& a_boxes)
+{
+  m_boxesNum = static_cast<uint32_t>(a_boxes.size());
+  const size_t padded = (a_boxes.size() + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+
+  for (auto* arr : {&m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ})
+    arr->assign(padded, std::numeric_limits<float>::quiet_NaN());
+
+  for (uint32_t i = 0; i < m_boxesNum; ++i)
+    SetBox(i, a_boxes[i]);
+}
+
+void FrustumCuller::SetBox(uint32_t a_boxId, const LiteMath::Box4f& a_box)
+{
+  m_minX[a_boxId] = a_box.boxMin.x;
+  m_minY[a_boxId] = a_box.boxMin.y;
+  m_minZ[a_boxId] = a_box.boxMin.z;
+  m_maxX[a_boxId] = a_box.boxMax.x;
+  m_maxY[a_boxId] = a_box.boxMax.y;
+  m_maxZ[a_boxId] = a_box.boxMax.z;
+}
+
+// For every plane only the box corner furthest along the plane normal (the "positive vertex") is tested,
+// so the corner arrays are picked once per plane instead of once per box.
+static std::array<FrustumPlaneTest, 6> make_plane_tests(const LiteMath::float4x4& a_projView,
+  const std::vector<float>& minX, const std::vector<float>& minY, const std::vector<float>& minZ,
+  const std::vector<float>& maxX, const std::vector<float>& maxY, const std::vector<float>& maxZ)
+{
+  const auto planes = ExtractFrustumPlanes(a_projView);
+  std::array<FrustumPlaneTest, 6> tests;
+  for (size_t i = 0; i < planes.size(); ++i)
+  {
+    tests[i].nx = planes[i].x;
+    tests[i].ny = planes[i].y;
+    tests[i].nz = planes[i].z;
+    tests[i].w  = planes[i].w;
+    tests[i].x = planes[i].x >= 0.0f ? maxX.data() : minX.data();
+    tests[i].y = planes[i].y >= 0.0f ? maxY.data() : minY.data();
+    tests[i].z = planes[i].z >= 0.0f ? maxZ.data() : minZ.data();
+  }
+  return tests;
+}
+
+void FrustumCuller::CullScalar(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_visible) const
+{
+  a_visible.clear();
+  const auto tests = make_plane_tests(a_projView, m_minX, m_minY, m_minZ, m_maxX, m_maxY, m_maxZ);
+
+  for (uint32_t i = 0; i < m_boxesNum; ++i)
+  {
+    bool inside = true;
+    for (const auto& t : tests)
+      inside &= t.nx * t.x[i] + t.ny * t.y[i] + t.nz * t.z[i] + t.w >= 0.0f;
+
+    if (inside)
+      a_visible.push_back(i);
+  }
+}
+
+#ifdef FRUSTUM_CULLING_AVX2
+
+// the AVX2 unit is built into every x86-64 binary, but only CPUs that have the instructions run it
+static bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  // the OS has to save the ymm registers as well
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx     = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+void FrustumCuller::Cull(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_visible) const
+{
+  static const bool useAvx2 = cpu_supports_avx2();
+  if (!useAvx2)
+  {
+    CullScalar(a_projView, a_visible);
+    return;
+  }
+
+  const auto tests = make_plane_tests(a_projView, m_minX, m_minY, m_minZ, m_maxX, m_maxY, m_maxZ);
+  a_visible.resize(m_minX.size());
+  const uint32_t visibleNum = CullBoxesAvx2(tests.data(), uint32_t(tests.size()), uint32_t(m_minX.size()),
+    a_visible.data());
+  a_visible.resize(visibleNum);
+}
+
+#else
+
+void FrustumCuller::Cull(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_visible) const
+{
+  CullScalar(a_projView, a_visible);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+
+// Plane equations (xyz - normal pointing inside, w - distance) of the frustum of a_projView, Gribb-Hartmann.
+// The near plane is taken as z >= -w, which is exact for OpenGL style matrices and conservative for
+// matrices with OpenglToVulkanProjectionMatrixFix applied.
+std::array<LiteMath::float4, 6> ExtractFrustumPlanes(const LiteMath::float4x4& a_projView);
+
+// Instance bounding boxes in structure-of-arrays form. Arrays are padded to a multiple of BATCH_SIZE
+// with NaN boxes, which never pass the plane test, so the AVX2 loop has no scalar tail.
+class FrustumCuller
+{
+public:
+  static constexpr uint32_t BATCH_SIZE = 8;
+
+  void SetBoxes(const std::vector<LiteMath::Box4f>& a_boxes);
+  void SetBox(uint32_t a_boxId, const LiteMath::Box4f& a_box);
+  uint32_t BoxesNum() const { return m_boxesNum; }
+
+  // Writes ids of the boxes that intersect the frustum to a_visible in ascending order.
+  // Uses the AVX2 path when the project is built with it and the CPU supports it, CullScalar otherwise.
+  void Cull(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_visible) const;
+  void CullScalar(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_visible) const;
+
+private:
+  uint32_t m_boxesNum = 0u;
+  std::vector<float> m_minX, m_minY, m_minZ;
+  std::vector<float> m_maxX, m_maxY, m_maxZ;
+};
+
+#endif // FRUSTUM_CULLING_H
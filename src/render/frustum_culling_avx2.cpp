@@ -0,0 +1,42 @@
+#include "frustum_culling_avx2.h"
+
+#include <immintrin.h>
+
+// The only unit compiled with AVX2 (see USE_AVX2 in the root CMakeLists.txt). It includes no headers with inline
+// functions, so the linker never picks an AVX2 copy of code that the rest of the program runs on any CPU.
+
+uint32_t CullBoxesAvx2(const FrustumPlaneTest* a_tests, uint32_t a_testsNum, uint32_t a_boxesNum, uint32_t* a_visible)
+{
+  constexpr uint32_t MAX_PLANES = 6;
+  __m256 nx[MAX_PLANES], ny[MAX_PLANES], nz[MAX_PLANES], nw[MAX_PLANES];
+  for (uint32_t p = 0; p < a_testsNum; ++p)
+  {
+    nx[p] = _mm256_set1_ps(a_tests[p].nx);
+    ny[p] = _mm256_set1_ps(a_tests[p].ny);
+    nz[p] = _mm256_set1_ps(a_tests[p].nz);
+    nw[p] = _mm256_set1_ps(a_tests[p].w);
+  }
+
+  uint32_t visibleNum = 0;
+  const __m256 zero = _mm256_setzero_ps();
+  for (uint32_t base = 0; base < a_boxesNum; base += 8)
+  {
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (uint32_t p = 0; p < a_testsNum; ++p)
+    {
+      __m256 dist = _mm256_add_ps(nw[p], _mm256_mul_ps(nx[p], _mm256_loadu_ps(a_tests[p].x + base)));
+      dist = _mm256_add_ps(dist, _mm256_mul_ps(ny[p], _mm256_loadu_ps(a_tests[p].y + base)));
+      dist = _mm256_add_ps(dist, _mm256_mul_ps(nz[p], _mm256_loadu_ps(a_tests[p].z + base)));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+    }
+
+    // ordered comparison with NaN is false, so padding never ends up in the mask
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+    for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1)
+    {
+      if (mask & 1u)
+        a_visible[visibleNum++] = base + lane;
+    }
+  }
+  return visibleNum;
+}
@@ -0,0 +1,20 @@
+#ifndef FRUSTUM_CULLING_AVX2_H
+#define FRUSTUM_CULLING_AVX2_H
+
+#include <cstdint>
+
+// One plane of a FrustumCuller test: the plane (xyz - normal pointing inside, w - distance) and the box bound
+// arrays of its positive vertex. Plain floats, so the AVX2 unit doesn't instantiate any LiteMath code.
+struct FrustumPlaneTest
+{
+  float nx, ny, nz, w;
+  const float* x;
+  const float* y;
+  const float* z;
+};
+
+// Only built with AVX2 instructions, callers check the CPU first. a_boxesNum is a multiple of 8.
+// Writes the ids of the boxes in front of all a_testsNum planes to a_visible in ascending order, returns their number.
+uint32_t CullBoxesAvx2(const FrustumPlaneTest* a_tests, uint32_t a_testsNum, uint32_t a_boxesNum, uint32_t* a_visible);
+
+#endif // FRUSTUM_CULLING_AVX2_H
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cassert>
+
+#include "geometry_heap.h"
+#include <vk_buffers.h>
+
+
+GeometryHeap::GeometryHeap(VkDevice a_device, VkPhysicalDevice a_physDevice, VkDeviceSize a_blockSize)
+  : m_device(a_device), m_physDevice(a_physDevice), m_blockSize(a_blockSize)
+{
+}
+
+GeometryHeap::~GeometryHeap()
+{
+  for(auto& block : m_blocks)
+  {
+    if(block.allocations != 0)
+      vk_utils::logWarning("[GeometryHeap] destroyed with " + std::to_string(block.allocations) + " live allocations");
+    vkFreeMemory(m_device, block.memory, nullptr);
+  }
+}
+
+VkBuffer GeometryHeap::CreateBuffer(VkDeviceSize a_size, VkBufferUsageFlags a_usage, Allocation& a_allocation)
+{
+  VkMemoryRequirements memReq;
+  VkBuffer buffer = vk_utils::createBuffer(m_device, a_size, a_usage, &memReq);
+
+  a_allocation = Allocate(memReq);
+  VK_CHECK_RESULT(vkBindBufferMemory(m_device, buffer, a_allocation.memory, a_allocation.offset));
+
+  return buffer;
+}
+
+void GeometryHeap::DestroyBuffer(VkBuffer& a_buffer, Allocation& a_allocation)
+{
+  if(a_buffer != VK_NULL_HANDLE)
+  {
+    vkDestroyBuffer(m_device, a_buffer, nullptr);
+    a_buffer = VK_NULL_HANDLE;
+  }
+
+  if(a_allocation.memory != VK_NULL_HANDLE)
+  {
+    Free(a_allocation);
+    a_allocation = Allocation();
+  }
+}
+
+GeometryHeap::Allocation GeometryHeap::Allocate(const VkMemoryRequirements& a_memReq)
+{
+  const uint32_t memoryType = vk_utils::findMemoryType(a_memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    m_physDevice);
+
+  Allocation allocation;
+  for(uint32_t blockId = 0; blockId < m_blocks.size(); ++blockId)
+  {
+    if(m_blocks[blockId].memoryType == memoryType
+      && AllocateFromBlock(blockId, a_memReq.size, a_memReq.alignment, allocation))
+      return allocation;
+  }
+
+  Block block;
+  block.size       = std::max(m_blockSize, vk_utils::getPaddedSize(a_memReq.size, a_memReq.alignment));
+  block.memoryType = memoryType;
+  block.freeRanges.emplace(0, block.size);
+
+  VkMemoryAllocateInfo allocateInfo = {};
+  allocateInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocateInfo.allocationSize  = block.size;
+  allocateInfo.memoryTypeIndex = memoryType;
+  VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &block.memory));
+
+  m_blocks.push_back(std::move(block));
+  const bool allocated = AllocateFromBlock(uint32_t(m_blocks.size() - 1), a_memReq.size, a_memReq.alignment, allocation);
+  assert(allocated);
+  (void)allocated;
+
+  return allocation;
+}
+
+bool GeometryHeap::AllocateFromBlock(uint32_t a_blockId, VkDeviceSize a_size, VkDeviceSize a_alignment,
+  Allocation& a_allocation)
+{
+  Block& block = m_blocks[a_blockId];
+
+  // best fit: the smallest range the aligned allocation fits in, large ranges are left for large buffers
+  auto best = block.freeRanges.end();
+  for(auto range = block.freeRanges.begin(); range != block.freeRanges.end(); ++range)
+  {
+    const VkDeviceSize alignedOffset = vk_utils::getPaddedSize(range->first, a_alignment);
+    if(alignedOffset + a_size > range->first + range->second)
+      continue;
+    if(best == block.freeRanges.end() || range->second < best->second)
+      best = range;
+  }
+  if(best == block.freeRanges.end())
+    return false;
+
+  const VkDeviceSize rangeOffset   = best->first;
+  const VkDeviceSize rangeEnd      = best->first + best->second;
+  const VkDeviceSize alignedOffset = vk_utils::getPaddedSize(rangeOffset, a_alignment);
+  block.freeRanges.erase(best);
+
+  // alignment padding in front goes back to the free list
+  if(alignedOffset > rangeOffset)
+    block.freeRanges.emplace(rangeOffset, alignedOffset - rangeOffset);
+  if(alignedOffset + a_size < rangeEnd)
+    block.freeRanges.emplace(alignedOffset + a_size, rangeEnd - alignedOffset - a_size);
+
+  block.used += a_size;
+  block.allocations++;
+
+  a_allocation.memory = block.memory;
+  a_allocation.offset = alignedOffset;
+  a_allocation.size   = a_size;
+  a_allocation.block  = a_blockId;
+  return true;
+}
+
+void GeometryHeap::Free(const Allocation& a_allocation)
+{
+  assert(a_allocation.block < m_blocks.size());
+  Block& block = m_blocks[a_allocation.block];
+  assert(block.memory == a_allocation.memory && block.allocations > 0);
+
+  block.used -= a_allocation.size;
+  block.allocations--;
+
+  VkDeviceSize offset = a_allocation.offset;
+  VkDeviceSize size   = a_allocation.size;
+
+  auto next = block.freeRanges.lower_bound(offset);
+  if(next != block.freeRanges.end() && offset + size == next->first)
+  {
+    size += next->second;
+    next = block.freeRanges.erase(next);
+  }
+  if(next != block.freeRanges.begin())
+  {
+    auto prev = std::prev(next);
+    if(prev->first + prev->second == offset)
+    {
+      offset = prev->first;
+      size  += prev->second;
+      block.freeRanges.erase(prev);
+    }
+  }
+  block.freeRanges.emplace(offset, size);
+}
+
+GeometryHeap::Stats GeometryHeap::GetStats() const
+{
+  Stats stats;
+  VkDeviceSize freeBytes = 0;
+  for(const auto& block : m_blocks)
+  {
+    stats.blocks++;
+    stats.allocations   += block.allocations;
+    stats.reservedBytes += block.size;
+    stats.usedBytes     += block.used;
+    stats.freeRanges    += uint32_t(block.freeRanges.size());
+    for(const auto& [offset, size] : block.freeRanges)
+    {
+      freeBytes += size;
+      stats.largestFreeRange = std::max(stats.largestFreeRange, size);
+    }
+  }
+  if(freeBytes > 0)
+    stats.fragmentation = 1.0f - float(stats.largestFreeRange) / float(freeBytes);
+
+  return stats;
+}
@@ -0,0 +1,69 @@
+#ifndef CHIMERA_GEOMETRY_HEAP_H
+#define CHIMERA_GEOMETRY_HEAP_H
+
+#include <map>
+#include <vector>
+
+#include <vk_utils.h>
+
+// Device local memory for vertex, index and other geometry buffers, shared by all loaders.
+// Memory is allocated in large blocks and buffers are placed into them with a best fit free list,
+// freed ranges are merged with their neighbours. Blocks are kept until the heap is destroyed, so geometry
+// can be created and destroyed at runtime without vkAllocateMemory once the heap has grown to its working set.
+// Buffers larger than the block size get a block of their own.
+class GeometryHeap
+{
+public:
+  struct Allocation
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t block = UINT32_MAX;
+  };
+
+  GeometryHeap(VkDevice a_device, VkPhysicalDevice a_physDevice, VkDeviceSize a_blockSize = 64 * 1024 * 1024);
+  ~GeometryHeap();
+
+  GeometryHeap(const GeometryHeap&) = delete;
+  GeometryHeap& operator=(const GeometryHeap&) = delete;
+
+  VkBuffer CreateBuffer(VkDeviceSize a_size, VkBufferUsageFlags a_usage, Allocation& a_allocation);
+  // The buffer must not be in use by the GPU, both handles are reset
+  void DestroyBuffer(VkBuffer& a_buffer, Allocation& a_allocation);
+
+  struct Stats
+  {
+    uint32_t blocks = 0;
+    uint32_t allocations = 0;
+    VkDeviceSize reservedBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    uint32_t freeRanges = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 1 - largest free range / all free space, free space spread over several blocks counts as fragmented too
+    float fragmentation = 0.0f;
+  };
+  Stats GetStats() const;
+
+private:
+  struct Block
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    VkDeviceSize used = 0;
+    uint32_t allocations = 0;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset -> size
+  };
+
+  Allocation Allocate(const VkMemoryRequirements& a_memReq);
+  bool AllocateFromBlock(uint32_t a_blockId, VkDeviceSize a_size, VkDeviceSize a_alignment, Allocation& a_allocation);
+  void Free(const Allocation& a_allocation);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkPhysicalDevice m_physDevice = VK_NULL_HANDLE;
+  VkDeviceSize m_blockSize = 0;
+  std::vector<Block> m_blocks;
+};
+
+#endif//CHIMERA_GEOMETRY_HEAP_H
@@ -0,0 +1,127 @@
+#include "gpu_profiler.h"
+
+
+GpuProfiler::GpuProfiler(VkDevice a_device, VkPhysicalDevice a_physicalDevice, uint32_t a_queueFamilyIdx,
+  uint32_t a_slotsNum, uint32_t a_scopesPerSlot)
+  : m_device(a_device), m_queriesPerSlot(a_scopesPerSlot * 2)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(a_physicalDevice, &properties);
+
+  uint32_t queueFamiliesNum = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(a_physicalDevice, &queueFamiliesNum, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamiliesNum);
+  vkGetPhysicalDeviceQueueFamilyProperties(a_physicalDevice, &queueFamiliesNum, queueFamilies.data());
+
+  const uint32_t validBits = queueFamilies[a_queueFamilyIdx].timestampValidBits;
+  if(validBits == 0 || properties.limits.timestampPeriod == 0.0f)
+    return;
+
+  m_timestampPeriod = properties.limits.timestampPeriod;
+  m_timestampMask   = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  m_slots.resize(a_slotsNum);
+  m_results.resize(m_queriesPerSlot);
+
+  VkQueryPoolCreateInfo poolInfo = {};
+  poolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = m_queriesPerSlot * a_slotsNum;
+  VK_CHECK_RESULT(vkCreateQueryPool(m_device, &poolInfo, nullptr, &m_queryPool));
+}
+
+GpuProfiler::~GpuProfiler()
+{
+  if(m_queryPool != VK_NULL_HANDLE)
+    vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+}
+
+void GpuProfiler::BeginSlot(VkCommandBuffer a_cmdBuff, uint32_t a_slot)
+{
+  if(!Supported())
+    return;
+
+  m_recordingSlot = a_slot;
+  m_slots[a_slot].scopes.clear();
+  m_openScopes.clear();
+  vkCmdResetQueryPool(a_cmdBuff, m_queryPool, a_slot * m_queriesPerSlot, m_queriesPerSlot);
+}
+
+void GpuProfiler::BeginScope(VkCommandBuffer a_cmdBuff, const std::string& a_name)
+{
+  if(!Supported())
+    return;
+
+  Slot& slot = m_slots[m_recordingSlot];
+  if(2 * (slot.scopes.size() + 1) > m_queriesPerSlot)
+    RUN_TIME_ERROR("[GpuProfiler::BeginScope] too many scopes in a command buffer");
+
+  Scope scope;
+  scope.timing = FindTiming(a_name);
+  scope.query  = m_recordingSlot * m_queriesPerSlot + 2 * uint32_t(slot.scopes.size());
+  m_openScopes.push_back(uint32_t(slot.scopes.size()));
+  slot.scopes.push_back(scope);
+
+  vkCmdWriteTimestamp(a_cmdBuff, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, scope.query);
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer a_cmdBuff)
+{
+  if(!Supported())
+    return;
+
+  const Scope& scope = m_slots[m_recordingSlot].scopes[m_openScopes.back()];
+  m_openScopes.pop_back();
+  vkCmdWriteTimestamp(a_cmdBuff, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, scope.query + 1);
+}
+
+void GpuProfiler::Collect(uint32_t a_slot)
+{
+  if(!Supported() || m_slots[a_slot].scopes.empty())
+    return;
+
+  const auto& scopes = m_slots[a_slot].scopes;
+  const uint32_t queriesNum = 2 * uint32_t(scopes.size());
+  // not ready if the slot was recorded but never submitted
+  if(vkGetQueryPoolResults(m_device, m_queryPool, a_slot * m_queriesPerSlot, queriesNum,
+       queriesNum * sizeof(uint64_t), m_results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+    return;
+
+  // the begin timestamp of the first scope is not necessarily the earliest one once scopes overlap
+  uint64_t slotStart = m_results[0];
+  for(size_t i = 1; i < scopes.size(); ++i)
+  {
+    if(((m_results[2 * i] - slotStart) & m_timestampMask) > (m_timestampMask >> 1))
+      slotStart = m_results[2 * i];
+  }
+
+  const auto toMs = [this](uint64_t a_from, uint64_t a_to) {
+    return float(double((a_to - a_from) & m_timestampMask) * m_timestampPeriod * 1e-6);
+  };
+  for(size_t i = 0; i < scopes.size(); ++i)
+  {
+    Timing& timing = m_timings[scopes[i].timing];
+    const float ms = toMs(m_results[2 * i], m_results[2 * i + 1]);
+    const float startMs = toMs(slotStart, m_results[2 * i]);
+    if(timing.ms == 0.0f)
+    {
+      timing.ms      = ms;
+      timing.startMs = startMs;
+    }
+    else
+    {
+      timing.ms      += (ms - timing.ms) * 0.05f;
+      timing.startMs += (startMs - timing.startMs) * 0.05f;
+    }
+  }
+}
+
+uint32_t GpuProfiler::FindTiming(const std::string& a_name)
+{
+  for(size_t i = 0; i < m_timings.size(); ++i)
+  {
+    if(m_timings[i].name == a_name)
+      return uint32_t(i);
+  }
+  m_timings.push_back(Timing{a_name, 0.0f});
+  return uint32_t(m_timings.size() - 1);
+}
@@ -0,0 +1,74 @@
+#ifndef CHIMERA_GPU_PROFILER_H
+#define CHIMERA_GPU_PROFILER_H
+
+#include <string>
+#include <vector>
+
+#include <vk_utils.h>
+
+// GPU time of named command buffer ranges, measured with timestamp queries.
+// Every command buffer that may be pending at the same time records into its own slot of the query pool.
+// BeginSlot resets the slot at the start of the recording, so command buffers that are submitted many times
+// measure every submission. Results are read back without waiting in Collect, once the submission is known to
+// be complete, and kept as moving averages per scope name. Scope starts are kept relative to the first scope of the
+// slot, so work that runs concurrently on the GPU shows up as overlapping ranges.
+class GpuProfiler
+{
+public:
+  struct Timing
+  {
+    std::string name;
+    float ms = 0.0f;
+    float startMs = 0.0f; // since the start of the first scope of the command buffer
+  };
+
+  GpuProfiler(VkDevice a_device, VkPhysicalDevice a_physicalDevice, uint32_t a_queueFamilyIdx, uint32_t a_slotsNum,
+    uint32_t a_scopesPerSlot = 32);
+  ~GpuProfiler();
+
+  GpuProfiler(const GpuProfiler&) = delete;
+  GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+  // Without timestamp support all the calls do nothing
+  bool Supported() const { return m_queryPool != VK_NULL_HANDLE; }
+
+  // Outside of render passes, before any scope of the command buffer
+  void BeginSlot(VkCommandBuffer a_cmdBuff, uint32_t a_slot);
+  // Scopes may be nested
+  void BeginScope(VkCommandBuffer a_cmdBuff, const std::string& a_name);
+  void EndScope(VkCommandBuffer a_cmdBuff);
+
+  // The last submission of the slot must be complete
+  void Collect(uint32_t a_slot);
+
+  // In the order scope names were first seen
+  const std::vector<Timing>& Timings() const { return m_timings; }
+
+private:
+  struct Scope
+  {
+    uint32_t timing = 0; // index in m_timings
+    uint32_t query = 0;  // begin timestamp, the end one follows it
+  };
+  struct Slot
+  {
+    std::vector<Scope> scopes;
+  };
+
+  uint32_t FindTiming(const std::string& a_name);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkQueryPool m_queryPool = VK_NULL_HANDLE;
+  float m_timestampPeriod = 1.0f; // ns per tick
+  uint64_t m_timestampMask = ~0ull;
+  uint32_t m_queriesPerSlot = 0;
+
+  std::vector<Slot> m_slots;
+  uint32_t m_recordingSlot = 0;
+  std::vector<uint32_t> m_openScopes; // indices in the scopes of the recording slot
+
+  std::vector<Timing> m_timings;
+  std::vector<uint64_t> m_results;
+};
+
+#endif//CHIMERA_GPU_PROFILER_H
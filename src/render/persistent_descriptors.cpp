@@ -0,0 +1,95 @@
+#include <iterator>
+
+#include "persistent_descriptors.h"
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+
+
+PersistentDescriptorPool::PersistentDescriptorPool(VkDevice a_device, uint32_t a_setsPerPool)
+  : m_device(a_device), m_setsPerPool(a_setsPerPool)
+{
+}
+
+PersistentDescriptorPool::~PersistentDescriptorPool()
+{
+  for(auto pool : m_pools)
+    vkDestroyDescriptorPool(m_device, pool, nullptr);
+}
+
+VkDescriptorSet PersistentDescriptorPool::Create(etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff,
+  std::vector<etna::Binding> a_bindings)
+{
+  auto frameSet = etna::create_descriptor_set(a_layoutId, a_cmdBuff, a_bindings);
+
+  VkDescriptorSet set = Allocate(etna::get_context().getDescriptorSetLayouts().getVkLayout(a_layoutId));
+
+  std::vector<VkCopyDescriptorSet> copies(a_bindings.size());
+  for(size_t i = 0; i < a_bindings.size(); ++i)
+  {
+    copies[i].sType           = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+    copies[i].srcSet          = frameSet.getVkSet();
+    copies[i].srcBinding      = a_bindings[i].binding;
+    copies[i].dstSet          = set;
+    copies[i].dstBinding      = a_bindings[i].binding;
+    copies[i].descriptorCount = 1;
+  }
+  vkUpdateDescriptorSets(m_device, 0, nullptr, uint32_t(copies.size()), copies.data());
+
+  return set;
+}
+
+void PersistentDescriptorPool::Reset()
+{
+  for(auto pool : m_pools)
+    VK_CHECK_RESULT(vkResetDescriptorPool(m_device, pool, 0));
+  m_currentPool = 0;
+  m_setsNum = 0;
+}
+
+VkDescriptorSet PersistentDescriptorPool::Allocate(VkDescriptorSetLayout a_layout)
+{
+  VkDescriptorSetAllocateInfo allocateInfo = {};
+  allocateInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocateInfo.descriptorSetCount = 1;
+  allocateInfo.pSetLayouts        = &a_layout;
+
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  for(; m_currentPool < m_pools.size(); ++m_currentPool)
+  {
+    allocateInfo.descriptorPool = m_pools[m_currentPool];
+    VkResult res = vkAllocateDescriptorSets(m_device, &allocateInfo, &set);
+    if(res == VK_SUCCESS)
+    {
+      m_setsNum++;
+      return set;
+    }
+    if(res != VK_ERROR_OUT_OF_POOL_MEMORY && res != VK_ERROR_FRAGMENTED_POOL)
+      VK_CHECK_RESULT(res);
+  }
+
+  // the passes bind a handful of resources each, this is plenty for any of their layouts
+  const VkDescriptorPoolSize poolSizes[] =
+  {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         m_setsPerPool * 2},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         m_setsPerPool * 4},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_setsPerPool * 4},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          m_setsPerPool * 2},
+  };
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets       = m_setsPerPool;
+  poolInfo.poolSizeCount = uint32_t(std::size(poolSizes));
+  poolInfo.pPoolSizes    = poolSizes;
+
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VK_CHECK_RESULT(vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &pool));
+  m_pools.push_back(pool);
+  m_currentPool = uint32_t(m_pools.size() - 1);
+
+  allocateInfo.descriptorPool = pool;
+  VK_CHECK_RESULT(vkAllocateDescriptorSets(m_device, &allocateInfo, &set));
+  m_setsNum++;
+  return set;
+}
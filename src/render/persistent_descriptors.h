@@ -0,0 +1,40 @@
+#ifndef CHIMERA_PERSISTENT_DESCRIPTORS_H
+#define CHIMERA_PERSISTENT_DESCRIPTORS_H
+
+#include <vector>
+
+#include <vk_utils.h>
+#include <etna/DescriptorSet.hpp>
+
+// Descriptor sets for command buffers that are recorded once and submitted many times.
+// etna::create_descriptor_set allocates from a pool that is recycled every few frames, so its sets can't be
+// referenced by such command buffers. Create still goes through etna, which records the layout transitions of
+// the bound images into the command buffer, and copies the descriptors into a set that lives until Reset.
+class PersistentDescriptorPool
+{
+public:
+  explicit PersistentDescriptorPool(VkDevice a_device, uint32_t a_setsPerPool = 64);
+  ~PersistentDescriptorPool();
+
+  PersistentDescriptorPool(const PersistentDescriptorPool&) = delete;
+  PersistentDescriptorPool& operator=(const PersistentDescriptorPool&) = delete;
+
+  VkDescriptorSet Create(etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff, std::vector<etna::Binding> a_bindings);
+
+  // Frees all sets at once, none of them may be used by pending command buffers
+  void Reset();
+
+  uint32_t SetsNum() const { return m_setsNum; }
+
+private:
+  VkDescriptorSet Allocate(VkDescriptorSetLayout a_layout);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  uint32_t m_setsPerPool = 0;
+  // a new pool is added when the current one runs out, they are all kept for the next Reset
+  std::vector<VkDescriptorPool> m_pools;
+  uint32_t m_currentPool = 0;
+  uint32_t m_setsNum = 0;
+};
+
+#endif//CHIMERA_PERSISTENT_DESCRIPTORS_H
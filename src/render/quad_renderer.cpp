@@ -25,12 +25,13 @@ QuadRenderer::QuadRenderer(CreateInfo info)
 }
 
 void QuadRenderer::RecordCommands(vk::CommandBuffer cmdBuff, vk::Image targetImage, vk::ImageView targetImageView,
-                                  const etna::Image &inTex, const etna::Sampler &sampler)
+                                  const etna::Image &inTex, const etna::Sampler &sampler,
+                                  const etna::Image::ViewParams &inTexView)
 {
   auto programInfo = etna::get_shader_program(m_programId);
   auto set = etna::create_descriptor_set(programInfo.getDescriptorLayoutId(0), cmdBuff,
     {
-      etna::Binding {0, inTex.genBinding(sampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)}
+      etna::Binding {0, inTex.genBinding(sampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, inTexView)}
     });
   vk::DescriptorSet vkSet = set.getVkSet();
 
@@ -22,7 +22,8 @@ public:
   ~QuadRenderer() {}
 
   void RecordCommands(vk::CommandBuffer cmdBuff, vk::Image targetImage, vk::ImageView targetImageView,
-                      const etna::Image &inTex, const etna::Sampler &sampler);
+                      const etna::Image &inTex, const etna::Sampler &sampler,
+                      const etna::Image::ViewParams &inTexView = {});
 
 private:
   etna::GraphicsPipeline m_pipeline;
@@ -0,0 +1,638 @@
+#include "scene_bvh.h"
+#include "scene_mgr.h"
+#include "frustum_culling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+using LiteMath::float3;
+using LiteMath::float4;
+using LiteMath::float4x4;
+using LiteMath::Box4f;
+
+namespace
+{
+  constexpr uint32_t SAH_BINS      = 12;
+  constexpr uint32_t MAX_LEAF_SIZE = 4;
+  constexpr uint32_t STACK_SIZE    = 64;
+
+  float3 xyz(const float4& v) { return float3(v.x, v.y, v.z); }
+
+  float3 transform_point(const float4x4& m, const float3& p) { return xyz(m * float4(p.x, p.y, p.z, 1.0f)); }
+  float3 transform_dir(const float4x4& m, const float3& d) { return xyz(m * float4(d.x, d.y, d.z, 0.0f)); }
+
+  struct Aabb
+  {
+    float3 boxMin = float3(FLT_MAX, FLT_MAX, FLT_MAX);
+    float3 boxMax = float3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    void include(const float3& p) { boxMin = min(boxMin, p); boxMax = max(boxMax, p); }
+    void include(const Aabb& b) { boxMin = min(boxMin, b.boxMin); boxMax = max(boxMax, b.boxMax); }
+    float area() const
+    {
+      const float3 d = boxMax - boxMin;
+      return d.x < 0.0f ? 0.0f : d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+  };
+
+  Aabb to_aabb(const Box4f& box) { return Aabb{xyz(box.boxMin), xyz(box.boxMax)}; }
+  bool is_empty(const Box4f& box) { return !(box.boxMin.x <= box.boxMax.x); }
+
+  // Arvo: box of the transformed box from the center and the absolute values of the matrix
+  Aabb transform_aabb(const float4x4& m, const float3& boxMin, const float3& boxMax)
+  {
+    const float3 center = transform_point(m, (boxMin + boxMax) * 0.5f);
+    const float3 half   = (boxMax - boxMin) * 0.5f;
+    float3 extent;
+    extent.x = std::abs(m(0, 0)) * half.x + std::abs(m(0, 1)) * half.y + std::abs(m(0, 2)) * half.z;
+    extent.y = std::abs(m(1, 0)) * half.x + std::abs(m(1, 1)) * half.y + std::abs(m(1, 2)) * half.z;
+    extent.z = std::abs(m(2, 0)) * half.x + std::abs(m(2, 1)) * half.y + std::abs(m(2, 2)) * half.z;
+    return Aabb{center - extent, center + extent};
+  }
+
+  float distance2_to_box(const float3& p, const float3& boxMin, const float3& boxMax)
+  {
+    const float3 d = max(max(boxMin - p, p - boxMax), float3(0.0f, 0.0f, 0.0f));
+    return dot(d, d);
+  }
+
+  // Slab test, returns entry distance or FLT_MAX on miss. Empty boxes would pass with swapped slabs.
+  float intersect_box(const float3& origin, const float3& invDir, float tMax, const float3& boxMin, const float3& boxMax)
+  {
+    if (boxMin.x > boxMax.x)
+      return FLT_MAX;
+    const float3 t0 = (boxMin - origin) * invDir;
+    const float3 t1 = (boxMax - origin) * invDir;
+    const float3 tNear = min(t0, t1);
+    const float3 tFar  = max(t0, t1);
+    const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    const float exit  = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : FLT_MAX;
+  }
+
+  // Möller–Trumbore, returns t or FLT_MAX on miss
+  float intersect_triangle(const float3& origin, const float3& dir, const float3& a, const float3& b, const float3& c)
+  {
+    const float3 edge1 = b - a;
+    const float3 edge2 = c - a;
+    const float3 pvec  = cross(dir, edge2);
+    const float det = dot(edge1, pvec);
+    if (std::abs(det) < 1e-12f)
+      return FLT_MAX;
+
+    const float invDet = 1.0f / det;
+    const float3 tvec = origin - a;
+    const float u = dot(tvec, pvec) * invDet;
+    if (u < 0.0f || u > 1.0f)
+      return FLT_MAX;
+
+    const float3 qvec = cross(tvec, edge1);
+    const float v = dot(dir, qvec) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+      return FLT_MAX;
+
+    const float t = dot(edge2, qvec) * invDet;
+    return t >= 0.0f ? t : FLT_MAX;
+  }
+
+  // Ericson, Real-Time Collision Detection 5.1.5
+  float3 closest_point_on_triangle(const float3& p, const float3& a, const float3& b, const float3& c)
+  {
+    const float3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+      return a;
+
+    const float3 bp = p - b;
+    const float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+      return b;
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+      return a + ab * (d1 / (d1 - d3));
+
+    const float3 cp = p - c;
+    const float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+      return c;
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+      return a + ac * (d2 / (d2 - d6));
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+      return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    const float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+  }
+
+  float3 safe_inverse(const float3& d)
+  {
+    auto inv = [](float x) { return std::abs(x) > 1e-20f ? 1.0f / x : (x >= 0.0f ? FLT_MAX : -FLT_MAX); };
+    return float3(inv(d.x), inv(d.y), inv(d.z));
+  }
+
+  // Traversal stack on the program stack, trees deeper than STACK_SIZE (degenerate SAH splits) spill to the heap
+  class TraversalStack
+  {
+  public:
+    explicit TraversalStack(uint32_t a_root) { push(a_root); }
+
+    bool empty() const { return m_size == 0; }
+    void push(uint32_t a_node)
+    {
+      if (m_size < STACK_SIZE)
+        m_fixed[m_size] = a_node;
+      else
+        m_spill.push_back(a_node);
+      ++m_size;
+    }
+    uint32_t pop()
+    {
+      --m_size;
+      if (m_size < STACK_SIZE)
+        return m_fixed[m_size];
+      const uint32_t node = m_spill.back();
+      m_spill.pop_back();
+      return node;
+    }
+
+  private:
+    uint32_t m_fixed[STACK_SIZE];
+    uint32_t m_size = 0;
+    std::vector<uint32_t> m_spill;
+  };
+}
+
+void Bvh::Build(const std::vector<Box4f>& a_primBoxes)
+{
+  m_nodes.clear();
+  m_primIndices.clear();
+  m_inTree.assign(a_primBoxes.size(), false);
+
+  std::vector<Aabb> boxes(a_primBoxes.size());
+  std::vector<float3> centroids(a_primBoxes.size());
+  for (uint32_t i = 0; i < a_primBoxes.size(); ++i)
+  {
+    if (is_empty(a_primBoxes[i]))
+      continue;
+    boxes[i] = to_aabb(a_primBoxes[i]);
+    centroids[i] = (boxes[i].boxMin + boxes[i].boxMax) * 0.5f;
+    m_primIndices.push_back(i);
+    m_inTree[i] = true;
+  }
+  if (m_primIndices.empty())
+    return;
+
+  struct Task
+  {
+    uint32_t node;
+    uint32_t first;
+    uint32_t count;
+  };
+  std::vector<Task> tasks = {{0, 0, static_cast<uint32_t>(m_primIndices.size())}};
+  m_nodes.reserve(2 * m_primIndices.size());
+  m_nodes.emplace_back();
+
+  while (!tasks.empty())
+  {
+    const Task task = tasks.back();
+    tasks.pop_back();
+
+    Aabb bounds, centroidBounds;
+    for (uint32_t i = task.first; i < task.first + task.count; ++i)
+    {
+      bounds.include(boxes[m_primIndices[i]]);
+      centroidBounds.include(centroids[m_primIndices[i]]);
+    }
+    m_nodes[task.node].boxMin = bounds.boxMin;
+    m_nodes[task.node].boxMax = bounds.boxMax;
+
+    auto makeLeaf = [&]()
+    {
+      m_nodes[task.node].first    = task.first;
+      m_nodes[task.node].primsNum = task.count;
+    };
+    if (task.count <= MAX_LEAF_SIZE)
+    {
+      makeLeaf();
+      continue;
+    }
+
+    const float3 extent = centroidBounds.boxMax - centroidBounds.boxMin;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const float axisMin = centroidBounds.boxMin[axis];
+    const float axisExtent = extent[axis];
+
+    auto* first = m_primIndices.data() + task.first;
+    auto* last  = first + task.count;
+    uint32_t* middle = nullptr;
+
+    if (axisExtent > 0.0f)
+    {
+      auto binOf = [&](uint32_t prim)
+      {
+        const uint32_t bin = static_cast<uint32_t>(float(SAH_BINS) * (centroids[prim][axis] - axisMin) / axisExtent);
+        return std::min(bin, SAH_BINS - 1);
+      };
+
+      Aabb binBounds[SAH_BINS];
+      uint32_t binCounts[SAH_BINS] = {};
+      for (auto* prim = first; prim != last; ++prim)
+      {
+        const uint32_t bin = binOf(*prim);
+        binBounds[bin].include(boxes[*prim]);
+        binCounts[bin]++;
+      }
+
+      // sweep from the right to get the area and count of everything right of each split
+      float rightCost[SAH_BINS] = {};
+      Aabb rightBounds;
+      uint32_t rightCount = 0;
+      for (uint32_t split = SAH_BINS - 1; split > 0; --split)
+      {
+        rightBounds.include(binBounds[split]);
+        rightCount += binCounts[split];
+        rightCost[split] = rightBounds.area() * float(rightCount);
+      }
+
+      float bestCost = FLT_MAX;
+      uint32_t bestSplit = 0;
+      Aabb leftBounds;
+      uint32_t leftCount = 0;
+      for (uint32_t split = 1; split < SAH_BINS; ++split)
+      {
+        leftBounds.include(binBounds[split - 1]);
+        leftCount += binCounts[split - 1];
+        const float cost = leftBounds.area() * float(leftCount) + rightCost[split];
+        if (leftCount > 0 && leftCount < task.count && cost < bestCost)
+        {
+          bestCost  = cost;
+          bestSplit = split;
+        }
+      }
+
+      if (bestSplit != 0)
+      {
+        if (bestCost >= bounds.area() * float(task.count) && task.count <= 4 * MAX_LEAF_SIZE)
+        {
+          makeLeaf();
+          continue;
+        }
+        middle = std::partition(first, last, [&](uint32_t prim) { return binOf(prim) < bestSplit; });
+      }
+    }
+
+    // all centroids in one bin, fall back to a median split
+    if (middle == nullptr)
+    {
+      middle = first + task.count / 2;
+      std::nth_element(first, middle, last,
+        [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+    }
+
+    const uint32_t leftCountFinal = static_cast<uint32_t>(middle - first);
+    const uint32_t leftNode = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_nodes[task.node].first    = leftNode;
+    m_nodes[task.node].primsNum = 0;
+
+    tasks.push_back({leftNode + 1, task.first + leftCountFinal, task.count - leftCountFinal});
+    tasks.push_back({leftNode, task.first, leftCountFinal});
+  }
+}
+
+bool Bvh::Refit(const std::vector<Box4f>& a_primBoxes)
+{
+  // a primitive that was empty at Build has no leaf to be refitted into
+  if (a_primBoxes.size() != m_inTree.size())
+    return false;
+  for (size_t i = 0; i < a_primBoxes.size(); ++i)
+  {
+    if (!m_inTree[i] && !is_empty(a_primBoxes[i]))
+      return false;
+  }
+
+  for (size_t nodeNo = m_nodes.size(); nodeNo-- > 0; )
+  {
+    Node& node = m_nodes[nodeNo];
+    Aabb bounds;
+    if (node.primsNum > 0)
+    {
+      for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+        if (!is_empty(a_primBoxes[m_primIndices[i]]))
+          bounds.include(to_aabb(a_primBoxes[m_primIndices[i]]));
+    }
+    else
+    {
+      bounds.include(Aabb{m_nodes[node.first].boxMin, m_nodes[node.first].boxMax});
+      bounds.include(Aabb{m_nodes[node.first + 1].boxMin, m_nodes[node.first + 1].boxMax});
+    }
+    node.boxMin = bounds.boxMin;
+    node.boxMax = bounds.boxMax;
+  }
+  return true;
+}
+
+void SceneBvh::Build(const SceneManager& a_scene)
+{
+  const float* vertices = a_scene.GetVertexData();
+  const uint32_t* indices = a_scene.GetIndexData();
+  const uint32_t stride = a_scene.GetVertexStride();
+  assert(a_scene.MeshesNum() == 0 || (vertices != nullptr && indices != nullptr));
+
+  m_blas.resize(a_scene.MeshesNum());
+  for (uint32_t meshId = 0; meshId < a_scene.MeshesNum(); ++meshId)
+  {
+    const MeshInfo info = a_scene.GetMeshInfo(meshId);
+    const uint32_t trianglesNum = info.m_indNum / 3;
+    auto position = [&](uint32_t corner)
+    {
+      const float* v = vertices + size_t(info.m_vertexOffset + indices[info.m_indexOffset + corner]) * stride;
+      return float3(v[0], v[1], v[2]);
+    };
+
+    std::vector<Box4f> triangleBoxes(trianglesNum);
+    for (uint32_t tri = 0; tri < trianglesNum; ++tri)
+    {
+      for (uint32_t corner = 0; corner < 3; ++corner)
+      {
+        const float3 p = position(3 * tri + corner);
+        triangleBoxes[tri].include(float4(p.x, p.y, p.z, 1.0f));
+      }
+    }
+
+    MeshBlas& blas = m_blas[meshId];
+    blas.bvh.Build(triangleBoxes);
+    blas.positions.resize(blas.bvh.PrimIndices().size() * 3);
+    for (size_t i = 0; i < blas.bvh.PrimIndices().size(); ++i)
+      for (uint32_t corner = 0; corner < 3; ++corner)
+        blas.positions[3 * i + corner] = position(3 * blas.bvh.PrimIndices()[i] + corner);
+  }
+
+  UpdateInstances(a_scene);
+  m_tlas.Build(m_instanceBoxes);
+}
+
+void SceneBvh::Refit(const SceneManager& a_scene)
+{
+  UpdateInstances(a_scene);
+  if (!m_tlas.Refit(m_instanceBoxes))
+    m_tlas.Build(m_instanceBoxes);
+}
+
+void SceneBvh::UpdateInstances(const SceneManager& a_scene)
+{
+  const uint32_t instancesNum = a_scene.InstancesNum();
+  m_instanceBoxes.resize(instancesNum);
+  m_instanceMatrices.resize(instancesNum);
+  m_instanceInverses.resize(instancesNum);
+  m_instanceMeshes.resize(instancesNum);
+  for (uint32_t instId = 0; instId < instancesNum; ++instId)
+  {
+    const InstanceInfo info = a_scene.GetInstanceInfo(instId);
+    // removed and unmarked instances are not part of the visible scene
+    m_instanceBoxes[instId] = info.renderMark ? a_scene.GetInstanceBbox(instId) : Box4f();
+    m_instanceMeshes[instId] = info.mesh_id;
+    if (!info.removed)
+    {
+      m_instanceMatrices[instId] = a_scene.GetInstanceMatrix(instId);
+      m_instanceInverses[instId] = LiteMath::inverse4x4(m_instanceMatrices[instId]);
+    }
+  }
+}
+
+bool SceneBvh::RayPick(const float3& a_origin, const float3& a_dir, float a_tMax, RayHit& a_hit) const
+{
+  if (m_tlas.Empty())
+    return false;
+
+  float closest = a_tMax;
+  bool found = false;
+  const float3 invDir = safe_inverse(a_dir);
+  const auto& nodes = m_tlas.Nodes();
+
+  TraversalStack stack(0);
+  while (!stack.empty())
+  {
+    const Bvh::Node& node = nodes[stack.pop()];
+    if (intersect_box(a_origin, invDir, closest, node.boxMin, node.boxMax) == FLT_MAX)
+      continue;
+
+    if (node.primsNum == 0)
+    {
+      stack.push(node.first);
+      stack.push(node.first + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+    {
+      const uint32_t instId = m_tlas.PrimIndices()[i];
+      const MeshBlas& blas = m_blas[m_instanceMeshes[instId]];
+      const Box4f& box = m_instanceBoxes[instId];
+      if (blas.bvh.Empty() || intersect_box(a_origin, invDir, closest, xyz(box.boxMin), xyz(box.boxMax)) == FLT_MAX)
+        continue;
+
+      // the direction is not normalized, so t is the same in object and world space
+      const float3 origin = transform_point(m_instanceInverses[instId], a_origin);
+      const float3 dir    = transform_dir(m_instanceInverses[instId], a_dir);
+      const float3 objInvDir = safe_inverse(dir);
+      const auto& blasNodes = blas.bvh.Nodes();
+
+      TraversalStack blasStack(0);
+      while (!blasStack.empty())
+      {
+        const Bvh::Node& blasNode = blasNodes[blasStack.pop()];
+        if (intersect_box(origin, objInvDir, closest, blasNode.boxMin, blasNode.boxMax) == FLT_MAX)
+          continue;
+
+        if (blasNode.primsNum == 0)
+        {
+          blasStack.push(blasNode.first);
+          blasStack.push(blasNode.first + 1);
+          continue;
+        }
+
+        for (uint32_t tri = blasNode.first; tri < blasNode.first + blasNode.primsNum; ++tri)
+        {
+          const float t = intersect_triangle(origin, dir,
+            blas.positions[3 * tri + 0], blas.positions[3 * tri + 1], blas.positions[3 * tri + 2]);
+          if (t < closest)
+          {
+            closest = t;
+            found = true;
+            a_hit = RayHit{t, instId, blas.bvh.PrimIndices()[tri]};
+          }
+        }
+      }
+    }
+  }
+  return found;
+}
+
+void SceneBvh::QueryBox(const Box4f& a_box, std::vector<uint32_t>& a_instances) const
+{
+  a_instances.clear();
+  if (m_tlas.Empty())
+    return;
+
+  const float3 boxMin = xyz(a_box.boxMin);
+  const float3 boxMax = xyz(a_box.boxMax);
+  auto overlaps = [&](const float3& bMin, const float3& bMax)
+  {
+    return bMin.x <= boxMax.x && bMin.y <= boxMax.y && bMin.z <= boxMax.z &&
+           boxMin.x <= bMax.x && boxMin.y <= bMax.y && boxMin.z <= bMax.z;
+  };
+
+  const auto& nodes = m_tlas.Nodes();
+  TraversalStack stack(0);
+  while (!stack.empty())
+  {
+    const Bvh::Node& node = nodes[stack.pop()];
+    if (!overlaps(node.boxMin, node.boxMax))
+      continue;
+
+    if (node.primsNum == 0)
+    {
+      stack.push(node.first);
+      stack.push(node.first + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+    {
+      const uint32_t instId = m_tlas.PrimIndices()[i];
+      const Box4f& box = m_instanceBoxes[instId];
+      if (!is_empty(box) && overlaps(xyz(box.boxMin), xyz(box.boxMax)))
+        a_instances.push_back(instId);
+    }
+  }
+}
+
+void SceneBvh::QueryFrustum(const float4x4& a_projView, std::vector<uint32_t>& a_instances) const
+{
+  a_instances.clear();
+  if (m_tlas.Empty())
+    return;
+
+  // same positive vertex test as FrustumCuller
+  const auto planes = ExtractFrustumPlanes(a_projView);
+  auto intersects = [&planes](const float3& bMin, const float3& bMax)
+  {
+    for (const auto& plane : planes)
+    {
+      const float3 positive(plane.x >= 0.0f ? bMax.x : bMin.x, plane.y >= 0.0f ? bMax.y : bMin.y,
+                            plane.z >= 0.0f ? bMax.z : bMin.z);
+      if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.0f)
+        return false;
+    }
+    return true;
+  };
+
+  const auto& nodes = m_tlas.Nodes();
+  TraversalStack stack(0);
+  while (!stack.empty())
+  {
+    const Bvh::Node& node = nodes[stack.pop()];
+    if (!intersects(node.boxMin, node.boxMax))
+      continue;
+
+    if (node.primsNum == 0)
+    {
+      stack.push(node.first);
+      stack.push(node.first + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+    {
+      const uint32_t instId = m_tlas.PrimIndices()[i];
+      const Box4f& box = m_instanceBoxes[instId];
+      if (!is_empty(box) && intersects(xyz(box.boxMin), xyz(box.boxMax)))
+        a_instances.push_back(instId);
+    }
+  }
+}
+
+bool SceneBvh::NearestSurface(const float3& a_point, float a_maxDistance, SurfaceHit& a_hit) const
+{
+  if (m_tlas.Empty())
+    return false;
+
+  float best2 = a_maxDistance * a_maxDistance;
+  bool found = false;
+  const auto& nodes = m_tlas.Nodes();
+
+  // nearer child goes on top of the stack, so the search radius shrinks quickly
+  TraversalStack stack(0);
+  while (!stack.empty())
+  {
+    const Bvh::Node& node = nodes[stack.pop()];
+    if (distance2_to_box(a_point, node.boxMin, node.boxMax) >= best2)
+      continue;
+
+    if (node.primsNum == 0)
+    {
+      const Bvh::Node& left  = nodes[node.first];
+      const Bvh::Node& right = nodes[node.first + 1];
+      const bool leftNearer = distance2_to_box(a_point, left.boxMin, left.boxMax)
+        <= distance2_to_box(a_point, right.boxMin, right.boxMax);
+      stack.push(leftNearer ? node.first + 1 : node.first);
+      stack.push(leftNearer ? node.first : node.first + 1);
+      continue;
+    }
+
+    for (uint32_t i = node.first; i < node.first + node.primsNum; ++i)
+    {
+      const uint32_t instId = m_tlas.PrimIndices()[i];
+      const MeshBlas& blas = m_blas[m_instanceMeshes[instId]];
+      const Box4f& box = m_instanceBoxes[instId];
+      if (blas.bvh.Empty() || is_empty(box) || distance2_to_box(a_point, xyz(box.boxMin), xyz(box.boxMax)) >= best2)
+        continue;
+
+      // BLAS boxes are taken to world space on the fly, distances are not preserved by scaled instances
+      const float4x4& matrix = m_instanceMatrices[instId];
+      const auto& blasNodes = blas.bvh.Nodes();
+
+      TraversalStack blasStack(0);
+      while (!blasStack.empty())
+      {
+        const Bvh::Node& blasNode = blasNodes[blasStack.pop()];
+        const Aabb worldBox = transform_aabb(matrix, blasNode.boxMin, blasNode.boxMax);
+        if (distance2_to_box(a_point, worldBox.boxMin, worldBox.boxMax) >= best2)
+          continue;
+
+        if (blasNode.primsNum == 0)
+        {
+          blasStack.push(blasNode.first);
+          blasStack.push(blasNode.first + 1);
+          continue;
+        }
+
+        for (uint32_t tri = blasNode.first; tri < blasNode.first + blasNode.primsNum; ++tri)
+        {
+          const float3 closest = closest_point_on_triangle(a_point,
+            transform_point(matrix, blas.positions[3 * tri + 0]),
+            transform_point(matrix, blas.positions[3 * tri + 1]),
+            transform_point(matrix, blas.positions[3 * tri + 2]));
+          const float3 delta = closest - a_point;
+          const float distance2 = dot(delta, delta);
+          if (distance2 < best2)
+          {
+            best2 = distance2;
+            found = true;
+            a_hit = SurfaceHit{std::sqrt(distance2), instId, closest};
+          }
+        }
+      }
+    }
+  }
+  return found;
+}
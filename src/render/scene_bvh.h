@@ -0,0 +1,90 @@
+#ifndef CHIMERA_SCENE_BVH_H
+#define CHIMERA_SCENE_BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "LiteMath.h"
+
+struct SceneManager;
+
+// Binary BVH over boxes, built with binned SAH. Children of an inner node are stored next to each other
+// and always after their parent, so a reverse pass over the nodes visits children first (see Refit).
+class Bvh
+{
+public:
+  struct Node
+  {
+    LiteMath::float3 boxMin;
+    LiteMath::float3 boxMax;
+    uint32_t first = 0;    // inner: left child, right one is first + 1; leaf: first index in PrimIndices
+    uint32_t primsNum = 0; // 0 for inner nodes
+  };
+
+  // Empty boxes (min > max) are left out
+  void Build(const std::vector<LiteMath::Box4f>& a_primBoxes);
+  // Recomputes node boxes for the same primitives, the tree quality degrades with large movements.
+  // Returns false and leaves the tree as it is if a primitive was added or became non-empty, Build is needed then.
+  bool Refit(const std::vector<LiteMath::Box4f>& a_primBoxes);
+
+  bool Empty() const { return m_nodes.empty(); }
+  const std::vector<Node>& Nodes() const { return m_nodes; }
+  const std::vector<uint32_t>& PrimIndices() const { return m_primIndices; }
+
+private:
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_primIndices;
+  std::vector<bool> m_inTree; // per primitive given to Build
+};
+
+// Two-level BVH over a SceneManager: one BLAS per mesh over its triangles in object space and a TLAS over
+// the world space instance boxes. Instances only refer to the BLAS of their mesh, so moving one needs
+// a TLAS refit and nothing else.
+class SceneBvh
+{
+public:
+  struct RayHit
+  {
+    float t = 0.0f;
+    uint32_t instId = 0;
+    uint32_t triangleId = 0; // mesh local, indices 3 * triangleId .. 3 * triangleId + 2
+  };
+
+  struct SurfaceHit
+  {
+    float distance = 0.0f;
+    uint32_t instId = 0;
+    LiteMath::float3 point;
+  };
+
+  // The scene must have its CPU geometry (SceneManager::GetVertexData) available
+  void Build(const SceneManager& a_scene);
+  // Picks up moved and removed instances, rebuilds the TLAS if instances were added or marked again
+  void Refit(const SceneManager& a_scene);
+
+  // Closest hit along a_origin + t * a_dir for t in [0, a_tMax]
+  bool RayPick(const LiteMath::float3& a_origin, const LiteMath::float3& a_dir, float a_tMax, RayHit& a_hit) const;
+  // Instances whose boxes overlap, in no particular order
+  void QueryBox(const LiteMath::Box4f& a_box, std::vector<uint32_t>& a_instances) const;
+  void QueryFrustum(const LiteMath::float4x4& a_projView, std::vector<uint32_t>& a_instances) const;
+  // Closest point on any instance surface within a_maxDistance
+  bool NearestSurface(const LiteMath::float3& a_point, float a_maxDistance, SurfaceHit& a_hit) const;
+
+private:
+  struct MeshBlas
+  {
+    Bvh bvh;
+    std::vector<LiteMath::float3> positions; // 3 per triangle, in bvh.PrimIndices() order
+  };
+
+  void UpdateInstances(const SceneManager& a_scene);
+
+  std::vector<MeshBlas> m_blas;
+  Bvh m_tlas;
+  std::vector<LiteMath::Box4f> m_instanceBoxes;
+  std::vector<LiteMath::float4x4> m_instanceMatrices;
+  std::vector<LiteMath::float4x4> m_instanceInverses;
+  std::vector<uint32_t> m_instanceMeshes;
+};
+
+#endif//CHIMERA_SCENE_BVH_H
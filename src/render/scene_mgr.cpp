@@ -1,9 +1,17 @@
 #include <map>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <numeric>
+#include <thread>
 #include "scene_mgr.h"
 #include "vk_utils.h"
 #include "vk_buffers.h"
 #include "../loader_utils/hydraxml.h"
+#include "../loader_utils/hydraxml_stream.h"
+
+#include <etna/GlobalContext.hpp>
+#include <etna/Etna.hpp>
 
 
 VkTransformMatrixKHR transformMatrixFromFloat4x4(const LiteMath::float4x4 &m)
@@ -21,21 +29,22 @@ VkTransformMatrixKHR transformMatrixFromFloat4x4(const LiteMath::float4x4 &m)
 }
 
 SceneManager::SceneManager(VkDevice a_device, VkPhysicalDevice a_physDevice,
-  uint32_t a_transferQId, uint32_t a_graphicsQId, bool debug) : m_device(a_device), m_physDevice(a_physDevice),
-                 m_transferQId(a_transferQId), m_graphicsQId(a_graphicsQId), m_debug(debug)
+  std::shared_ptr<UploadManager> a_pUploads, std::shared_ptr<GeometryHeap> a_pGeoHeap, bool debug)
+  : m_device(a_device), m_physDevice(a_physDevice), m_pUploads(std::move(a_pUploads)),
+    m_pGeoHeap(std::move(a_pGeoHeap)), m_debug(debug)
 {
-  vkGetDeviceQueue(m_device, m_transferQId, 0, &m_transferQ);
-  vkGetDeviceQueue(m_device, m_graphicsQId, 0, &m_graphicsQ);
-  VkDeviceSize scratchMemSize = 64 * 1024 * 1024;
-  m_pCopyHelper = std::make_shared<vk_utils::PingPongCopyHelper>(m_physDevice, m_device, m_transferQ, m_transferQId, scratchMemSize);
   m_pMeshData   = std::make_shared<Mesh8F>();
 
 }
 
 bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
 {
-  auto hscene_main = std::make_shared<hydra_xml::HydraScene>();
-  auto res         = hscene_main->LoadState(scenePath);
+  const std::string snapshotPath = scenePath + ".snapshot";
+  if(LoadSceneSnapshot(snapshotPath, transpose))
+    return true;
+
+  hydra_xml::SceneDescription scene;
+  auto res = hydra_xml::LoadSceneDescription(scenePath, scene);
 
   if(res < 0)
   {
@@ -43,26 +52,75 @@ bool SceneManager::LoadSceneXML(const std::string &scenePath, bool transpose)
     return false;
   }
 
-  for(auto loc : hscene_main->MeshFiles())
+  const auto& meshLocs = scene.meshLocs;
+
+  // instances are added mesh by mesh, so group them with a stable counting sort
+  std::vector<uint32_t> meshFirstInstance(meshLocs.size() + 1, 0);
+  for(uint32_t meshNo : scene.instanceMeshes)
+    meshFirstInstance[meshNo + 1]++;
+  std::partial_sum(meshFirstInstance.begin(), meshFirstInstance.end(), meshFirstInstance.begin());
+
+  std::vector<uint32_t> instancesByMesh(scene.instanceMeshes.size());
+  {
+    std::vector<uint32_t> fill(meshFirstInstance.begin(), meshFirstInstance.end() - 1);
+    for(uint32_t i = 0; i < scene.instanceMeshes.size(); ++i)
+      instancesByMesh[fill[scene.instanceMeshes[i]]++] = i;
+  }
+
+  // reading, decoding and bboxes are independent per mesh,
+  // only appending to m_pMeshData has to go in the scene order
+  // a thread per core takes the next mesh until none is left, the standard parallel algorithms would need TBB
+  // with libstdc++ and quietly run serially without it
+  std::vector<cmesh::SimpleMesh> meshes(meshLocs.size());
+  std::vector<LiteMath::Box4f> meshBboxes(meshLocs.size());
+  std::atomic<size_t> nextMesh = 0;
+  auto loadMeshes = [&meshLocs, &meshes, &meshBboxes, &nextMesh]()
   {
-    auto meshId    = AddMeshFromFile(loc);
-    auto instances = hscene_main->GetAllInstancesOfMeshLoc(loc); 
-    for(size_t j = 0; j < instances.size(); ++j)
+    for(size_t i = nextMesh++; i < meshLocs.size(); i = nextMesh++)
+    {
+      meshes[i] = cmesh::LoadMeshFromVSGF(meshLocs[i].c_str());
+      if(meshes[i].VerticesNum() > 0)
+        meshBboxes[i] = CalculateMeshBbox(meshes[i]);
+    }
+  };
+
+  const size_t threadsNum = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), meshLocs.size());
+  std::vector<std::thread> loaders;
+  for(size_t i = 1; i < threadsNum; ++i)
+    loaders.emplace_back(loadMeshes);
+  loadMeshes();
+  for(auto& loader : loaders)
+    loader.join();
+
+  for(size_t i = 0; i < meshLocs.size(); ++i)
+  {
+    if(meshes[i].VerticesNum() == 0)
+      RUN_TIME_ERROR(("can't load mesh at " + meshLocs[i]).c_str());
+
+    auto meshId = AddMeshFromData(meshes[i], meshBboxes[i]);
+    meshes[i]   = cmesh::SimpleMesh();
+
+    for(uint32_t j = meshFirstInstance[i]; j < meshFirstInstance[i + 1]; ++j)
     {
+      const auto& matrix = scene.instanceMatrices[instancesByMesh[j]];
       if(transpose)
-        InstanceMesh(meshId, LiteMath::transpose(instances[j]));
+        InstanceMesh(meshId, LiteMath::transpose(matrix));
       else
-        InstanceMesh(meshId, instances[j]);
+        InstanceMesh(meshId, matrix);
     }
   }
 
-  for(auto cam : hscene_main->Cameras())
+  for(const auto& cam : scene.cameras)
   {
     m_sceneCameras.push_back(cam);
   }
 
-  LoadGeoDataOnGPU();
-  hscene_main = nullptr;
+  LoadGeoDataOnGPU(m_pMeshData->VertexData(), m_pMeshData->VertexDataSize(),
+    m_pMeshData->IndexData(), m_pMeshData->IndexDataSize());
+
+  std::vector<std::string> sourcePaths = {scenePath};
+  sourcePaths.insert(sourcePaths.end(), meshLocs.begin(), meshLocs.end());
+  SaveSceneSnapshot(snapshotPath, transpose, sourcePaths);
 
   return true;
 }
@@ -103,26 +161,12 @@ void SceneManager::LoadSingleTriangle()
 
   VkDeviceSize vertexBufSize = sizeof(Vertex) * vertices.size();
   VkDeviceSize indexBufSize  = sizeof(uint32_t) * indices.size();
-  
-  VkMemoryRequirements vertMemReq, idxMemReq; 
-  m_geoVertBuf = vk_utils::createBuffer(m_device, vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &vertMemReq);
-  m_geoIdxBuf  = vk_utils::createBuffer(m_device, indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &idxMemReq);
-
-  size_t pad = vk_utils::getPaddedSize(vertMemReq.size, idxMemReq.alignment);
-
-  VkMemoryAllocateInfo allocateInfo = {};
-  allocateInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocateInfo.pNext           = nullptr;
-  allocateInfo.allocationSize  = pad + idxMemReq.size;
-  allocateInfo.memoryTypeIndex = vk_utils::findMemoryType(vertMemReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physDevice);
-
 
-  VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &m_geoMemAlloc));
-
-  VK_CHECK_RESULT(vkBindBufferMemory(m_device, m_geoVertBuf, m_geoMemAlloc, 0));
-  VK_CHECK_RESULT(vkBindBufferMemory(m_device, m_geoIdxBuf,  m_geoMemAlloc, pad));
-  m_pCopyHelper->UpdateBuffer(m_geoVertBuf, 0, vertices.data(),  vertexBufSize);
-  m_pCopyHelper->UpdateBuffer(m_geoIdxBuf,  0, indices.data(), indexBufSize);
+  m_geoVertBuf = m_pGeoHeap->CreateBuffer(vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoVertAlloc);
+  m_geoIdxBuf  = m_pGeoHeap->CreateBuffer(indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoIdxAlloc);
+  m_pUploads->UploadBuffer(m_geoVertBuf, 0, vertices.data(),  vertexBufSize);
+  m_pUploads->UploadBuffer(m_geoIdxBuf,  0, indices.data(), indexBufSize);
+  m_pUploads->Flush();
 }
 
 
@@ -138,10 +182,27 @@ uint32_t SceneManager::AddMeshFromFile(const std::string& meshPath)
   return AddMeshFromData(data);
 }
 
+LiteMath::Box4f SceneManager::CalculateMeshBbox(const cmesh::SimpleMesh &meshData)
+{
+  Box4f meshBox;
+  for (uint32_t i = 0; i < meshData.VerticesNum(); ++i) {
+    meshBox.include(reinterpret_cast<const float4*>(meshData.vPos4f.data())[i]);
+  }
+  return meshBox;
+}
+
 uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData)
+{
+  return AddMeshFromData(meshData, CalculateMeshBbox(meshData));
+}
+
+uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData, const LiteMath::Box4f &meshBox)
 {
   assert(meshData.VerticesNum() > 0);
   assert(meshData.IndicesNum() > 0);
+  // the geometry buffers are not grown, and appending could move the data GetVertexData points to
+  if(m_geoVertBuf != VK_NULL_HANDLE)
+    RUN_TIME_ERROR("meshes can't be added after the scene geometry is loaded on GPU");
 
   m_pMeshData->Append(meshData);
 
@@ -159,30 +220,13 @@ uint32_t SceneManager::AddMeshFromData(cmesh::SimpleMesh &meshData)
   m_totalIndices  += (uint32_t)meshData.IndicesNum();
 
   m_meshInfos.push_back(info);
-  Box4f meshBox;
-  for (uint32_t i = 0; i < meshData.VerticesNum(); ++i) {
-    meshBox.include(reinterpret_cast<float4*>(meshData.vPos4f.data())[i]);
-  }
   m_meshBboxes.push_back(meshBox);
 
   return (uint32_t)m_meshInfos.size() - 1;
 }
 
-uint32_t SceneManager::InstanceMesh(const uint32_t meshId, const LiteMath::float4x4 &matrix, bool markForRender)
+LiteMath::Box4f SceneManager::CalculateInstanceBbox(uint32_t meshId, const LiteMath::float4x4 &matrix) const
 {
-  assert(meshId < m_meshInfos.size());
-
-  //@TODO: maybe move
-  m_instanceMatrices.push_back(matrix);
-
-  InstanceInfo info;
-  info.inst_id       = (uint32_t)m_instanceMatrices.size() - 1;
-  info.mesh_id       = meshId;
-  info.renderMark    = markForRender;
-  info.instBufOffset = (m_instanceMatrices.size() - 1) * sizeof(matrix);
-
-  m_instanceInfos.push_back(info);
-
   Box4f instBox;
   for (uint32_t i = 0; i < 8; ++i) {
     float4 corner = float4(
@@ -193,37 +237,171 @@ uint32_t SceneManager::InstanceMesh(const uint32_t meshId, const LiteMath::float
     );
     instBox.include(matrix * corner);
   }
-  sceneBbox.include(instBox);
-  m_instanceBboxes.push_back(instBox);
+  return instBox;
+}
+
+uint32_t SceneManager::InstanceMesh(const uint32_t meshId, const LiteMath::float4x4 &matrix, bool markForRender)
+{
+  assert(meshId < m_meshInfos.size());
+
+  uint32_t instId;
+  if(!m_freeInstances.empty())
+  {
+    instId = m_freeInstances.back();
+    m_freeInstances.pop_back();
+  }
+  else
+  {
+    instId = (uint32_t)m_instanceInfos.size();
+    m_instanceInfos.emplace_back();
+    m_instanceMatrices.emplace_back();
+    m_instanceBboxes.emplace_back();
+    m_drawCommands.emplace_back();
+    m_instanceDirtyFlags.push_back(0);
+  }
+
+  InstanceInfo info;
+  info.inst_id       = instId;
+  info.mesh_id       = meshId;
+  info.renderMark    = markForRender;
+  info.instBufOffset = instId * sizeof(matrix);
+
+  m_instanceInfos[instId]    = info;
+  m_instanceMatrices[instId] = matrix;
+  m_instanceBboxes[instId]   = CalculateInstanceBbox(meshId, matrix);
+  sceneBbox.include(m_instanceBboxes[instId]);
+
+  MarkInstanceDirty(instId);
 
   return info.inst_id;
 }
 
+void SceneManager::RemoveInstance(const uint32_t instId)
+{
+  assert(instId < m_instanceInfos.size() && !m_instanceInfos[instId].removed);
+
+  ReleaseInstanceBbox(m_instanceBboxes[instId]);
+  m_instanceInfos[instId].removed    = true;
+  m_instanceInfos[instId].renderMark = false;
+  // an empty box fails every plane test, both culling paths skip it
+  m_instanceBboxes[instId] = Box4f();
+  m_freeInstances.push_back(instId);
+
+  MarkInstanceDirty(instId);
+}
+
+void SceneManager::SetInstanceMatrix(const uint32_t instId, const LiteMath::float4x4 &matrix)
+{
+  assert(instId < m_instanceInfos.size() && !m_instanceInfos[instId].removed);
+
+  ReleaseInstanceBbox(m_instanceBboxes[instId]);
+  m_instanceMatrices[instId] = matrix;
+  m_instanceBboxes[instId]   = CalculateInstanceBbox(m_instanceInfos[instId].mesh_id, matrix);
+  sceneBbox.include(m_instanceBboxes[instId]);
+
+  MarkInstanceDirty(instId);
+}
+
 void SceneManager::MarkInstance(const uint32_t instId)
 {
-  assert(instId < m_instanceInfos.size());
+  assert(instId < m_instanceInfos.size() && !m_instanceInfos[instId].removed);
   m_instanceInfos[instId].renderMark = true;
+  MarkInstanceDirty(instId);
 }
 
 void SceneManager::UnmarkInstance(const uint32_t instId)
 {
   assert(instId < m_instanceInfos.size());
   m_instanceInfos[instId].renderMark = false;
+  MarkInstanceDirty(instId);
 }
 
-void SceneManager::LoadGeoDataOnGPU()
+void SceneManager::ReleaseInstanceBbox(const LiteMath::Box4f &box)
 {
-  VkDeviceSize vertexBufSize = m_pMeshData->VertexDataSize();
-  VkDeviceSize indexBufSize  = m_pMeshData->IndexDataSize();
-  VkDeviceSize infoBufSize   = m_meshInfos.size() * sizeof(uint32_t) * 2;
+  if(box.boxMin.x <= sceneBbox.boxMin.x || box.boxMin.y <= sceneBbox.boxMin.y || box.boxMin.z <= sceneBbox.boxMin.z ||
+     box.boxMax.x >= sceneBbox.boxMax.x || box.boxMax.y >= sceneBbox.boxMax.y || box.boxMax.z >= sceneBbox.boxMax.z)
+    m_sceneBboxDirty = true;
+}
+
+VkDrawIndexedIndirectCommand SceneManager::MakeDrawCommand(const uint32_t instId) const
+{
+  const auto& inst = m_instanceInfos[instId];
+  const auto& mesh = m_meshInfos[inst.mesh_id];
+  return VkDrawIndexedIndirectCommand
+    {
+      .indexCount    = mesh.m_indNum,
+      .instanceCount = inst.renderMark ? 1u : 0u,
+      .firstIndex    = mesh.m_indexOffset,
+      .vertexOffset  = static_cast<int32_t>(mesh.m_vertexOffset),
+      .firstInstance = inst.inst_id
+    };
+}
 
-  m_geoVertBuf  = vk_utils::createBuffer(m_device, vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-  m_geoIdxBuf   = vk_utils::createBuffer(m_device, indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-  m_meshInfoBuf = vk_utils::createBuffer(m_device, infoBufSize,   VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+void SceneManager::MarkInstanceDirty(const uint32_t instId)
+{
+  m_drawCommands[instId] = MakeDrawCommand(instId);
+  if(m_instanceDirtyFlags[instId] == 0)
+  {
+    m_instanceDirtyFlags[instId] = 1;
+    m_dirtyInstances.push_back(instId);
+  }
+}
 
-  VkMemoryAllocateFlags allocFlags {};
+bool SceneManager::UpdateInstancesOnGPU(std::vector<uint32_t> &a_updated)
+{
+  a_updated.clear();
 
-  m_geoMemAlloc = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, {m_geoVertBuf, m_geoIdxBuf, m_meshInfoBuf}, allocFlags);
+  if(m_sceneBboxDirty)
+  {
+    sceneBbox = Box4f();
+    for(const auto& box : m_instanceBboxes)
+      sceneBbox.include(box);
+    m_sceneBboxDirty = false;
+  }
+
+  if(m_dirtyInstances.empty())
+    return false;
+
+  if(m_instanceInfos.size() > m_instanceCapacity)
+  {
+    // the old buffers may still be read by frames in flight
+    vkDeviceWaitIdle(m_device);
+    LoadInstanceDataOnGPU();
+    m_pUploads->Flush();
+    return true;
+  }
+
+  // instances close to each other are sent as one range, re-uploading a few clean ones is cheaper than a copy per instance
+  constexpr uint32_t MERGE_GAP = 16;
+  std::sort(m_dirtyInstances.begin(), m_dirtyInstances.end());
+  for(size_t first = 0; first < m_dirtyInstances.size(); )
+  {
+    size_t last = first;
+    while(last + 1 < m_dirtyInstances.size() && m_dirtyInstances[last + 1] - m_dirtyInstances[last] <= MERGE_GAP)
+      ++last;
+    UploadInstanceRange(m_dirtyInstances[first], m_dirtyInstances[last] + 1);
+    first = last + 1;
+  }
+
+  for(uint32_t instId : m_dirtyInstances)
+    m_instanceDirtyFlags[instId] = 0;
+  a_updated.swap(m_dirtyInstances);
+  m_dirtyInstances.clear();
+
+  m_pUploads->Flush();
+  return false;
+}
+
+void SceneManager::LoadGeoDataOnGPU(const void* vertexData, VkDeviceSize vertexBufSize,
+  const void* indexData, VkDeviceSize indexBufSize)
+{
+  VkDeviceSize infoBufSize   = m_meshInfos.size() * sizeof(uint32_t) * 2;
+  m_cpuVertexData = vertexData;
+  m_cpuIndexData  = indexData;
+
+  m_geoVertBuf  = m_pGeoHeap->CreateBuffer(vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoVertAlloc);
+  m_geoIdxBuf   = m_pGeoHeap->CreateBuffer(indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoIdxAlloc);
+  m_meshInfoBuf = m_pGeoHeap->CreateBuffer(infoBufSize,   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_meshInfoAlloc);
 
   std::vector<LiteMath::uint2> mesh_info_tmp;
   for(const auto& m : m_meshInfos)
@@ -231,55 +409,107 @@ void SceneManager::LoadGeoDataOnGPU()
     mesh_info_tmp.emplace_back(m.m_indexOffset, m.m_vertexOffset);
   }
 
-  m_pCopyHelper->UpdateBuffer(m_geoVertBuf, 0, m_pMeshData->VertexData(), vertexBufSize);
-  m_pCopyHelper->UpdateBuffer(m_geoIdxBuf,  0, m_pMeshData->IndexData(), indexBufSize);
+  m_pUploads->UploadBuffer(m_geoVertBuf, 0, vertexData, vertexBufSize);
+  m_pUploads->UploadBuffer(m_geoIdxBuf,  0, indexData, indexBufSize);
   if(!mesh_info_tmp.empty())
-    m_pCopyHelper->UpdateBuffer(m_meshInfoBuf,  0, mesh_info_tmp.data(), mesh_info_tmp.size() * sizeof(mesh_info_tmp[0]));
+    m_pUploads->UploadBuffer(m_meshInfoBuf,  0, mesh_info_tmp.data(), mesh_info_tmp.size() * sizeof(mesh_info_tmp[0]));
+
+  LoadInstanceDataOnGPU();
+  // start copying while the caller goes on loading
+  m_pUploads->Flush();
 }
 
-void SceneManager::DrawMarkedInstances()
+void SceneManager::LoadInstanceDataOnGPU()
 {
+  if(m_instanceInfos.empty())
+    return;
+
+  const uint32_t instancesNum = (uint32_t)m_instanceInfos.size();
+  m_drawCommands.resize(instancesNum);
+  for(uint32_t instId = 0; instId < instancesNum; ++instId)
+    m_drawCommands[instId] = MakeDrawCommand(instId);
+  m_instanceDirtyFlags.assign(instancesNum, 0);
+  m_dirtyInstances.clear();
 
+  // headroom for instances added at runtime, doubled every time it runs out
+  m_instanceCapacity = std::max({64u, instancesNum + instancesNum / 4, m_instanceCapacity * 2});
+
+  m_instanceMatricesBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo
+    {
+      .size        = m_instanceCapacity * sizeof(m_instanceMatrices[0]),
+      .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+      .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+      .name        = "instance_matrices"
+    });
+
+  m_drawCommandsBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo
+    {
+      .size        = m_instanceCapacity * sizeof(m_drawCommands[0]),
+      .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer
+                   | vk::BufferUsageFlagBits::eTransferDst,
+      .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+      .name        = "draw_commands"
+    });
+
+  m_instanceBboxesBuffer = etna::get_context().createBuffer(etna::Buffer::CreateInfo
+    {
+      .size        = m_instanceCapacity * sizeof(LiteMath::float4) * 2,
+      .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+      .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+      .name        = "instance_bboxes"
+    });
+
+  UploadInstanceRange(0, instancesNum);
 }
 
-void SceneManager::DestroyScene()
+void SceneManager::UploadInstanceRange(uint32_t firstInst, uint32_t endInst)
 {
-  if(m_geoVertBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_geoVertBuf, nullptr);
-    m_geoVertBuf = VK_NULL_HANDLE;
-  }
+  const uint32_t count = endInst - firstInst;
 
-  if(m_geoIdxBuf != VK_NULL_HANDLE)
+  std::vector<LiteMath::float4> bboxes;
+  bboxes.reserve(count * 2);
+  for(uint32_t instId = firstInst; instId < endInst; ++instId)
   {
-    vkDestroyBuffer(m_device, m_geoIdxBuf, nullptr);
-    m_geoIdxBuf = VK_NULL_HANDLE;
+    bboxes.push_back(m_instanceBboxes[instId].boxMin);
+    bboxes.push_back(m_instanceBboxes[instId].boxMax);
   }
 
-  if(m_meshInfoBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_meshInfoBuf, nullptr);
-    m_meshInfoBuf = VK_NULL_HANDLE;
-  }
+  m_pUploads->UploadBuffer(m_instanceBboxesBuffer.get(), firstInst * sizeof(bboxes[0]) * 2, bboxes.data(),
+    bboxes.size() * sizeof(bboxes[0]));
+  m_pUploads->UploadBuffer(m_instanceMatricesBuffer.get(), firstInst * sizeof(m_instanceMatrices[0]),
+    m_instanceMatrices.data() + firstInst, count * sizeof(m_instanceMatrices[0]));
+  m_pUploads->UploadBuffer(m_drawCommandsBuffer.get(), firstInst * sizeof(m_drawCommands[0]),
+    m_drawCommands.data() + firstInst, count * sizeof(m_drawCommands[0]));
+}
 
-  if(m_instanceMatricesBuffer != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_instanceMatricesBuffer, nullptr);
-    m_instanceMatricesBuffer = VK_NULL_HANDLE;
-  }
+void SceneManager::DestroyScene()
+{
+  // copies into the buffers below may still be in flight
+  if(m_pUploads != nullptr)
+    m_pUploads->WaitIdle();
 
-  if(m_geoMemAlloc != VK_NULL_HANDLE)
-  {
-    vkFreeMemory(m_device, m_geoMemAlloc, nullptr);
-    m_geoMemAlloc = VK_NULL_HANDLE;
-  }
+  // the ranges go back to the heap for the next scene or other geometry
+  m_pGeoHeap->DestroyBuffer(m_geoVertBuf,  m_geoVertAlloc);
+  m_pGeoHeap->DestroyBuffer(m_geoIdxBuf,   m_geoIdxAlloc);
+  m_pGeoHeap->DestroyBuffer(m_meshInfoBuf, m_meshInfoAlloc);
 
-  m_pCopyHelper = nullptr;
+  m_instanceMatricesBuffer = etna::Buffer();
+  m_drawCommandsBuffer = etna::Buffer();
+  m_instanceBboxesBuffer = etna::Buffer();
 
   m_meshInfos.clear();
   m_pMeshData = nullptr;
+  m_snapshotFile = nullptr;
+  m_cpuVertexData = nullptr;
+  m_cpuIndexData  = nullptr;
   m_instanceInfos.clear();
   m_instanceMatrices.clear();
+  m_instanceBboxes.clear();
+  m_drawCommands.clear();
+  m_freeInstances.clear();
+  m_dirtyInstances.clear();
+  m_instanceDirtyFlags.clear();
+  m_instanceCapacity = 0;
 }
 
 etna::VertexByteStreamFormatDescription SceneManager::GetVertexStreamDescription()
@@ -5,10 +5,13 @@
 
 #include <geom/vk_mesh.h>
 #include "LiteMath.h"
-#include <vk_copy.h>
+#include <etna/Buffer.hpp>
 #include <etna/VertexInput.hpp>
 
 #include "../loader_utils/hydraxml.h"
+#include "upload_manager.h"
+#include "geometry_heap.h"
+#include "../loader_utils/mapped_file.h"
 #include "../resources/shaders/common.h"
 
 struct InstanceInfo
@@ -17,26 +20,37 @@ struct InstanceInfo
   uint32_t mesh_id = 0u;
   VkDeviceSize instBufOffset = 0u;
   bool renderMark = false;
+  bool removed = false;
 };
 
 struct SceneManager
 {
-  SceneManager(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId, uint32_t a_graphicsQId,
-    bool debug = false);
+  SceneManager(VkDevice a_device, VkPhysicalDevice a_physDevice, std::shared_ptr<UploadManager> a_pUploads,
+    std::shared_ptr<GeometryHeap> a_pGeoHeap, bool debug = false);
   ~SceneManager() { DestroyScene(); }
 
   bool LoadSceneXML(const std::string &scenePath, bool transpose = true);
   void LoadSingleTriangle();
 
+  // Meshes can only be added before LoadSceneXML uploads the geometry, the GPU buffers are not grown afterwards
   uint32_t AddMeshFromFile(const std::string& meshPath);
   uint32_t AddMeshFromData(cmesh::SimpleMesh &meshData);
+  uint32_t AddMeshFromData(cmesh::SimpleMesh &meshData, const LiteMath::Box4f &meshBox);
 
+  // Instances can be added, removed, moved and (un)marked at any time, also after LoadGeoDataOnGPU.
+  // Changes are kept on CPU and uploaded by UpdateInstancesOnGPU. Removed instances stay in place as
+  // tombstones (empty bbox, no instances to draw) and their ids are reused by the next InstanceMesh.
   uint32_t InstanceMesh(uint32_t meshId, const LiteMath::float4x4 &matrix, bool markForRender = true);
+  void RemoveInstance(uint32_t instId);
+  void SetInstanceMatrix(uint32_t instId, const LiteMath::float4x4 &matrix);
 
   void MarkInstance(uint32_t instId);
   void UnmarkInstance(uint32_t instId);
 
-  void DrawMarkedInstances();
+  // Uploads the instances changed since the last call, merged into ranges, and writes their ids to a_updated.
+  // Returns true if the instance buffers had to be reallocated to grow: the device has been waited idle,
+  // all instances were uploaded and everything sized by InstanceCapacity must be recreated.
+  bool UpdateInstancesOnGPU(std::vector<uint32_t> &a_updated);
 
   void DestroyScene();
 
@@ -45,10 +59,25 @@ struct SceneManager
   VkBuffer GetVertexBuffer() const { return m_geoVertBuf; }
   VkBuffer GetIndexBuffer()  const { return m_geoIdxBuf; }
   VkBuffer GetMeshInfoBuffer()  const { return m_meshInfoBuf; }
-  std::shared_ptr<vk_utils::ICopyEngine> GetCopyHelper() { return  m_pCopyHelper; }
+  // mat4 per instance, indexed with gl_InstanceIndex
+  const etna::Buffer& GetInstanceMatricesBuffer() const { return m_instanceMatricesBuffer; }
+  // VkDrawIndexedIndirectCommand per instance, firstInstance is the instance id
+  const etna::Buffer& GetDrawCommandsBuffer() const { return m_drawCommandsBuffer; }
+  // world space bbox per instance as two float4: min, max
+  const etna::Buffer& GetInstanceBboxesBuffer() const { return m_instanceBboxesBuffer; }
+  const std::vector<VkDrawIndexedIndirectCommand>& GetDrawCommands() const { return m_drawCommands; }
+  const std::vector<LiteMath::Box4f>& GetInstanceBboxes() const { return m_instanceBboxes; }
+  std::shared_ptr<UploadManager> GetUploadManager() { return m_pUploads; }
+  // CPU copy of the geometry buffers for queries like SceneBvh, valid from loading until DestroyScene.
+  // Positions are the first 3 floats of every vertex, indices are relative to MeshInfo::m_vertexOffset.
+  const float* GetVertexData() const { return static_cast<const float*>(m_cpuVertexData); }
+  const uint32_t* GetIndexData() const { return static_cast<const uint32_t*>(m_cpuIndexData); }
+  uint32_t GetVertexStride() const { return uint32_t(m_pMeshData->SingleVertexSize() / sizeof(float)); }
 
   uint32_t MeshesNum() const {return (uint32_t)m_meshInfos.size();}
   uint32_t InstancesNum() const {return (uint32_t)m_instanceInfos.size();}
+  // size of the GPU instance buffers, instances added at runtime fit without reallocation up to it
+  uint32_t InstanceCapacity() const {return m_instanceCapacity;}
 
   hydra_xml::Camera GetCamera(uint32_t camId) const;
   MeshInfo GetMeshInfo(uint32_t meshId) const {assert(meshId < m_meshInfos.size()); return m_meshInfos[meshId];}
@@ -59,15 +88,42 @@ struct SceneManager
   LiteMath::Box4f GetSceneBbox() const {return sceneBbox;}
 
 private:
-  void LoadGeoDataOnGPU();
+  static LiteMath::Box4f CalculateMeshBbox(const cmesh::SimpleMesh &meshData);
+
+  // vertex and index data come either from m_pMeshData or straight from a mapped snapshot
+  void LoadGeoDataOnGPU(const void* vertexData, VkDeviceSize vertexBufSize, const void* indexData, VkDeviceSize indexBufSize);
+  void LoadInstanceDataOnGPU();
+  void UploadInstanceRange(uint32_t firstInst, uint32_t endInst);
+
+  LiteMath::Box4f CalculateInstanceBbox(uint32_t meshId, const LiteMath::float4x4 &matrix) const;
+  VkDrawIndexedIndirectCommand MakeDrawCommand(uint32_t instId) const;
+  void MarkInstanceDirty(uint32_t instId);
+  // sceneBbox only grows incrementally; it is recomputed if a box touching its border moves away
+  void ReleaseInstanceBbox(const LiteMath::Box4f &box);
+
+  // <scene>.snapshot holds everything LoadSceneXML builds, see scene_snapshot.cpp.
+  // Loading fails (and the XML is parsed again) if the snapshot is missing, from another version,
+  // or any of the source files changed size or mtime.
+  bool LoadSceneSnapshot(const std::string &snapshotPath, bool transpose);
+  void SaveSceneSnapshot(const std::string &snapshotPath, bool transpose, const std::vector<std::string> &sourcePaths) const;
 
   std::vector<MeshInfo> m_meshInfos = {};
   std::vector<LiteMath::Box4f> m_meshBboxes = {};
   std::shared_ptr<IMeshData> m_pMeshData = nullptr;
+  // kept mapped after loading from a snapshot, the CPU geometry points into it
+  std::shared_ptr<MappedFile> m_snapshotFile = nullptr;
+  const void* m_cpuVertexData = nullptr;
+  const void* m_cpuIndexData  = nullptr;
 
   std::vector<InstanceInfo> m_instanceInfos = {};
   std::vector<LiteMath::Box4f> m_instanceBboxes = {};
   std::vector<LiteMath::float4x4> m_instanceMatrices = {};
+  std::vector<VkDrawIndexedIndirectCommand> m_drawCommands = {};
+  std::vector<uint32_t> m_freeInstances = {};
+  std::vector<uint32_t> m_dirtyInstances = {};
+  std::vector<uint8_t> m_instanceDirtyFlags = {};
+  uint32_t m_instanceCapacity = 0u;
+  bool m_sceneBboxDirty = false;
 
   std::vector<hydra_xml::Camera> m_sceneCameras = {};
   LiteMath::Box4f sceneBbox;
@@ -78,17 +134,17 @@ private:
   VkBuffer m_geoVertBuf = VK_NULL_HANDLE;
   VkBuffer m_geoIdxBuf  = VK_NULL_HANDLE;
   VkBuffer m_meshInfoBuf  = VK_NULL_HANDLE;
-  VkBuffer m_instanceMatricesBuffer = VK_NULL_HANDLE;
-  VkDeviceMemory m_geoMemAlloc = VK_NULL_HANDLE;
+  GeometryHeap::Allocation m_geoVertAlloc;
+  GeometryHeap::Allocation m_geoIdxAlloc;
+  GeometryHeap::Allocation m_meshInfoAlloc;
+  etna::Buffer m_instanceMatricesBuffer;
+  etna::Buffer m_drawCommandsBuffer;
+  etna::Buffer m_instanceBboxesBuffer;
 
   VkDevice m_device = VK_NULL_HANDLE;
   VkPhysicalDevice m_physDevice = VK_NULL_HANDLE;
-  uint32_t m_transferQId = UINT32_MAX;
-  VkQueue m_transferQ = VK_NULL_HANDLE;
-
-  uint32_t m_graphicsQId = UINT32_MAX;
-  VkQueue m_graphicsQ = VK_NULL_HANDLE;
-  std::shared_ptr<vk_utils::ICopyEngine> m_pCopyHelper;
+  std::shared_ptr<UploadManager> m_pUploads;
+  std::shared_ptr<GeometryHeap> m_pGeoHeap;
 
   bool m_debug = false;
   // for debugging
@@ -0,0 +1,222 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include "scene_mgr.h"
+#include "vk_utils.h"
+#include "../loader_utils/mapped_file.h"
+
+// Snapshot layout: header, then sections in the order below, each aligned to SECTION_ALIGNMENT.
+// Everything is stored as laid out in memory, so a snapshot is only valid for the build that wrote it.
+//   SourceFile[sourcesNum]     XML first, then meshes, each with the size and mtime at save time
+//   char[pathsSize]            source paths, referenced by SourceFile
+//   MeshInfo[meshesNum], Box4f[meshesNum]
+//   InstanceInfo[instancesNum], float4x4[instancesNum], Box4f[instancesNum]
+//   hydra_xml::Camera[camerasNum]
+//   vertex data, index data
+namespace
+{
+  constexpr char     SNAPSHOT_MAGIC[8]   = "SCNSNAP";
+  constexpr uint32_t SNAPSHOT_VERSION    = 2;
+  constexpr size_t   SECTION_ALIGNMENT   = 16;
+
+  struct SnapshotHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t transpose;
+    uint32_t sourcesNum;
+    uint32_t pathsSize;
+    uint32_t meshesNum;
+    uint32_t instancesNum;
+    uint32_t camerasNum;
+    uint32_t totalVertices;
+    uint32_t totalIndices;
+    uint32_t singleVertexSize;
+    uint64_t vertexDataSize;
+    uint64_t indexDataSize;
+    LiteMath::Box4f sceneBbox;
+  };
+
+  struct SourceFile
+  {
+    int64_t  mtime;
+    uint64_t size;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+  };
+
+  static_assert(std::is_trivially_copyable_v<MeshInfo>);
+  static_assert(std::is_trivially_copyable_v<InstanceInfo>);
+  static_assert(std::is_trivially_copyable_v<hydra_xml::Camera>);
+
+  size_t align_section(size_t offset) { return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT; }
+
+  bool stat_source(const std::string &path, SourceFile &source)
+  {
+    std::error_code ec;
+    source.size = std::filesystem::file_size(path, ec);
+    if(ec)
+      return false;
+    source.mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+  }
+
+  // Sequential reader over the mapped snapshot, every section starts aligned
+  struct SectionReader
+  {
+    const char* data;
+    size_t size;
+    size_t offset = align_section(sizeof(SnapshotHeader));
+
+    template<typename T>
+    const T* Read(size_t count)
+    {
+      const size_t bytes = count * sizeof(T);
+      if(offset > size || bytes > size - offset)
+        return nullptr;
+      const T* result = reinterpret_cast<const T*>(data + offset);
+      offset = align_section(offset + bytes);
+      return result;
+    }
+  };
+
+  struct SectionWriter
+  {
+    std::ofstream& out;
+    size_t offset = 0;
+
+    void Write(const void* data, size_t bytes)
+    {
+      static const char zeros[SECTION_ALIGNMENT] = {};
+      out.write(static_cast<const char*>(data), std::streamsize(bytes));
+      offset += bytes;
+      const size_t padding = align_section(offset) - offset;
+      out.write(zeros, std::streamsize(padding));
+      offset += padding;
+    }
+  };
+}
+
+bool SceneManager::LoadSceneSnapshot(const std::string &snapshotPath, bool transpose)
+{
+  auto pFile = std::make_shared<MappedFile>(snapshotPath);
+  const MappedFile& file = *pFile;
+  if(!file.Valid() || file.Size() < sizeof(SnapshotHeader))
+    return false;
+
+  SnapshotHeader header;
+  std::memcpy(&header, file.Data(), sizeof(header));
+  if(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION
+    || header.transpose != uint32_t(transpose) || header.singleVertexSize != m_pMeshData->SingleVertexSize())
+    return false;
+
+  SectionReader reader{file.Data(), file.Size()};
+  const auto* sources   = reader.Read<SourceFile>(header.sourcesNum);
+  const auto* paths     = reader.Read<char>(header.pathsSize);
+  const auto* meshInfos = reader.Read<MeshInfo>(header.meshesNum);
+  const auto* meshBoxes = reader.Read<LiteMath::Box4f>(header.meshesNum);
+  const auto* instInfos = reader.Read<InstanceInfo>(header.instancesNum);
+  const auto* matrices  = reader.Read<LiteMath::float4x4>(header.instancesNum);
+  const auto* instBoxes = reader.Read<LiteMath::Box4f>(header.instancesNum);
+  const auto* cameras   = reader.Read<hydra_xml::Camera>(header.camerasNum);
+  const auto* vertices  = reader.Read<char>(header.vertexDataSize);
+  const auto* indices   = reader.Read<char>(header.indexDataSize);
+  if(indices == nullptr || header.sourcesNum == 0)
+    return false;
+
+  // stale if the XML or any of the meshes changed since the snapshot was written
+  for(uint32_t i = 0; i < header.sourcesNum; ++i)
+  {
+    if(uint64_t(sources[i].pathOffset) + sources[i].pathLength > header.pathsSize)
+      return false;
+    SourceFile current;
+    if(!stat_source(std::string(paths + sources[i].pathOffset, sources[i].pathLength), current)
+      || current.size != sources[i].size || current.mtime != sources[i].mtime)
+      return false;
+  }
+
+  m_meshInfos.assign(meshInfos, meshInfos + header.meshesNum);
+  m_meshBboxes.assign(meshBoxes, meshBoxes + header.meshesNum);
+  m_instanceInfos.assign(instInfos, instInfos + header.instancesNum);
+  m_instanceMatrices.assign(matrices, matrices + header.instancesNum);
+  m_instanceBboxes.assign(instBoxes, instBoxes + header.instancesNum);
+  m_sceneCameras.assign(cameras, cameras + header.camerasNum);
+  m_totalVertices = header.totalVertices;
+  m_totalIndices  = header.totalIndices;
+  sceneBbox       = header.sceneBbox;
+
+  // straight from the mapping, which is kept as the CPU copy of the geometry
+  m_snapshotFile = pFile;
+  LoadGeoDataOnGPU(vertices, header.vertexDataSize, indices, header.indexDataSize);
+
+  return true;
+}
+
+void SceneManager::SaveSceneSnapshot(const std::string &snapshotPath, bool transpose,
+  const std::vector<std::string> &sourcePaths) const
+{
+  std::vector<SourceFile> sources(sourcePaths.size());
+  std::string paths;
+  for(size_t i = 0; i < sourcePaths.size(); ++i)
+  {
+    if(!stat_source(sourcePaths[i], sources[i]))
+      return;
+    sources[i].pathOffset = uint32_t(paths.size());
+    sources[i].pathLength = uint32_t(sourcePaths[i].size());
+    paths += sourcePaths[i];
+  }
+
+  SnapshotHeader header = {};
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version          = SNAPSHOT_VERSION;
+  header.transpose        = uint32_t(transpose);
+  header.sourcesNum       = uint32_t(sources.size());
+  header.pathsSize        = uint32_t(paths.size());
+  header.meshesNum        = uint32_t(m_meshInfos.size());
+  header.instancesNum     = uint32_t(m_instanceInfos.size());
+  header.camerasNum       = uint32_t(m_sceneCameras.size());
+  header.totalVertices    = m_totalVertices;
+  header.totalIndices     = m_totalIndices;
+  header.singleVertexSize = uint32_t(m_pMeshData->SingleVertexSize());
+  header.vertexDataSize   = m_pMeshData->VertexDataSize();
+  header.indexDataSize    = m_pMeshData->IndexDataSize();
+  header.sceneBbox        = sceneBbox;
+
+  // written next to the final file and renamed, so a crash never leaves a truncated snapshot behind
+  const std::string tmpPath = snapshotPath + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!out)
+    {
+      vk_utils::logWarning("[SceneManager::SaveSceneSnapshot] can't write " + tmpPath);
+      return;
+    }
+
+    SectionWriter writer{out};
+    writer.Write(&header, sizeof(header));
+    writer.Write(sources.data(), sources.size() * sizeof(sources[0]));
+    writer.Write(paths.data(), paths.size());
+    writer.Write(m_meshInfos.data(), m_meshInfos.size() * sizeof(m_meshInfos[0]));
+    writer.Write(m_meshBboxes.data(), m_meshBboxes.size() * sizeof(m_meshBboxes[0]));
+    writer.Write(m_instanceInfos.data(), m_instanceInfos.size() * sizeof(m_instanceInfos[0]));
+    writer.Write(m_instanceMatrices.data(), m_instanceMatrices.size() * sizeof(m_instanceMatrices[0]));
+    writer.Write(m_instanceBboxes.data(), m_instanceBboxes.size() * sizeof(m_instanceBboxes[0]));
+    writer.Write(m_sceneCameras.data(), m_sceneCameras.size() * sizeof(m_sceneCameras[0]));
+    writer.Write(m_pMeshData->VertexData(), header.vertexDataSize);
+    writer.Write(m_pMeshData->IndexData(), header.indexDataSize);
+
+    if(!out)
+    {
+      vk_utils::logWarning("[SceneManager::SaveSceneSnapshot] can't write " + tmpPath);
+      out.close();
+      std::filesystem::remove(tmpPath);
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, snapshotPath, ec);
+  if(ec)
+    std::filesystem::remove(tmpPath, ec);
+}
@@ -0,0 +1,167 @@
+#include "shadow_cascades.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+  constexpr float SCENE_FAR_STEP = 1.0f / 16.0f;
+
+  // xyz range of a_points in the NDC of a_projView, false if one of them is behind its projection center
+  bool ProjectedBounds(const LiteMath::float4x4& a_projView, const LiteMath::float3* a_points, uint32_t a_pointsNum,
+    LiteMath::float3& a_min, LiteMath::float3& a_max)
+  {
+    a_min = LiteMath::float3(std::numeric_limits<float>::max());
+    a_max = LiteMath::float3(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < a_pointsNum; ++i)
+    {
+      const LiteMath::float4 clip = a_projView * LiteMath::float4(a_points[i].x, a_points[i].y, a_points[i].z, 1.0f);
+      if (clip.w <= 0.0f)
+        return false;
+      const LiteMath::float3 ndc = LiteMath::float3(clip.x, clip.y, clip.z) / clip.w;
+      a_min = LiteMath::min(a_min, ndc);
+      a_max = LiteMath::max(a_max, ndc);
+    }
+    return true;
+  }
+
+  // half of the NDC xy extent of a sphere around a_center, false if it's behind the projection center
+  bool ProjectedSphere(const LiteMath::float4x4& a_projView, const LiteMath::float3& a_center, float a_radius,
+    LiteMath::float2& a_ndcCenter, LiteMath::float2& a_halfExtent)
+  {
+    const LiteMath::float4 clip = a_projView * LiteMath::float4(a_center.x, a_center.y, a_center.z, 1.0f);
+    if (clip.w <= 0.0f)
+      return false;
+    a_ndcCenter = LiteMath::float2(clip.x, clip.y) / clip.w;
+
+    // an orthographic projection scales the sphere the same wherever it is
+    if (a_projView(3, 0) == 0.0f && a_projView(3, 1) == 0.0f && a_projView(3, 2) == 0.0f)
+    {
+      const LiteMath::float3 rowX(a_projView(0, 0), a_projView(0, 1), a_projView(0, 2));
+      const LiteMath::float3 rowY(a_projView(1, 0), a_projView(1, 1), a_projView(1, 2));
+      a_halfExtent = LiteMath::float2(LiteMath::length(rowX), LiteMath::length(rowY)) * a_radius / clip.w;
+      return true;
+    }
+
+    // a perspective one is bounded through the cube around the sphere
+    LiteMath::float3 cubeCorners[8];
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+      cubeCorners[i] = a_center + LiteMath::float3((i & 1) ? a_radius : -a_radius, (i & 2) ? a_radius : -a_radius,
+        (i & 4) ? a_radius : -a_radius);
+    }
+    LiteMath::float3 cubeMin, cubeMax;
+    if (!ProjectedBounds(a_projView, cubeCorners, 8, cubeMin, cubeMax))
+      return false;
+    a_halfExtent = LiteMath::float2(std::max(cubeMax.x - a_ndcCenter.x, a_ndcCenter.x - cubeMin.x),
+                                    std::max(cubeMax.y - a_ndcCenter.y, a_ndcCenter.y - cubeMin.y));
+    return true;
+  }
+
+  // a_lo and a_hi bound the shadowed range on one axis, the window is moved in whole texels
+  void FitAxis(float a_center, float a_half, float a_lo, float a_hi, uint32_t a_resolution, float& a_min, float& a_max)
+  {
+    if (a_lo >= a_hi)
+    {
+      a_lo = -1.0f;
+      a_hi = 1.0f;
+    }
+    const float half = std::min(a_half, 0.5f * (a_hi - a_lo));
+    const float center = std::clamp(a_center, a_lo + half, a_hi - half);
+    const float texel = 2.0f * half / float(a_resolution);
+    const float snapped = std::round(center / texel) * texel;
+    a_min = snapped - half;
+    a_max = snapped + half;
+  }
+}
+
+void FitShadowCascades(const LiteMath::float4x4& a_viewInverse, float a_fovy, float a_aspect, float a_near, float a_far,
+  const LiteMath::float4x4& a_lightProjView, const LiteMath::Box4f& a_sceneBox, uint32_t a_num, float a_lambda,
+  uint32_t a_resolution, LiteMath::float4x4* a_projViews, float* a_splits)
+{
+  const LiteMath::float3 camPos(a_viewInverse(0, 3), a_viewInverse(1, 3), a_viewInverse(2, 3));
+  const LiteMath::float3 camForward(-a_viewInverse(0, 2), -a_viewInverse(1, 2), -a_viewInverse(2, 2));
+
+  const bool hasScene = a_sceneBox.boxMin.x <= a_sceneBox.boxMax.x;
+  LiteMath::float3 sceneCorners[8];
+  LiteMath::float3 sceneMin(-1.0f, -1.0f, -1.0f);
+  LiteMath::float3 sceneMax(1.0f, 1.0f, 1.0f);
+  if (hasScene)
+  {
+    float sceneFar = 0.0f;
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+      sceneCorners[i] = LiteMath::float3((i & 1) ? a_sceneBox.boxMax.x : a_sceneBox.boxMin.x,
+                                         (i & 2) ? a_sceneBox.boxMax.y : a_sceneBox.boxMin.y,
+                                         (i & 4) ? a_sceneBox.boxMax.z : a_sceneBox.boxMin.z);
+      sceneFar = std::max(sceneFar, LiteMath::length(sceneCorners[i] - camPos));
+    }
+    // the distance, not the depth, of the farthest corner, rounded up to a step of the scene size, keeps the
+    // splits and so the cascade extents from changing while the camera turns or moves a little
+    const float farStep = std::max(SCENE_FAR_STEP * LiteMath::length(sceneCorners[7] - sceneCorners[0]), a_near);
+    a_far = std::clamp(std::ceil(sceneFar / farStep) * farStep, 2.0f * a_near, a_far);
+
+    // the light is inside the scene, the casters behind it can't shadow anything, the whole depth range is used
+    if (!ProjectedBounds(a_lightProjView, sceneCorners, 8, sceneMin, sceneMax))
+    {
+      sceneMin = LiteMath::float3(-1.0f, -1.0f, -1.0f);
+      sceneMax = LiteMath::float3(1.0f, 1.0f, 1.0f);
+    }
+  }
+
+  // a margin keeps the casters on the box faces from being clipped
+  const float zMargin = std::max(0.01f * (sceneMax.z - sceneMin.z), 1e-5f);
+  const float minZ = sceneMin.z - zMargin;
+  const float maxZ = sceneMax.z + zMargin;
+
+  const float tanY = std::tan(a_fovy * LiteMath::DEG_TO_RAD * 0.5f);
+  const float tanX = tanY * a_aspect;
+  // squared distance of the slice corners from the view axis, per unit of depth
+  const float cornerSlope2 = tanX * tanX + tanY * tanY;
+
+  float sliceNear = a_near;
+  for (uint32_t cascade = 0; cascade < a_num; ++cascade)
+  {
+    const float t = float(cascade + 1) / float(a_num);
+    const float logSplit = a_near * std::pow(a_far / a_near, t);
+    const float uniformSplit = a_near + (a_far - a_near) * t;
+    const float sliceFar = cascade + 1 == a_num ? a_far : a_lambda * logSplit + (1.0f - a_lambda) * uniformSplit;
+
+    // the smallest sphere through all the slice corners is centered on the view axis and depends only on the
+    // split distances and the field of view, not on where the camera looks
+    // (a wide slice has it at the far plane)
+    const float centerDist = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + cornerSlope2), sliceFar);
+    const float radius = std::sqrt(std::max(
+      (centerDist - sliceNear) * (centerDist - sliceNear) + sliceNear * sliceNear * cornerSlope2,
+      (sliceFar - centerDist) * (sliceFar - centerDist) + sliceFar * sliceFar * cornerSlope2));
+    const LiteMath::float3 sphereCenter = camPos + camForward * centerDist;
+
+    LiteMath::float2 ndcCenter(0.0f, 0.0f);
+    LiteMath::float2 halfExtent(1.0f, 1.0f);
+    if (!ProjectedSphere(a_lightProjView, sphereCenter, radius, ndcCenter, halfExtent))
+    {
+      ndcCenter = LiteMath::float2(0.0f, 0.0f);
+      halfExtent = LiteMath::float2(1.0f, 1.0f);
+    }
+
+    // nothing outside of the light frustum and the scene is ever shadowed
+    float minX, maxX, minY, maxY;
+    FitAxis(ndcCenter.x, halfExtent.x, std::max(sceneMin.x, -1.0f), std::min(sceneMax.x, 1.0f), a_resolution,
+      minX, maxX);
+    FitAxis(ndcCenter.y, halfExtent.y, std::max(sceneMin.y, -1.0f), std::min(sceneMax.y, 1.0f), a_resolution,
+      minY, maxY);
+
+    LiteMath::float4x4 crop;
+    crop(0, 0) = 2.0f / (maxX - minX);
+    crop(0, 3) = -(maxX + minX) / (maxX - minX);
+    crop(1, 1) = 2.0f / (maxY - minY);
+    crop(1, 3) = -(maxY + minY) / (maxY - minY);
+    crop(2, 2) = 1.0f / (maxZ - minZ);
+    crop(2, 3) = -minZ / (maxZ - minZ);
+
+    a_projViews[cascade] = crop * a_lightProjView;
+    a_splits[cascade] = sliceFar;
+    sliceNear = sliceFar;
+  }
+}
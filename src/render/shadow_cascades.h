@@ -0,0 +1,21 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <cstdint>
+
+#include "LiteMath.h"
+
+// Cascaded shadow maps for a light with any projection, perspective or orthographic.
+// The camera frustum between a_near and a_far is split into a_num slices, a_lambda blends logarithmic (1)
+// and uniform (0) split distances. a_far is first pulled in to about the distance of the farthest corner of
+// a_sceneBox, so no cascade covers the empty space behind the scene. Every cascade gets a_lightProjView with a crop applied in
+// light clip space: z is fitted to the scene box and mapped to [0, 1], so all the casters of the scene are in the
+// depth range. xy cover the bounding sphere of the slice, which keeps its size while the camera turns, limited to
+// the scene box. The crop offset is snapped to whole texels of an a_resolution map, so the shadow edges don't
+// shimmer while the camera moves; with an orthographic light both stay exactly the same for a static scene.
+// a_projViews receives a_num matrices, a_splits the view space distance where each cascade ends.
+void FitShadowCascades(const LiteMath::float4x4& a_viewInverse, float a_fovy, float a_aspect, float a_near, float a_far,
+  const LiteMath::float4x4& a_lightProjView, const LiteMath::Box4f& a_sceneBox, uint32_t a_num, float a_lambda,
+  uint32_t a_resolution, LiteMath::float4x4* a_projViews, float* a_splits);
+
+#endif // SHADOW_CASCADES_H
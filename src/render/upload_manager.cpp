@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "upload_manager.h"
+#include <vk_buffers.h>
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include <vulkan/vulkan_format_traits.hpp>
+
+
+UploadManager::UploadManager(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId,
+  uint32_t a_graphicsQId, VkDeviceSize a_stagingSize, uint32_t a_batchesNum)
+  : m_device(a_device), m_transferQId(a_transferQId), m_graphicsQId(a_graphicsQId)
+{
+  assert(a_batchesNum > 0);
+  vkGetDeviceQueue(m_device, m_transferQId, 0, &m_transferQ);
+
+  VkMemoryRequirements memReq;
+  m_stagingBuf = vk_utils::createBuffer(m_device, a_stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &memReq);
+
+  VkMemoryAllocateInfo allocateInfo = {};
+  allocateInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocateInfo.allocationSize  = memReq.size;
+  allocateInfo.memoryTypeIndex = vk_utils::findMemoryType(memReq.memoryTypeBits,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, a_physDevice);
+  VK_CHECK_RESULT(vkAllocateMemory(m_device, &allocateInfo, nullptr, &m_stagingMem));
+  VK_CHECK_RESULT(vkBindBufferMemory(m_device, m_stagingBuf, m_stagingMem, 0));
+  VK_CHECK_RESULT(vkMapMemory(m_device, m_stagingMem, 0, a_stagingSize, 0, reinterpret_cast<void**>(&m_stagingMapped)));
+
+  // segments stay aligned for any texel size and optimalBufferCopyOffsetAlignment in practice
+  m_segmentSize = a_stagingSize / a_batchesNum / 256 * 256;
+
+  m_commandPool = vk_utils::createCommandPool(m_device, m_transferQId, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  auto cmdBuffers = vk_utils::createCommandBuffers(m_device, m_commandPool, a_batchesNum);
+
+  m_batches.resize(a_batchesNum);
+  for(uint32_t i = 0; i < a_batchesNum; ++i)
+  {
+    m_batches[i].cmd = cmdBuffers[i];
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VK_CHECK_RESULT(vkCreateFence(m_device, &fenceInfo, nullptr, &m_batches[i].fence));
+  }
+}
+
+UploadManager::~UploadManager()
+{
+  WaitIdle();
+
+  for(auto& batch : m_batches)
+    vkDestroyFence(m_device, batch.fence, nullptr);
+  vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+
+  vkUnmapMemory(m_device, m_stagingMem);
+  vkDestroyBuffer(m_device, m_stagingBuf, nullptr);
+  vkFreeMemory(m_device, m_stagingMem, nullptr);
+}
+
+void UploadManager::WaitBatch(Batch& a_batch)
+{
+  if(!a_batch.submitted)
+    return;
+
+  if(vkGetFenceStatus(m_device, a_batch.fence) == VK_NOT_READY)
+    m_stats.stalls++;
+  VK_CHECK_RESULT(vkWaitForFences(m_device, 1, &a_batch.fence, VK_TRUE, UINT64_MAX));
+  VK_CHECK_RESULT(vkResetFences(m_device, 1, &a_batch.fence));
+  a_batch.submitted = false;
+  a_batch.used      = 0;
+}
+
+UploadManager::Batch& UploadManager::CurrentBatch()
+{
+  Batch& batch = m_batches[m_currentBatch];
+  if(batch.recording)
+    return batch;
+
+  WaitBatch(batch);
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK_RESULT(vkResetCommandBuffer(batch.cmd, 0));
+  VK_CHECK_RESULT(vkBeginCommandBuffer(batch.cmd, &beginInfo));
+
+  // destinations may still be read by previously submitted frames
+  VkMemoryBarrier barrier = {};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+    1, &barrier, 0, nullptr, 0, nullptr);
+
+  batch.recording = true;
+  return batch;
+}
+
+VkDeviceSize UploadManager::Allocate(VkDeviceSize a_size, VkDeviceSize a_alignment)
+{
+  assert(a_size <= m_segmentSize);
+
+  Batch* batch = &CurrentBatch();
+  VkDeviceSize offset = (batch->used + a_alignment - 1) / a_alignment * a_alignment;
+  if(offset + a_size > m_segmentSize)
+  {
+    Flush();
+    batch  = &CurrentBatch();
+    offset = 0;
+  }
+
+  batch->used = offset + a_size;
+  return VkDeviceSize(m_currentBatch) * m_segmentSize + offset;
+}
+
+void UploadManager::UploadBuffer(VkBuffer a_dst, VkDeviceSize a_dstOffset, const void* a_src, VkDeviceSize a_size)
+{
+  const char* src = static_cast<const char*>(a_src);
+  for(VkDeviceSize done = 0; done < a_size; )
+  {
+    const VkDeviceSize chunk = std::min(a_size - done, m_segmentSize);
+    const VkDeviceSize stagingOffset = Allocate(chunk, 16);
+    memcpy(m_stagingMapped + stagingOffset, src + done, chunk);
+
+    VkBufferCopy region = {};
+    region.srcOffset = stagingOffset;
+    region.dstOffset = a_dstOffset + done;
+    region.size      = chunk;
+    vkCmdCopyBuffer(CurrentBatch().cmd, m_stagingBuf, a_dst, 1, &region);
+
+    if(m_transferQId != m_graphicsQId)
+    {
+      VkBufferMemoryBarrier release = {};
+      release.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      release.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+      release.srcQueueFamilyIndex = m_transferQId;
+      release.dstQueueFamilyIndex = m_graphicsQId;
+      release.buffer              = a_dst;
+      release.offset              = region.dstOffset;
+      release.size                = chunk;
+      CurrentBatch().releases.push_back(release);
+    }
+
+    done += chunk;
+  }
+  m_stats.bytesUploaded += a_size;
+}
+
+etna::Image UploadManager::CreateImageFromBytes(etna::Image::CreateInfo a_info, const void* a_src)
+{
+  if(m_transferQId != m_graphicsQId)
+    RUN_TIME_ERROR("[UploadManager::CreateImageFromBytes] image uploads need a graphics family queue");
+  assert(a_info.extent.depth == 1);
+
+  a_info.imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
+  etna::Image image = etna::get_context().createImage(a_info);
+
+  const VkDeviceSize rowSize   = VkDeviceSize(vk::blockSize(a_info.format)) * a_info.extent.width;
+  const VkDeviceSize layerSize = rowSize * a_info.extent.height;
+  if(rowSize > m_segmentSize)
+    RUN_TIME_ERROR("[UploadManager::CreateImageFromBytes] image row doesn't fit into a staging segment");
+  const uint32_t rowsPerChunk = static_cast<uint32_t>(m_segmentSize / rowSize);
+  const vk::ImageSubresourceRange allLayers(vk::ImageAspectFlagBits::eColor, 0, 1, 0, a_info.layers);
+
+  etna::set_state(CurrentBatch().cmd, image.get(), vk::PipelineStageFlagBits2::eTransfer,
+    vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal, allLayers);
+  etna::flush_barriers(CurrentBatch().cmd);
+
+  // large images are split by rows over several batches, the layout is kept between them
+  const char* src = static_cast<const char*>(a_src);
+  for(uint32_t layer = 0; layer < a_info.layers; ++layer)
+  {
+    for(uint32_t row = 0; row < a_info.extent.height; row += rowsPerChunk)
+    {
+      const uint32_t rows = std::min(rowsPerChunk, a_info.extent.height - row);
+      const VkDeviceSize chunk = rowSize * rows;
+      const VkDeviceSize stagingOffset = Allocate(chunk, 16);
+      memcpy(m_stagingMapped + stagingOffset, src + layer * layerSize + row * rowSize, chunk);
+
+      VkBufferImageCopy region = {};
+      region.bufferOffset                    = stagingOffset;
+      region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.baseArrayLayer = layer;
+      region.imageSubresource.layerCount     = 1;
+      region.imageOffset                     = {0, static_cast<int32_t>(row), 0};
+      region.imageExtent                     = {a_info.extent.width, rows, 1};
+      vkCmdCopyBufferToImage(CurrentBatch().cmd, m_stagingBuf, image.get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+  }
+
+  etna::set_state(CurrentBatch().cmd, image.get(), vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal, allLayers);
+  etna::flush_barriers(CurrentBatch().cmd);
+
+  m_stats.bytesUploaded += layerSize * a_info.layers;
+  return image;
+}
+
+void UploadManager::Flush()
+{
+  Batch& batch = m_batches[m_currentBatch];
+  if(!batch.recording)
+    return;
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+    1, &barrier, 0, nullptr, uint32_t(batch.releases.size()), batch.releases.data());
+  VK_CHECK_RESULT(vkEndCommandBuffer(batch.cmd));
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers    = &batch.cmd;
+  VK_CHECK_RESULT(vkQueueSubmit(m_transferQ, 1, &submitInfo, batch.fence));
+
+  // the graphics side repeats the release barriers with its own access mask to acquire
+  for(auto acquire : batch.releases)
+  {
+    acquire.srcAccessMask = 0;
+    acquire.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    m_pendingAcquires.push_back(acquire);
+  }
+  batch.releases.clear();
+
+  batch.recording = false;
+  batch.submitted = true;
+  m_stats.submits++;
+  m_currentBatch = (m_currentBatch + 1) % uint32_t(m_batches.size());
+}
+
+void UploadManager::WaitIdle()
+{
+  Flush();
+  for(auto& batch : m_batches)
+    WaitBatch(batch);
+}
+
+void UploadManager::RecordAcquireBarriers(VkCommandBuffer a_cmd)
+{
+  if(m_pendingAcquires.empty())
+    return;
+
+  // there is no semaphore between the two queues, releases have to be complete before acquiring
+  WaitIdle();
+  vkCmdPipelineBarrier(a_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+    0, nullptr, uint32_t(m_pendingAcquires.size()), m_pendingAcquires.data(), 0, nullptr);
+  m_pendingAcquires.clear();
+}
@@ -0,0 +1,88 @@
+#ifndef CHIMERA_UPLOAD_MANAGER_H
+#define CHIMERA_UPLOAD_MANAGER_H
+
+#include <vector>
+
+#include <vk_utils.h>
+#include <etna/Image.hpp>
+
+// Host to device copies shared by all loaders.
+// Source data is copied into a persistently mapped staging ring right away, so it can be freed after the call,
+// and the transfers are recorded into batches that are submitted without waiting for the GPU: loading on the CPU
+// goes on while the previous batch is copied. The ring has one segment per batch, a segment is reused only after
+// the fence of its previous submission has signaled.
+//
+// Every batch starts and ends with a global barrier, so the copies are ordered against all other work submitted
+// to the same queue before and after them. If the transfer queue belongs to another family, uploaded buffers are
+// released to the graphics family and RecordAcquireBarriers must be called on the graphics queue before they are used.
+class UploadManager
+{
+public:
+  UploadManager(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId, uint32_t a_graphicsQId,
+    VkDeviceSize a_stagingSize = 64 * 1024 * 1024, uint32_t a_batchesNum = 4);
+  ~UploadManager();
+
+  UploadManager(const UploadManager&) = delete;
+  UploadManager& operator=(const UploadManager&) = delete;
+
+  void UploadBuffer(VkBuffer a_dst, VkDeviceSize a_dstOffset, const void* a_src, VkDeviceSize a_size);
+
+  // Replacement for etna::create_image_from_bytes: a_src holds mip 0 of all layers tightly packed,
+  // the image ends up in eShaderReadOnlyOptimal. Image layouts can only be changed on the graphics family,
+  // so this requires the transfer and graphics queues to be of the same family.
+  etna::Image CreateImageFromBytes(etna::Image::CreateInfo a_info, const void* a_src);
+
+  // Submits the recorded copies without waiting for them
+  void Flush();
+  // Submits the recorded copies and waits for all of them
+  void WaitIdle();
+
+  // Only records anything when the queue families differ
+  void RecordAcquireBarriers(VkCommandBuffer a_cmd);
+  // Command buffers recorded while this is set must not be replayed, the barriers are recorded only once
+  bool HasPendingAcquires() const { return !m_pendingAcquires.empty(); }
+
+  struct Stats
+  {
+    VkDeviceSize bytesUploaded = 0;
+    uint32_t submits = 0;
+    // times a batch had to wait for the GPU before its staging segment could be reused
+    uint32_t stalls  = 0;
+  };
+  const Stats& GetStats() const { return m_stats; }
+
+private:
+  struct Batch
+  {
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkDeviceSize used = 0;
+    bool recording = false;
+    bool submitted = false;
+    std::vector<VkBufferMemoryBarrier> releases;
+  };
+
+  // Space in the current batch segment, flushes the batch if it doesn't fit
+  VkDeviceSize Allocate(VkDeviceSize a_size, VkDeviceSize a_alignment);
+  Batch& CurrentBatch();
+  void WaitBatch(Batch& a_batch);
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  uint32_t m_transferQId = UINT32_MAX;
+  uint32_t m_graphicsQId = UINT32_MAX;
+  VkQueue m_transferQ = VK_NULL_HANDLE;
+
+  VkBuffer m_stagingBuf = VK_NULL_HANDLE;
+  VkDeviceMemory m_stagingMem = VK_NULL_HANDLE;
+  char* m_stagingMapped = nullptr;
+  VkDeviceSize m_segmentSize = 0;
+
+  VkCommandPool m_commandPool = VK_NULL_HANDLE;
+  std::vector<Batch> m_batches;
+  uint32_t m_currentBatch = 0;
+
+  std::vector<VkBufferMemoryBarrier> m_pendingAcquires;
+  Stats m_stats;
+};
+
+#endif//CHIMERA_UPLOAD_MANAGER_H
@@ -0,0 +1,105 @@
+#include "shadowmap_render.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+
+
+vk::Format SimpleShadowmapRender::GetColorTargetFormat() const
+{
+  switch (m_colorPrecision)
+  {
+    case ColorPrecision::R11G11B10: return vk::Format::eB10G11R11UfloatPack32;
+    case ColorPrecision::RGBA16F:   return vk::Format::eR16G16B16A16Sfloat;
+    default:                        return vk::Format::eR32G32B32A32Sfloat;
+  }
+}
+
+void SimpleShadowmapRender::SetColorPrecision(ColorPrecision a_precision)
+{
+  if (a_precision == m_colorPrecision)
+    return;
+
+  // pipelines are recreated for the new attachment format, the target itself belongs to the frame graph
+  ETNA_ASSERT(m_context->getDevice().waitIdle() == vk::Result::eSuccess);
+  m_colorPrecision = a_precision;
+  PreparePipelines();
+}
+
+void SimpleShadowmapRender::StartColorCheck()
+{
+  m_colorCheck.tested = m_colorPrecision;
+  m_colorCheck.stage  = ColorCheckStage::REFERENCE;
+  // any change between the two frames would be counted as an error of the tested format
+  m_colorCheck.time   = m_uniforms.time;
+  // recreated each time since the resolution may have changed, the previous check has already been waited for
+  m_colorCheck.readback = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = VkDeviceSize(m_width) * m_height * 4, // 8 bit swapchain formats
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+    .name = "color_check_readback"
+  });
+}
+
+void SimpleShadowmapRender::PrepareColorCheckFrame()
+{
+  if (m_colorCheck.stage == ColorCheckStage::REFERENCE)
+    SetColorPrecision(ColorPrecision::RGBA32F);
+  else if (m_colorCheck.stage == ColorCheckStage::TESTED)
+    SetColorPrecision(m_colorCheck.tested);
+}
+
+void SimpleShadowmapRender::RecordColorCapture(VkCommandBuffer a_cmdBuff, VkImage a_targetImage)
+{
+  etna::set_state(a_cmdBuff, a_targetImage, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead,
+    vk::ImageLayout::eTransferSrcOptimal, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+  etna::flush_barriers(a_cmdBuff);
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent                 = {m_width, m_height, 1};
+  vkCmdCopyImageToBuffer(a_cmdBuff, a_targetImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    m_colorCheck.readback.get(), 1, &region);
+}
+
+void SimpleShadowmapRender::FinishColorCheckFrame()
+{
+  ETNA_ASSERT(m_context->getDevice().waitIdle() == vk::Result::eSuccess);
+
+  // the frame as it is displayed, channel order doesn't matter as both frames have the swapchain format
+  const size_t bytesNum = size_t(m_width) * m_height * 4;
+  const uint8_t* mapped = reinterpret_cast<const uint8_t*>(m_colorCheck.readback.map());
+  std::vector<uint8_t> frame(mapped, mapped + bytesNum);
+  m_colorCheck.readback.unmap();
+
+  InvalidateCommandBuffers();
+
+  if (m_colorCheck.stage == ColorCheckStage::REFERENCE)
+  {
+    m_colorCheck.reference = std::move(frame);
+    m_colorCheck.stage = ColorCheckStage::TESTED;
+    return;
+  }
+
+  uint64_t diffSum = 0;
+  int maxDiff = 0;
+  for (size_t pixel = 0; pixel < bytesNum; pixel += 4)
+  {
+    int pixelDiff = 0;
+    for (size_t channel = 0; channel < 3; ++channel)
+      pixelDiff = std::max(pixelDiff, std::abs(int(frame[pixel + channel]) - int(m_colorCheck.reference[pixel + channel])));
+    maxDiff = std::max(maxDiff, pixelDiff);
+    diffSum += pixelDiff;
+  }
+
+  m_colorCheck.maxDiff         = float(maxDiff) / 255.0f;
+  m_colorCheck.meanDiff        = float(double(diffSum) / double(bytesNum / 4)) / 255.0f;
+  m_colorCheck.resultPrecision = m_colorCheck.tested;
+  m_colorCheck.hasResult       = true;
+  m_colorCheck.reference.clear();
+  m_colorCheck.stage = ColorCheckStage::IDLE;
+}
@@ -0,0 +1,285 @@
+#include "shadowmap_render.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+
+
+static uint32_t previous_pow2(uint32_t value)
+{
+  uint32_t result = 1;
+  while (result * 2 <= value)
+    result *= 2;
+  return result;
+}
+
+void SimpleShadowmapRender::AllocateDepthPyramid()
+{
+  // power of two levels keep every texel of a level covering exactly 2x2 texels of the previous one
+  m_depthPyramidExtent = vk::Extent2D{previous_pow2(m_width), previous_pow2(m_height)};
+
+  m_depthPyramidMips = 1;
+  while ((std::max(m_depthPyramidExtent.width, m_depthPyramidExtent.height) >> m_depthPyramidMips) > 0)
+    ++m_depthPyramidMips;
+
+  m_depthPyramid = m_context->createImage(etna::Image::CreateInfo
+  {
+    .extent = vk::Extent3D{m_depthPyramidExtent.width, m_depthPyramidExtent.height, 1},
+    .name = "depth_pyramid",
+    .format = vk::Format::eR32Sfloat,
+    .imageUsage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+    .mipLevels = m_depthPyramidMips
+  });
+  m_depthPyramidValid = false;
+}
+
+void SimpleShadowmapRender::AllocateCullingResources()
+{
+  m_frustumCuller.SetBoxes(m_pScnMgr->GetInstanceBboxes());
+
+  // lists are sized by the capacity, so instances added at runtime don't need new buffers
+  const VkDeviceSize listSize = std::max(1u, m_pScnMgr->InstanceCapacity()) * sizeof(VkDrawIndexedIndirectCommand);
+  m_culledDrawCommands = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = listSize * CULLING_LISTS_NUM * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+    .name = "culled_draw_commands"
+  });
+  m_culledDrawCommandsMapped = reinterpret_cast<VkDrawIndexedIndirectCommand*>(m_culledDrawCommands.map());
+
+  m_culledDrawCounts = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = sizeof(uint32_t) * CULLING_LISTS_NUM * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+    .name = "culled_draw_counts"
+  });
+  m_culledDrawCountsMapped = reinterpret_cast<uint32_t*>(m_culledDrawCounts.map());
+  memset(m_culledDrawCountsMapped, 0, sizeof(uint32_t) * CULLING_LISTS_NUM * m_framesInFlight);
+
+  m_gpuCulledDrawCommands = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = listSize * CULLING_LISTS_NUM * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "gpu_culled_draw_commands"
+  });
+
+  m_gpuDrawCounts = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = sizeof(GpuDrawCounts) * CULLING_LISTS_NUM * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer
+                 | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "gpu_draw_counts"
+  });
+
+  m_gpuDrawCountsReadback = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = sizeof(GpuDrawCounts) * CULLING_LISTS_NUM * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+    .name = "gpu_draw_counts_readback"
+  });
+  m_gpuDrawCountsMapped = reinterpret_cast<GpuDrawCounts*>(m_gpuDrawCountsReadback.map());
+  memset(m_gpuDrawCountsMapped, 0, sizeof(GpuDrawCounts) * CULLING_LISTS_NUM * m_framesInFlight);
+
+  AllocateShadowDrawLists();
+
+  // all the buffers above are referenced by the recorded command buffers
+  InvalidateCommandBuffers();
+}
+
+void SimpleShadowmapRender::UpdateSceneInstances()
+{
+  const bool reallocated = m_pScnMgr->UpdateInstancesOnGPU(m_updatedInstances);
+  if (reallocated || !m_updatedInstances.empty())
+    m_sceneBvh.Refit(*m_pScnMgr);
+
+  if (reallocated)
+  {
+    // the device is idle after the instance buffers grew, so the lists can be recreated right away
+    AllocateCullingResources();
+    // the instances uploaded with the new buffers are not reported as updated
+    InvalidateShadowCache();
+    return;
+  }
+
+  if (m_frustumCuller.BoxesNum() != m_pScnMgr->InstancesNum())
+  {
+    m_frustumCuller.SetBoxes(m_pScnMgr->GetInstanceBboxes());
+    return;
+  }
+
+  for (uint32_t instId : m_updatedInstances)
+    m_frustumCuller.SetBox(instId, m_pScnMgr->GetInstanceBbox(instId));
+}
+
+uint32_t SimpleShadowmapRender::CullInstances(const float4x4& a_projView, uint32_t a_listNo)
+{
+  m_frustumCuller.Cull(a_projView, m_visibleInstances);
+
+  const auto& drawCommands = m_pScnMgr->GetDrawCommands();
+  const uint32_t listIdx = m_presentationResources.currentFrame * CULLING_LISTS_NUM + a_listNo;
+  const uint32_t firstCommand = listIdx * m_pScnMgr->InstanceCapacity();
+
+  uint32_t count = 0;
+  for (uint32_t instId : m_visibleInstances)
+  {
+    // instances that are not marked for render have no instances to draw
+    if (drawCommands[instId].instanceCount != 0)
+      m_culledDrawCommandsMapped[firstCommand + count++] = drawCommands[instId];
+  }
+  // the count goes through memory as well, so the draws don't depend on the moment they were recorded
+  m_culledDrawCountsMapped[listIdx] = count;
+  return count;
+}
+
+SimpleShadowmapRender::CulledDraws SimpleShadowmapRender::GetCulledDraws(uint32_t a_listNo) const
+{
+  const uint32_t listIdx = m_presentationResources.currentFrame * CULLING_LISTS_NUM + a_listNo;
+  const uint32_t firstCommand = listIdx * m_pScnMgr->InstanceCapacity();
+
+  if (m_cullingMode == CullingMode::CPU)
+  {
+    return CulledDraws
+    {
+      .buffer      = m_culledDrawCommands.get(),
+      .offset      = VkDeviceSize(firstCommand) * sizeof(VkDrawIndexedIndirectCommand),
+      .count       = m_pScnMgr->InstanceCapacity(),
+      .countBuffer = m_culledDrawCounts.get(),
+      .countOffset = VkDeviceSize(listIdx) * sizeof(uint32_t)
+    };
+  }
+
+  return CulledDraws
+  {
+    .buffer      = m_gpuCulledDrawCommands.get(),
+    .offset      = VkDeviceSize(firstCommand) * sizeof(VkDrawIndexedIndirectCommand),
+    .count       = m_pScnMgr->InstanceCapacity(),
+    .countBuffer = m_gpuDrawCounts.get(),
+    .countOffset = VkDeviceSize(listIdx) * sizeof(GpuDrawCounts)
+  };
+}
+
+void SimpleShadowmapRender::CullScene()
+{
+  if (m_cullingMode == CullingMode::CPU)
+  {
+    m_cpuVisibleCounts[0] = CullInstances(m_worldViewProj, 0);
+    // lists of the cascades that are not rendered aren't used
+    for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+      m_cpuVisibleCounts[1 + cascade] = CullInstances(m_uniforms.shadowCascadeMatrices[cascade], 1 + cascade);
+    return;
+  }
+
+  // the frame fence has been waited, so the counts of the previous use of this frame slot are ready
+  const uint32_t firstList = m_presentationResources.currentFrame * CULLING_LISTS_NUM;
+  for (uint32_t listNo = 0; listNo < CULLING_LISTS_NUM; ++listNo)
+    m_gpuCullingStats[listNo] = m_gpuDrawCountsMapped[firstList + listNo];
+
+  m_cullingParams = m_pFrameAllocator->Allocate(CULLING_LISTS_NUM * sizeof(CullingParams));
+  auto* cullingParams = reinterpret_cast<CullingParams*>(m_cullingParams.data);
+  for (uint32_t listNo = 0; listNo < CULLING_LISTS_NUM; ++listNo)
+  {
+    const uint32_t firstCommand = (firstList + listNo) * m_pScnMgr->InstanceCapacity();
+
+    CullingParams& params = cullingParams[listNo];
+    params.projView          = listNo == 0 ? m_worldViewProj : m_uniforms.shadowCascadeMatrices[listNo - 1];
+    params.occlusionProjView = m_depthPyramidProjView;
+    params.instancesNum      = m_pScnMgr->InstancesNum();
+    params.firstCommand      = firstCommand;
+    params.countIdx          = firstList + listNo;
+    // the pyramid is built from the main view only
+    params.occlusionEnabled  = listNo == 0 && m_occlusionCulling && m_depthPyramidValid;
+  }
+}
+
+void SimpleShadowmapRender::CullSceneGpuCmd(VkCommandBuffer a_cmdBuff)
+{
+  const uint32_t firstList = m_presentationResources.currentFrame * CULLING_LISTS_NUM;
+  const VkDeviceSize countsOffset = VkDeviceSize(firstList) * sizeof(GpuDrawCounts);
+  const VkDeviceSize countsSize   = CULLING_LISTS_NUM * sizeof(GpuDrawCounts);
+
+  vkCmdFillBuffer(a_cmdBuff, m_gpuDrawCounts.get(), countsOffset, countsSize, 0);
+
+  VkMemoryBarrier clearBarrier = {};
+  clearBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(a_cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+    1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+  auto cullInstancesInfo = etna::get_shader_program("cull_instances");
+  VkDescriptorSet vkSet = CreateDescriptorSet(cullInstancesInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  {
+    etna::Binding {0, m_pScnMgr->GetInstanceBboxesBuffer().genBinding()},
+    etna::Binding {1, m_pScnMgr->GetDrawCommandsBuffer().genBinding()},
+    etna::Binding {2, m_gpuCulledDrawCommands.genBinding()},
+    etna::Binding {3, m_gpuDrawCounts.genBinding()},
+    etna::Binding {4, m_pFrameAllocator->genBinding(m_cullingParams)},
+    etna::Binding {5, m_depthPyramid.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal,
+      {0, m_depthPyramidMips, 1, vk::ImageViewType::e2D})}
+  });
+  etna::flush_barriers(a_cmdBuff);
+
+  vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullInstancesPipeline.getVkPipeline());
+  vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE,
+    m_cullInstancesPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+  for (uint32_t listNo = 0; listNo < 1 + m_shadowCascadesNum; ++listNo)
+  {
+    // relative to the parameter sets of this frame bound at binding 4
+    uint32_t paramsIdx = listNo;
+    vkCmdPushConstants(a_cmdBuff, m_cullInstancesPipeline.getVkPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT,
+      0, sizeof(paramsIdx), &paramsIdx);
+    // threads past params.instancesNum exit right away, the capacity only changes together with the buffers
+    vkCmdDispatch(a_cmdBuff, (m_pScnMgr->InstanceCapacity() + 63) / 64, 1, 1);
+  }
+
+  VkMemoryBarrier cullBarrier = {};
+  cullBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(a_cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy statsCopy = {countsOffset, countsOffset, countsSize};
+  vkCmdCopyBuffer(a_cmdBuff, m_gpuDrawCounts.get(), m_gpuDrawCountsReadback.get(), 1, &statsCopy);
+}
+
+void SimpleShadowmapRender::BuildDepthPyramidCmd(VkCommandBuffer a_cmdBuff)
+{
+  auto depthPyramidInfo = etna::get_shader_program("depth_pyramid");
+  vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_depthPyramidPipeline.getVkPipeline());
+
+  for (uint32_t mip = 0; mip < m_depthPyramidMips; ++mip)
+  {
+    VkDescriptorSet vkSet = CreateDescriptorSet(depthPyramidInfo.getDescriptorLayoutId(0), a_cmdBuff,
+    {
+      etna::Binding {0, mip == 0
+        ? GetImage(gBuffer.mainViewDepth).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)
+        : m_depthPyramid.genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral, {mip - 1, 1, 1, vk::ImageViewType::e2D})},
+      etna::Binding {1, m_depthPyramid.genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral, {mip, 1, 1, vk::ImageViewType::e2D})}
+    });
+    etna::flush_barriers(a_cmdBuff);
+
+    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE,
+      m_depthPyramidPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+    const uint32_t width  = std::max(m_depthPyramidExtent.width  >> mip, 1u);
+    const uint32_t height = std::max(m_depthPyramidExtent.height >> mip, 1u);
+    vkCmdDispatch(a_cmdBuff, (width + 15) / 16, (height + 15) / 16, 1);
+
+    // all levels stay in the same layout, so etna does not see the dependency between them
+    VkMemoryBarrier levelBarrier = {};
+    levelBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(a_cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+      1, &levelBarrier, 0, nullptr, 0, nullptr);
+  }
+}
@@ -1,24 +1,116 @@
 #include "shadowmap_render.h"
 #include <etna/Etna.hpp>
 
+#include <chrono>
+
 #include <imgui/imgui.h>
 
 #include "../../render/render_gui.h"
 
+void SimpleShadowmapRender::InvalidateCommandBuffers()
+{
+  ++m_commandsVersion;
+  m_framesSinceInvalidation = 0;
+}
+
+void SimpleShadowmapRender::UpdateRecordedState()
+{
+  RecordedState state;
+  state.cullingMode      = static_cast<int>(m_cullingMode);
+  state.occlusionCulling = m_occlusionCulling;
+  state.ssaoEnabled      = m_uniforms.ssaoEnabled;
+  state.drawFSQuad       = m_input.drawFSQuad;
+  state.cameraFov        = m_cam.fov;
+  state.shadowUpdate     = static_cast<int>(m_shadowUpdate);
+  state.shadowDrawMask   = m_shadowCache.drawMask;
+  state.shadowStaticDrawMask = m_shadowCache.staticDrawMask;
+  state.overlapSsaoWithShadows = m_overlapSsaoWithShadows;
+  selectTransparencyLods(state.transparencyLods);
+
+  if (state != m_recordedState)
+  {
+    m_recordedState = std::move(state);
+    InvalidateCommandBuffers();
+  }
+}
+
 void SimpleShadowmapRender::DrawFrameSimple(bool draw_gui)
 {
-  vkWaitForFences(m_context->getDevice(), 1, &m_frameFences[m_presentationResources.currentFrame], VK_TRUE, UINT64_MAX);
-  vkResetFences(m_context->getDevice(), 1, &m_frameFences[m_presentationResources.currentFrame]);
+  PrepareColorCheckFrame();
+
+  const uint32_t frame = m_presentationResources.currentFrame;
+  vkWaitForFences(m_context->getDevice(), 1, &m_frameFences[frame], VK_TRUE, UINT64_MAX);
 
   uint32_t imageIdx;
-  m_swapchain.AcquireNextImage(m_presentationResources.imageAvailable, &imageIdx);
+  m_swapchain.AcquireNextImage(m_presentationResources.imageAvailable[frame], &imageIdx);
+
+  // with more swapchain images than frames in flight the image may come from the other frame slot
+  if (m_imagesInFlight[imageIdx] != VK_NULL_HANDLE && m_imagesInFlight[imageIdx] != m_frameFences[frame])
+    vkWaitForFences(m_context->getDevice(), 1, &m_imagesInFlight[imageIdx], VK_TRUE, UINT64_MAX);
+  m_imagesInFlight[imageIdx] = m_frameFences[frame];
+  vkResetFences(m_context->getDevice(), 1, &m_frameFences[frame]);
 
-  auto currentCmdBuf = m_cmdBuffersDrawMain[m_presentationResources.currentFrame];
+  if (m_submittedCmdBuffers[frame] != UINT32_MAX)
+  {
+    m_pGpuProfiler->Collect(m_submittedCmdBuffers[frame]);
+    CollectSsaoTileStats(frame);
+  }
 
-  VkSemaphore waitSemaphores[] = {m_presentationResources.imageAvailable};
+  m_pFrameAllocator->BeginFrame(frame);
+  m_uniformsAlloc = m_pFrameAllocator->Push(m_uniforms);
+
+  const uint32_t cmdBufIdx = frame * m_swapchain.GetImageCount() + imageIdx;
+  auto currentCmdBuf = m_cmdBuffersDrawMain[cmdBufIdx];
+
+  VkSemaphore waitSemaphores[] = {m_presentationResources.imageAvailable[frame]};
   VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
-  BuildCommandBufferSimple(currentCmdBuf, m_swapchain.GetAttachment(imageIdx).image, m_swapchain.GetAttachment(imageIdx).view);
+  UpdateSceneInstances();
+  UpdateShadowCache();
+  CullScene();
+  UpdateRecordedState();
+  // recorded descriptor sets point to the offsets of the last recording
+  if (m_pFrameAllocator->LayoutChanged())
+    InvalidateCommandBuffers();
+  // every invalidation may change the passes of a frame, recordings of older versions are not replayed anymore
+  if (m_frameGraphVersion != m_commandsVersion)
+  {
+    SetupFrameGraph();
+    m_frameGraphVersion = m_commandsVersion;
+  }
+
+  // A recording can only be replayed if the image states etna assumed at its start are the ones it leaves behind.
+  // This holds from the second frame after an invalidation on, once the target image has been presented before.
+  // The full screen quad is drawn with etna's per frame descriptor sets, so that debug view records every frame.
+  const bool reusable = m_reuseCommandBuffers && m_framesSinceInvalidation > 0 && m_swapchainImageUsed[imageIdx]
+    && !m_input.drawFSQuad && !m_pUploads->HasPendingAcquires() && m_colorCheck.stage == ColorCheckStage::IDLE;
+  if (!reusable || m_cmdBufferVersions[cmdBufIdx] != m_commandsVersion)
+  {
+    if (reusable && m_persistentSetsVersion != m_commandsVersion)
+    {
+      // sets of the previous version may still be in use by the other frames in flight
+      for (uint32_t i = 0; i < m_framesInFlight; ++i)
+      {
+        if (i != frame)
+          vkWaitForFences(m_context->getDevice(), 1, &m_frameFences[i], VK_TRUE, UINT64_MAX);
+      }
+      m_pPersistentSets->Reset();
+      m_persistentSetsVersion = m_commandsVersion;
+    }
+
+    const auto recordStart = std::chrono::high_resolution_clock::now();
+    m_recordingReusable = reusable;
+    BuildCommandBufferSimple(currentCmdBuf, m_swapchain.GetAttachment(imageIdx).image, m_swapchain.GetAttachment(imageIdx).view,
+      cmdBufIdx);
+    m_recordingReusable = false;
+    m_commandStats.recordMs = std::chrono::duration<float, std::milli>(
+      std::chrono::high_resolution_clock::now() - recordStart).count();
+    m_commandStats.recorded++;
+
+    m_cmdBufferVersions[cmdBufIdx] = reusable ? m_commandsVersion : 0;
+  }
+  else
+    m_commandStats.reused++;
 
   std::vector<VkCommandBuffer> submitCmdBufs = { currentCmdBuf };
 
@@ -37,15 +129,26 @@ void SimpleShadowmapRender::DrawFrameSimple(bool draw_gui)
   submitInfo.commandBufferCount = (uint32_t)submitCmdBufs.size();
   submitInfo.pCommandBuffers = submitCmdBufs.data();
 
-  VkSemaphore signalSemaphores[] = {m_presentationResources.renderingFinished};
+  VkSemaphore signalSemaphores[] = {m_presentationResources.renderingFinished[frame]};
   submitInfo.signalSemaphoreCount = 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
 
   VK_CHECK_RESULT(vkQueueSubmit(m_context->getQueue(),
-    1, &submitInfo, m_frameFences[m_presentationResources.currentFrame]));
+    1, &submitInfo, m_frameFences[frame]));
+
+  m_swapchainImageUsed[imageIdx] = true;
+  m_submittedCmdBuffers[frame] = cmdBufIdx;
+  m_framesSinceInvalidation++;
+  // the next frame tests occlusion against the pyramid built by this one
+  m_depthPyramidValid = m_cullingMode == CullingMode::GPU && m_occlusionCulling;
+  m_depthPyramidProjView = m_worldViewProj;
+  FinishShadowFrame();
+
+  if (m_colorCheck.stage != ColorCheckStage::IDLE)
+    FinishColorCheckFrame();
 
   VkResult presentRes = m_swapchain.QueuePresent(m_presentationResources.queue, imageIdx,
-                                                 m_presentationResources.renderingFinished);
+                                                 m_presentationResources.renderingFinished[frame]);
 
   if (presentRes == VK_ERROR_OUT_OF_DATE_KHR || presentRes == VK_SUBOPTIMAL_KHR)
   {
@@ -58,13 +161,49 @@ void SimpleShadowmapRender::DrawFrameSimple(bool draw_gui)
 
   m_presentationResources.currentFrame = (m_presentationResources.currentFrame + 1) % m_framesInFlight;
 
-  vkQueueWaitIdle(m_presentationResources.queue);
-  
+  // the next frame is recorded while this one is executed unless the old behaviour is selected for comparison
+  if (m_framePacing.waitIdle)
+    vkQueueWaitIdle(m_presentationResources.queue);
+
+  // etna::submit moves on to its next per frame descriptor pool and resets it. With a ring of two or more pools
+  // that one was last used by a frame no newer than the one of the next slot, which may still be executing, so
+  // the next slot's fence is waited here rather than at the start of the next frame. The CPU still records a
+  // frame while the GPU executes the previous one.
+  vkWaitForFences(m_context->getDevice(), 1, &m_frameFences[m_presentationResources.currentFrame], VK_TRUE, UINT64_MAX);
   etna::submit();
 }
 
+void SimpleShadowmapRender::UpdateFramePacing()
+{
+  const auto now = std::chrono::high_resolution_clock::now();
+  const float frameMs = std::chrono::duration<float, std::milli>(now - m_framePacing.lastFrame).count();
+  m_framePacing.lastFrame = now;
+  if (!m_framePacing.started)
+  {
+    m_framePacing.started = true;
+    return;
+  }
+
+  // the interval belongs to the previous frame, which was drawn with the current mode
+  const uint32_t mode = m_framePacing.waitIdle ? 1 : 0;
+  float& average = m_framePacing.frameMs[mode];
+  average = average == 0.0f ? frameMs : average + (frameMs - average) * 0.05f;
+
+  if (m_framePacing.benchmarkFrames == 0)
+    return;
+
+  m_framePacing.benchmarkMs[mode] += frameMs;
+  m_framePacing.waitIdle = --m_framePacing.benchmarkFrames > FRAME_PACING_BENCHMARK_FRAMES;
+  if (m_framePacing.benchmarkFrames == 0)
+  {
+    for (uint32_t i = 0; i < 2; ++i)
+      m_framePacing.benchmarkResult[i] = float(m_framePacing.benchmarkMs[i] / FRAME_PACING_BENCHMARK_FRAMES);
+  }
+}
+
 void SimpleShadowmapRender::DrawFrame(float a_time, DrawMode a_mode)
 {
+  UpdateFramePacing();
   UpdateUniformBuffer(a_time);
   switch (a_mode)
   {
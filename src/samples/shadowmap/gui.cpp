@@ -2,6 +2,8 @@
 
 #include "../../render/render_gui.h"
 
+#include <algorithm>
+
 void SimpleShadowmapRender::SetupGUIElements()
 {
   ImGui_ImplVulkan_NewFrame();
@@ -12,10 +14,139 @@ void SimpleShadowmapRender::SetupGUIElements()
     ImGui::Begin("Simple render settings");
 
     ImGui::SliderFloat3("Light source position", m_uniforms.lightPos.M, -10.f, 10.f);
+    bool shadowLayers = m_shadowCache.layered;
+    if (ImGui::Checkbox("Static and dynamic shadow layers", &shadowLayers))
+      SetShadowLayers(shadowLayers);
+    ImGui::Text("Shadow map: %u rendered (%u cascades), %u reused, %u dynamic casters",
+      m_shadowCache.rendered, m_shadowCache.cascadesRendered, m_shadowCache.reused, m_shadowCache.dynamicNum);
+    int shadowCascades = int(m_shadowCascadesNum);
+    if (ImGui::SliderInt("Shadow cascades", &shadowCascades, 2, SHADOW_CASCADES_MAX))
+      SetShadowCascadesNum(uint32_t(shadowCascades));
+    ImGui::Text("Shadow cascades end at %.1f, %.1f, %.1f, %.1f", m_uniforms.shadowCascadeSplits.x,
+      m_uniforms.shadowCascadeSplits.y, m_uniforms.shadowCascadeSplits.z, m_uniforms.shadowCascadeSplits.w);
     ImGui::Checkbox("SSAO", (bool*)&m_uniforms.ssaoEnabled);
+    const char* ssaoResolutions[] = {"Full", "Half", "Quarter"};
+    int ssaoResolution = static_cast<int>(m_ssaoResolution);
+    if (ImGui::Combo("SSAO resolution", &ssaoResolution, ssaoResolutions, IM_ARRAYSIZE(ssaoResolutions)))
+      SetSsaoResolution(static_cast<SsaoResolution>(ssaoResolution));
+    if (m_uniforms.ssaoEnabled && m_ssaoTileHits + m_ssaoTileMisses > 0)
+      ImGui::Text("SSAO samples from the shared tile: %.1f%%",
+        100.0 * double(m_ssaoTileHits) / double(m_ssaoTileHits + m_ssaoTileMisses));
     ImGui::SliderFloat("Blending width", (float*)&m_uniforms.screenSpaceBlendingWidth, 0.f, 0.5f);
 
     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+    const char* cullingModes[] = {"CPU frustum", "GPU frustum + Hi-Z"};
+    int cullingMode = static_cast<int>(m_cullingMode);
+    if (ImGui::Combo("Culling", &cullingMode, cullingModes, IM_ARRAYSIZE(cullingModes)))
+      m_cullingMode = static_cast<CullingMode>(cullingMode);
+
+    // an instance in several cascades is counted once per cascade
+    if (m_cullingMode == CullingMode::CPU)
+    {
+      uint32_t lightVisible = 0;
+      for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+        lightVisible += m_cpuVisibleCounts[1 + cascade];
+      ImGui::Text("Visible instances: camera %u, cascades %u of %u",
+        m_cpuVisibleCounts[0], lightVisible, m_pScnMgr->InstancesNum());
+    }
+    else
+    {
+      ImGui::Checkbox("Occlusion culling", &m_occlusionCulling);
+      ImGui::Text("Camera: %u drawn, %u frustum culled, %u occluded",
+        m_gpuCullingStats[0].drawCount, m_gpuCullingStats[0].frustumCulled, m_gpuCullingStats[0].occlusionCulled);
+      uint32_t lightDrawn = 0, lightCulled = 0;
+      for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+      {
+        lightDrawn  += m_gpuCullingStats[1 + cascade].drawCount;
+        lightCulled += m_gpuCullingStats[1 + cascade].frustumCulled;
+      }
+      ImGui::Text("Cascades: %u drawn, %u frustum culled", lightDrawn, lightCulled);
+    }
+
+    if (m_pGpuProfiler->Supported())
+    {
+      // SSAO is listed once per resolution it has been drawn with
+      ImGui::Text("GPU time, ms:");
+      for (const auto& timing : m_pGpuProfiler->Timings())
+        ImGui::Text("  %s: %.3f", timing.name.c_str(), timing.ms);
+      ImGui::Checkbox("GPU timeline overlay", &m_showProfilerOverlay);
+    }
+    else
+      ImGui::Text("GPU timestamps are not supported");
+    ImGui::Checkbox("Overlap SSAO with shadow rendering", &m_overlapSsaoWithShadows);
+
+    ImGui::Checkbox("Wait for the GPU every frame", &m_framePacing.waitIdle);
+    ImGui::Text("Frame time: %.3f ms pipelined, %.3f ms waiting", m_framePacing.frameMs[0], m_framePacing.frameMs[1]);
+    if (m_framePacing.benchmarkFrames > 0)
+      ImGui::Text("Benchmark: %u frames left", m_framePacing.benchmarkFrames);
+    else if (ImGui::Button("Benchmark frame pacing"))
+    {
+      m_framePacing.waitIdle = true;
+      m_framePacing.benchmarkFrames = 2 * FRAME_PACING_BENCHMARK_FRAMES;
+      m_framePacing.benchmarkMs[0] = m_framePacing.benchmarkMs[1] = 0.0;
+    }
+    if (m_framePacing.benchmarkResult[0] > 0.0f)
+    {
+      ImGui::Text("Last benchmark: %.3f ms pipelined, %.3f ms waiting (%.2fx)", m_framePacing.benchmarkResult[0],
+        m_framePacing.benchmarkResult[1], m_framePacing.benchmarkResult[1] / m_framePacing.benchmarkResult[0]);
+    }
+
+    ImGui::Checkbox("Reuse command buffers", &m_reuseCommandBuffers);
+    ImGui::Text("Command buffers: %u recorded, %u reused, last recording %.3f ms",
+      m_commandStats.recorded, m_commandStats.reused, m_commandStats.recordMs);
+
+    ImGui::Text("Frame allocator: %.1f of %.1f KB per frame, peak %.1f KB",
+      double(m_pFrameAllocator->Used()) / 1024.0, double(m_pFrameAllocator->FrameSize()) / 1024.0,
+      double(m_pFrameAllocator->PeakUsed()) / 1024.0);
+
+    const auto& graphStats = m_pFrameGraph->GetStats();
+    ImGui::Text("Frame graph: %u of %u passes, %u barriers, %u reads without one",
+      graphStats.passes - graphStats.culledPasses, graphStats.passes, graphStats.stateRequests, graphStats.mergedReads);
+    ImGui::Text("Frame graph images: %u for %u transient, %.1f of %.1f MB, %.1f MB saved",
+      graphStats.allocatedImages, graphStats.transientImages, double(graphStats.allocatedBytes) / (1024.0 * 1024.0),
+      double(graphStats.transientBytes) / (1024.0 * 1024.0),
+      double(graphStats.transientBytes - graphStats.allocatedBytes) / (1024.0 * 1024.0));
+
+    const char* colorPrecisions[] = {"R11G11B10 (4 B/px)", "RGBA16F (8 B/px)", "RGBA32F (16 B/px)"};
+    if (m_colorCheck.stage != ColorCheckStage::IDLE)
+      ImGui::Text("Color targets: checking %s", colorPrecisions[static_cast<int>(m_colorCheck.tested)]);
+    else
+    {
+      int colorPrecision = static_cast<int>(m_colorPrecision);
+      if (ImGui::Combo("Color targets", &colorPrecision, colorPrecisions, IM_ARRAYSIZE(colorPrecisions)))
+        SetColorPrecision(static_cast<ColorPrecision>(colorPrecision));
+      if (ImGui::Button("Check against RGBA32F"))
+        StartColorCheck();
+    }
+    if (m_colorCheck.hasResult)
+    {
+      ImGui::Text("%s: max diff %.2f/255, mean %.3f/255, %s", colorPrecisions[static_cast<int>(m_colorCheck.resultPrecision)],
+        m_colorCheck.maxDiff * 255.0f, m_colorCheck.meanDiff * 255.0f,
+        m_colorCheck.maxDiff <= COLOR_CHECK_MAX_DIFF ? "passed" : "failed");
+    }
+
+    const auto heapStats = m_pGeoHeap->GetStats();
+    ImGui::Text("Geometry heap: %.1f of %.1f MB in %u blocks, %u buffers, %.0f%% fragmented",
+      double(heapStats.usedBytes) / (1024.0 * 1024.0), double(heapStats.reservedBytes) / (1024.0 * 1024.0),
+      heapStats.blocks, heapStats.allocations, heapStats.fragmentation * 100.0f);
+
+    if (ImGui::CollapsingHeader("Scene queries"))
+    {
+      SceneBvh::RayHit rayHit;
+      if (m_sceneBvh.RayPick(m_cam.pos, m_cam.forward(), m_cam.tdist, rayHit))
+        ImGui::Text("Under crosshair: instance %u, triangle %u at %.2f", rayHit.instId, rayHit.triangleId, rayHit.t);
+      else
+        ImGui::Text("Under crosshair: nothing");
+
+      SceneBvh::SurfaceHit surfaceHit;
+      if (m_sceneBvh.NearestSurface(m_light.cam.pos, m_light.lightTargetDist, surfaceHit))
+        ImGui::Text("Closest to light: instance %u at %.2f", surfaceHit.instId, surfaceHit.distance);
+      else
+        ImGui::Text("Closest to light: nothing in range");
+
+      m_sceneBvh.QueryFrustum(m_lightMatrix, m_queriedInstances);
+      ImGui::Text("Instances in light frustum: %zu", m_queriedInstances.size());
+    }
 
     ImGui::NewLine();
 
@@ -23,6 +154,45 @@ void SimpleShadowmapRender::SetupGUIElements()
     ImGui::End();
   }
 
+  if (m_showProfilerOverlay && m_pGpuProfiler->Supported())
+    DrawProfilerOverlay();
+
   // Rendering
   ImGui::Render();
 }
+
+void SimpleShadowmapRender::DrawProfilerOverlay()
+{
+  const auto& timings = m_pGpuProfiler->Timings();
+  float frameMs = 0.0f;
+  for (const auto& timing : timings)
+    frameMs = std::max(frameMs, timing.startMs + timing.ms);
+
+  ImGui::SetNextWindowBgAlpha(0.6f);
+  ImGui::Begin("GPU timeline", &m_showProfilerOverlay, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing);
+  ImGui::Text("%.3f ms from the first to the last scope end", frameMs);
+
+  // a row per scope, bars that share columns ran at the same time
+  const float labelWidth = 140.0f;
+  const float barsWidth  = 360.0f;
+  const float rowHeight  = ImGui::GetTextLineHeightWithSpacing();
+  ImDrawList* drawList   = ImGui::GetWindowDrawList();
+  const ImU32 barColor   = ImGui::GetColorU32(ImGuiCol_PlotHistogram);
+  for (const auto& timing : timings)
+  {
+    const ImVec2 rowStart = ImGui::GetCursorScreenPos();
+    ImGui::TextUnformatted(timing.name.c_str());
+    ImGui::SameLine(labelWidth);
+    ImGui::Dummy(ImVec2(barsWidth, ImGui::GetTextLineHeight()));
+    if (frameMs <= 0.0f)
+      continue;
+
+    const float x0 = rowStart.x + labelWidth + barsWidth * timing.startMs / frameMs;
+    const float x1 = rowStart.x + labelWidth + barsWidth * (timing.startMs + timing.ms) / frameMs;
+    drawList->AddRectFilled(ImVec2(x0, rowStart.y + 1.0f), ImVec2(std::max(x1, x0 + 1.0f), rowStart.y + rowHeight - 2.0f),
+      barColor);
+    if (ImGui::IsItemHovered())
+      ImGui::SetTooltip("%s: %.3f ms at %.3f ms", timing.name.c_str(), timing.ms, timing.startMs);
+  }
+  ImGui::End();
+}
@@ -0,0 +1,217 @@
+#include "mesh_lod.h"
+#include "preprocessing_common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <execution>
+#include <numeric>
+#include <unordered_map>
+
+static glm::vec3 read_vec3(const std::vector<float> &vertexData, uint32_t vertexNo, int offset)
+{
+  const float *p = &vertexData[size_t(SINGLE_VERTEX_FLOAT_NUM) * vertexNo + offset];
+  return glm::vec3(p[0], p[1], p[2]);
+}
+
+static void write_vec3(std::vector<float> &vertexData, uint32_t vertexNo, int offset, const glm::vec3 &value)
+{
+  float *p = &vertexData[size_t(SINGLE_VERTEX_FLOAT_NUM) * vertexNo + offset];
+  p[0] = value.x;
+  p[1] = value.y;
+  p[2] = value.z;
+}
+
+// One of 6 buckets: dominant axis of the normal and its sign
+static uint32_t normal_bucket(const glm::vec3 &n)
+{
+  glm::vec3 a = glm::abs(n);
+  if (a.x >= a.y && a.x >= a.z)
+    return n.x >= 0.f ? 0 : 1;
+  if (a.y >= a.z)
+    return n.y >= 0.f ? 2 : 3;
+  return n.z >= 0.f ? 4 : 5;
+}
+
+void simplify_mesh(const std::vector<float> &vertexData, const std::vector<uint32_t> &indexData, float cellSize,
+  std::vector<float> &lodVertexData, std::vector<uint32_t> &lodIndexData)
+{
+  assert(cellSize > 0.f);
+  const uint32_t vertexCount = static_cast<uint32_t>(vertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
+
+  glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+  for (uint32_t i = 0; i < vertexCount; i++)
+  {
+    boxMin = glm::min(boxMin, read_vec3(vertexData, i, VERTEX_POSITION_START));
+    boxMax = glm::max(boxMax, read_vec3(vertexData, i, VERTEX_POSITION_START));
+  }
+  glm::uvec3 gridSize = glm::uvec3((boxMax - boxMin) / cellSize) + 1u;
+
+  struct CellSum
+  {
+    glm::vec3 position = glm::vec3(0.f);
+    uint32_t count = 0;
+  };
+  struct ClusterSum
+  {
+    glm::vec3 normal = glm::vec3(0.f);
+    uint32_t lodVertexNo = 0;
+  };
+
+  std::unordered_map<uint64_t, CellSum> cells;
+  std::unordered_map<uint64_t, ClusterSum> clusters;
+  std::vector<uint64_t> vertexCell(vertexCount);
+  std::vector<uint64_t> vertexCluster(vertexCount);
+
+  for (uint32_t i = 0; i < vertexCount; i++)
+  {
+    glm::vec3 pos = read_vec3(vertexData, i, VERTEX_POSITION_START);
+    glm::vec3 normal = read_vec3(vertexData, i, VERTEX_NORMAL_START);
+    glm::uvec3 cell = glm::min(glm::uvec3((pos - boxMin) / cellSize), gridSize - 1u);
+
+    uint64_t cellId = (uint64_t(cell.z) * gridSize.y + cell.y) * gridSize.x + cell.x;
+    uint64_t clusterId = cellId * 6 + normal_bucket(normal);
+    vertexCell[i] = cellId;
+    vertexCluster[i] = clusterId;
+
+    cells[cellId].position += pos;
+    cells[cellId].count++;
+    clusters[clusterId].normal += normal;
+  }
+
+  lodVertexData.clear();
+  lodIndexData.clear();
+  std::unordered_map<uint64_t, uint32_t> usedClusters;
+
+  auto emitVertex = [&](uint32_t vertexNo)
+  {
+    auto [it, inserted] = usedClusters.try_emplace(vertexCluster[vertexNo], 0);
+    if (inserted)
+    {
+      it->second = static_cast<uint32_t>(lodVertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
+      lodVertexData.resize(lodVertexData.size() + SINGLE_VERTEX_FLOAT_NUM, 0.f);
+
+      const CellSum &cell = cells[vertexCell[vertexNo]];
+      glm::vec3 normal = clusters[vertexCluster[vertexNo]].normal;
+      float normalLength = glm::length(normal);
+      write_vec3(lodVertexData, it->second, VERTEX_POSITION_START, cell.position / float(cell.count));
+      write_vec3(lodVertexData, it->second, VERTEX_NORMAL_START,
+        normalLength > 0.f ? normal / normalLength : read_vec3(vertexData, vertexNo, VERTEX_NORMAL_START));
+    }
+    lodIndexData.push_back(it->second);
+  };
+
+  for (size_t t = 0; t + 2 < indexData.size(); t += 3)
+  {
+    uint32_t i0 = indexData[t + 0], i1 = indexData[t + 1], i2 = indexData[t + 2];
+    // Triangles collapsed into a single cell have zero area
+    if (vertexCell[i0] == vertexCell[i1] || vertexCell[i1] == vertexCell[i2] || vertexCell[i0] == vertexCell[i2])
+      continue;
+
+    emitVertex(i0);
+    emitVertex(i1);
+    emitVertex(i2);
+  }
+}
+
+// Closest point on a triangle (Ericson, Real-Time Collision Detection 5.1.5), returned as barycentrics
+static glm::vec3 closest_point_barycentrics(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+  glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+  float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+  if (d1 <= 0.f && d2 <= 0.f)
+    return glm::vec3(1.f, 0.f, 0.f);
+
+  glm::vec3 bp = p - b;
+  float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+  if (d3 >= 0.f && d4 <= d3)
+    return glm::vec3(0.f, 1.f, 0.f);
+
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+  {
+    float v = d1 / (d1 - d3);
+    return glm::vec3(1.f - v, v, 0.f);
+  }
+
+  glm::vec3 cp = p - c;
+  float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+  if (d6 >= 0.f && d5 <= d6)
+    return glm::vec3(0.f, 0.f, 1.f);
+
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+  {
+    float w = d2 / (d2 - d6);
+    return glm::vec3(1.f - w, 0.f, w);
+  }
+
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+  {
+    float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    return glm::vec3(0.f, 1.f - w, w);
+  }
+
+  float denom = 1.f / (va + vb + vc);
+  float v = vb * denom, w = vc * denom;
+  return glm::vec3(1.f - v - w, v, w);
+}
+
+void transfer_sh_coefficients(const std::vector<float> &vertexData, const std::vector<uint32_t> &indexData,
+  std::vector<float> &lodVertexData)
+{
+  const uint32_t lodVertexCount = static_cast<uint32_t>(lodVertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
+  std::vector<uint32_t> vertexNumbers(lodVertexCount);
+  std::iota(vertexNumbers.begin(), vertexNumbers.end(), 0);
+
+  std::for_each(
+    std::execution::par,
+    vertexNumbers.begin(),
+    vertexNumbers.end(),
+    [&vertexData, &indexData, &lodVertexData](uint32_t vertexNo)
+    {
+      glm::vec3 pos = read_vec3(lodVertexData, vertexNo, VERTEX_POSITION_START);
+      glm::vec3 normal = read_vec3(lodVertexData, vertexNo, VERTEX_NORMAL_START);
+
+      // Coefficients are expressed in the vertex normal frame, so triangles facing the other way
+      // (e.g. the opposite wall of a thin shell) are only used when nothing else is found.
+      float bestDistance[2] = {FLT_MAX, FLT_MAX};
+      size_t bestTriangle[2] = {0, 0};
+      glm::vec3 bestBarycentrics[2] = {};
+
+      for (size_t t = 0; t + 2 < indexData.size(); t += 3)
+      {
+        glm::vec3 a = read_vec3(vertexData, indexData[t + 0], VERTEX_POSITION_START);
+        glm::vec3 b = read_vec3(vertexData, indexData[t + 1], VERTEX_POSITION_START);
+        glm::vec3 c = read_vec3(vertexData, indexData[t + 2], VERTEX_POSITION_START);
+
+        glm::vec3 barycentrics = closest_point_barycentrics(pos, a, b, c);
+        glm::vec3 closest = a * barycentrics.x + b * barycentrics.y + c * barycentrics.z;
+        glm::vec3 delta = closest - pos;
+        float distance = glm::dot(delta, delta);
+
+        glm::vec3 triangleNormal = read_vec3(vertexData, indexData[t + 0], VERTEX_NORMAL_START) * barycentrics.x
+          + read_vec3(vertexData, indexData[t + 1], VERTEX_NORMAL_START) * barycentrics.y
+          + read_vec3(vertexData, indexData[t + 2], VERTEX_NORMAL_START) * barycentrics.z;
+        int facing = glm::dot(triangleNormal, normal) > 0.f ? 0 : 1;
+
+        if (distance < bestDistance[facing])
+        {
+          bestDistance[facing] = distance;
+          bestTriangle[facing] = t;
+          bestBarycentrics[facing] = barycentrics;
+        }
+      }
+
+      int best = bestDistance[0] < FLT_MAX ? 0 : 1;
+      for (int i = 0; i < SH_COEEFS_NUM * SH_ENCODED_VALUES; i++)
+      {
+        float coefficient = 0.f;
+        for (int corner = 0; corner < 3; corner++)
+          coefficient += bestBarycentrics[best][corner]
+            * vertexData[size_t(SINGLE_VERTEX_FLOAT_NUM) * indexData[bestTriangle[best] + corner] + SH_COEFFS_START + i];
+        lodVertexData[size_t(SINGLE_VERTEX_FLOAT_NUM) * vertexNo + SH_COEFFS_START + i] = coefficient;
+      }
+    });
+}
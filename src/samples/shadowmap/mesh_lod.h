@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Vertex clustering simplification of an interleaved transparency mesh (SINGLE_VERTEX_FLOAT_NUM floats per vertex).
+// Vertices are snapped to a grid with the given (positive) cell size; all vertices of a cell share one position so the
+// result has no cracks, while normals are averaged per cell and dominant normal axis to keep hard edges.
+// SH coefficients of the produced vertices are left zeroed, see transfer_sh_coefficients.
+void simplify_mesh(const std::vector<float> &vertexData, const std::vector<uint32_t> &indexData, float cellSize,
+  std::vector<float> &lodVertexData, std::vector<uint32_t> &lodIndexData);
+
+// Fills SH coefficients of the simplified mesh from the full-resolution bake: every LOD vertex takes the
+// barycentric interpolation of the coefficients at the nearest point on the original surface.
+void transfer_sh_coefficients(const std::vector<float> &vertexData, const std::vector<uint32_t> &indexData,
+  std::vector<float> &lodVertexData);
@@ -0,0 +1,236 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include <glm/glm.hpp>
+
+float calculate_acmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+  if (indices.size() < 3)
+    return 0.f;
+
+  // Timestamp based FIFO emulation: a vertex is in the cache if it was pushed less than cacheSize misses ago
+  std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+  uint32_t timestamp = cacheSize + 1;
+  uint32_t misses = 0;
+
+  for (uint32_t index : indices)
+  {
+    if (timestamp - cacheTimestamps[index] > cacheSize)
+    {
+      cacheTimestamps[index] = timestamp++;
+      misses++;
+    }
+  }
+
+  return float(misses) / float(indices.size() / 3);
+}
+
+std::vector<uint32_t> optimize_vertex_cache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+  const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+  std::vector<uint32_t> clusterStarts;
+  if (triangleCount == 0)
+    return clusterStarts;
+
+  // Vertex -> triangles adjacency in CSR form
+  std::vector<uint32_t> liveTriangles(vertexCount, 0);
+  for (uint32_t index : indices)
+    liveTriangles[index]++;
+
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  std::inclusive_scan(liveTriangles.begin(), liveTriangles.end(), adjacencyOffsets.begin() + 1);
+
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (uint32_t triangle = 0; triangle < triangleCount; triangle++)
+      for (uint32_t corner = 0; corner < 3; corner++)
+        adjacency[fill[indices[3 * triangle + corner]]++] = triangle;
+  }
+
+  std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> deadEndStack;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+
+  uint32_t timestamp = cacheSize + 1;
+  uint32_t cursor = 0;
+  int64_t fanningVertex = 0;
+  bool startCluster = true;
+
+  auto skipDeadEnd = [&]() -> int64_t
+  {
+    while (!deadEndStack.empty())
+    {
+      uint32_t vertex = deadEndStack.back();
+      deadEndStack.pop_back();
+      if (liveTriangles[vertex] > 0)
+        return vertex;
+    }
+    for (; cursor < vertexCount; cursor++)
+      if (liveTriangles[cursor] > 0)
+        return cursor;
+    return -1;
+  };
+
+  while (fanningVertex >= 0)
+  {
+    if (startCluster)
+    {
+      clusterStarts.push_back(static_cast<uint32_t>(result.size()));
+      startCluster = false;
+    }
+
+    candidates.clear();
+    for (uint32_t i = adjacencyOffsets[fanningVertex]; i < adjacencyOffsets[fanningVertex + 1]; i++)
+    {
+      uint32_t triangle = adjacency[i];
+      if (emitted[triangle])
+        continue;
+
+      for (uint32_t corner = 0; corner < 3; corner++)
+      {
+        uint32_t vertex = indices[3 * triangle + corner];
+        result.push_back(vertex);
+        deadEndStack.push_back(vertex);
+        candidates.push_back(vertex);
+        liveTriangles[vertex]--;
+        if (timestamp - cacheTimestamps[vertex] > cacheSize)
+          cacheTimestamps[vertex] = timestamp++;
+      }
+      emitted[triangle] = true;
+    }
+
+    // Prefer the candidate that stays in the cache longest while its remaining fan is emitted
+    int64_t nextVertex = -1;
+    uint32_t bestPriority = 0;
+    for (uint32_t vertex : candidates)
+    {
+      if (liveTriangles[vertex] == 0)
+        continue;
+
+      uint32_t priority = 0;
+      if (timestamp - cacheTimestamps[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+        priority = timestamp - cacheTimestamps[vertex];
+      if (nextVertex < 0 || priority > bestPriority)
+      {
+        bestPriority = priority;
+        nextVertex = vertex;
+      }
+    }
+
+    if (nextVertex < 0)
+    {
+      nextVertex = skipDeadEnd();
+      startCluster = true;
+    }
+    fanningVertex = nextVertex;
+  }
+
+  indices.swap(result);
+  return clusterStarts;
+}
+
+void optimize_overdraw(std::vector<uint32_t> &indices, const std::vector<uint32_t> &clusterStarts,
+  const std::vector<float> &vertexData, uint32_t vertexStride, uint32_t positionOffset)
+{
+  if (clusterStarts.size() < 2)
+    return;
+
+  auto position = [&](uint32_t vertex)
+  {
+    const float *p = &vertexData[vertexStride * vertex + positionOffset];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  struct Cluster
+  {
+    uint32_t begin, end;
+    glm::vec3 centroid;
+    glm::vec3 normal;
+    float area;
+  };
+
+  std::vector<Cluster> clusters;
+  clusters.reserve(clusterStarts.size());
+  glm::vec3 meshCentroid(0.f);
+  float meshArea = 0.f;
+
+  for (size_t i = 0; i < clusterStarts.size(); i++)
+  {
+    Cluster cluster = {};
+    cluster.centroid = glm::vec3(0.f);
+    cluster.normal = glm::vec3(0.f);
+    cluster.begin = clusterStarts[i];
+    cluster.end = i + 1 < clusterStarts.size() ? clusterStarts[i + 1] : static_cast<uint32_t>(indices.size());
+
+    for (uint32_t t = cluster.begin; t + 2 < cluster.end; t += 3)
+    {
+      glm::vec3 p0 = position(indices[t + 0]);
+      glm::vec3 p1 = position(indices[t + 1]);
+      glm::vec3 p2 = position(indices[t + 2]);
+      glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(areaNormal);
+
+      cluster.centroid += (p0 + p1 + p2) / 3.f * area;
+      cluster.normal += areaNormal;
+      cluster.area += area;
+    }
+
+    meshCentroid += cluster.centroid;
+    meshArea += cluster.area;
+    if (cluster.area > 0.f)
+      cluster.centroid /= cluster.area;
+    clusters.push_back(cluster);
+  }
+
+  if (meshArea > 0.f)
+    meshCentroid /= meshArea;
+
+  // Clusters that face outwards occlude the rest of the object, so they go first
+  std::vector<float> sortKeys(clusters.size());
+  for (size_t i = 0; i < clusters.size(); i++)
+  {
+    float normalLength = glm::length(clusters[i].normal);
+    glm::vec3 normal = normalLength > 0.f ? clusters[i].normal / normalLength : glm::vec3(0.f);
+    sortKeys[i] = glm::dot(clusters[i].centroid - meshCentroid, normal);
+  }
+
+  std::vector<uint32_t> order(clusters.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (uint32_t clusterNo : order)
+    result.insert(result.end(), indices.begin() + clusters[clusterNo].begin, indices.begin() + clusters[clusterNo].end);
+
+  indices.swap(result);
+}
+
+void optimize_vertex_fetch(std::vector<uint32_t> &indices, std::vector<float> &vertexData, uint32_t vertexStride)
+{
+  const uint32_t vertexCount = static_cast<uint32_t>(vertexData.size() / vertexStride);
+  std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+  std::vector<float> result(vertexData.size());
+  uint32_t nextVertex = 0;
+
+  for (uint32_t &index : indices)
+  {
+    if (remap[index] == UINT32_MAX)
+    {
+      remap[index] = nextVertex;
+      std::copy_n(vertexData.begin() + size_t(vertexStride) * index, vertexStride, result.begin() + size_t(vertexStride) * nextVertex);
+      nextVertex++;
+    }
+    index = remap[index];
+  }
+
+  // Vertices that are not referenced by any triangle are dropped
+  result.resize(size_t(vertexStride) * nextVertex);
+  vertexData.swap(result);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Average cache miss ratio: vertex shader invocations per triangle for a FIFO post-transform
+// cache of the given size. 0.5 is the theoretical optimum for regular meshes, 3 is the worst case.
+float calculate_acmr(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize);
+
+// Tipsify (Sander, Nehab, Barczak 2007): reorders triangles in place for post-transform cache locality.
+// Returns the first index of every triangle cluster, clusters are split where the fan walk hits a dead end.
+std::vector<uint32_t> optimize_vertex_cache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize);
+
+// Sorts the clusters produced by optimize_vertex_cache so that the ones facing away from the mesh centre
+// are drawn first, which lets early depth testing reject more of the occluded fragments.
+void optimize_overdraw(std::vector<uint32_t> &indices, const std::vector<uint32_t> &clusterStarts,
+  const std::vector<float> &vertexData, uint32_t vertexStride, uint32_t positionOffset);
+
+// Renumbers vertices in the order of their first use in the index buffer and reorders the
+// interleaved vertex data accordingly, so vertex fetches walk the buffer linearly.
+void optimize_vertex_fetch(std::vector<uint32_t> &indices, std::vector<float> &vertexData, uint32_t vertexStride);
@@ -6,16 +6,27 @@ void SimpleShadowmapRender::InitPresentStuff()
 {
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  VK_CHECK_RESULT(vkCreateSemaphore(m_context->getDevice(), &semaphoreInfo, nullptr, &m_presentationResources.imageAvailable));
-  VK_CHECK_RESULT(vkCreateSemaphore(m_context->getDevice(), &semaphoreInfo, nullptr, &m_presentationResources.renderingFinished));
+  m_presentationResources.imageAvailable.resize(m_framesInFlight);
+  m_presentationResources.renderingFinished.resize(m_framesInFlight);
+  for (uint32_t i = 0; i < m_framesInFlight; ++i)
+  {
+    VK_CHECK_RESULT(vkCreateSemaphore(m_context->getDevice(), &semaphoreInfo, nullptr, &m_presentationResources.imageAvailable[i]));
+    VK_CHECK_RESULT(vkCreateSemaphore(m_context->getDevice(), &semaphoreInfo, nullptr, &m_presentationResources.renderingFinished[i]));
+  }
 
   // TODO: Move to customizable initialization
   m_commandPool = vk_utils::createCommandPool(m_context->getDevice(), m_context->getQueueFamilyIdx(), VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-  m_cmdBuffersDrawMain.reserve(m_framesInFlight);
-  m_cmdBuffersDrawMain = vk_utils::createCommandBuffers(m_context->getDevice(), m_commandPool, m_framesInFlight);
-
-  m_textureCmdBuffer = vk_utils::createCommandBuffers(m_context->getDevice(), m_commandPool, 1)[0];
+  // the target image is baked into the commands, so every frame slot has one per swapchain image
+  const uint32_t cmdBuffersNum = m_framesInFlight * m_swapchain.GetImageCount();
+  m_cmdBuffersDrawMain = vk_utils::createCommandBuffers(m_context->getDevice(), m_commandPool, cmdBuffersNum);
+  m_cmdBufferVersions.assign(cmdBuffersNum, 0);
+  m_swapchainImageUsed.assign(m_swapchain.GetImageCount(), false);
+  m_pPersistentSets = std::make_unique<PersistentDescriptorPool>(m_context->getDevice());
+  m_pGpuProfiler = std::make_unique<GpuProfiler>(m_context->getDevice(), m_context->getPhysicalDevice(),
+    m_context->getQueueFamilyIdx(), cmdBuffersNum);
+  m_submittedCmdBuffers.assign(m_framesInFlight, UINT32_MAX);
+  InvalidateCommandBuffers();
 
   m_frameFences.resize(m_framesInFlight);
   VkFenceCreateInfo fenceInfo = {};
@@ -25,6 +36,7 @@ void SimpleShadowmapRender::InitPresentStuff()
   {
     VK_CHECK_RESULT(vkCreateFence(m_context->getDevice(), &fenceInfo, nullptr, &m_frameFences[i]));
   }
+  m_imagesInFlight.assign(m_swapchain.GetImageCount(), VK_NULL_HANDLE);
 
   m_pGUIRender = std::make_shared<ImGuiRender>(
     m_context->getInstance(),
@@ -43,20 +55,26 @@ void SimpleShadowmapRender::ResetPresentStuff()
                          m_cmdBuffersDrawMain.data());
     m_cmdBuffersDrawMain.clear();
   }
+  m_pPersistentSets.reset();
+  m_pGpuProfiler.reset();
 
   for (size_t i = 0; i < m_frameFences.size(); i++)
   {
     vkDestroyFence(m_context->getDevice(), m_frameFences[i], nullptr);
   }
+  m_frameFences.clear();
+  m_imagesInFlight.clear();
 
-  if (m_presentationResources.imageAvailable != VK_NULL_HANDLE)
+  for (VkSemaphore semaphore : m_presentationResources.imageAvailable)
   {
-    vkDestroySemaphore(m_context->getDevice(), m_presentationResources.imageAvailable, nullptr);
+    vkDestroySemaphore(m_context->getDevice(), semaphore, nullptr);
   }
-  if (m_presentationResources.renderingFinished != VK_NULL_HANDLE)
+  for (VkSemaphore semaphore : m_presentationResources.renderingFinished)
   {
-    vkDestroySemaphore(m_context->getDevice(), m_presentationResources.renderingFinished, nullptr);
+    vkDestroySemaphore(m_context->getDevice(), semaphore, nullptr);
   }
+  m_presentationResources.imageAvailable.clear();
+  m_presentationResources.renderingFinished.clear();
 
   if (m_commandPool != VK_NULL_HANDLE)
   {
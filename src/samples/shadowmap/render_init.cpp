@@ -2,6 +2,43 @@
 
 #include <etna/Etna.hpp>
 
+#include <algorithm>
+#include <cstring>
+
+// the features SetupDeviceFeatures enables, a device without one of them can't run the sample
+static constexpr struct
+{
+  VkBool32 VkPhysicalDeviceFeatures::*member;
+  const char* name;
+} REQUIRED_DEVICE_FEATURES[] =
+{
+  {&VkPhysicalDeviceFeatures::multiDrawIndirect, "multiDrawIndirect"},
+  {&VkPhysicalDeviceFeatures::drawIndirectFirstInstance, "drawIndirectFirstInstance"},
+  {&VkPhysicalDeviceFeatures::shaderStorageImageWriteWithoutFormat, "shaderStorageImageWriteWithoutFormat"},
+};
+
+static std::array<uint8_t, VK_UUID_SIZE> device_uuid(VkPhysicalDevice a_device)
+{
+  VkPhysicalDeviceIDProperties idProperties = {};
+  idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &idProperties;
+  vkGetPhysicalDeviceProperties2(a_device, &properties);
+
+  std::array<uint8_t, VK_UUID_SIZE> uuid;
+  std::copy(std::begin(idProperties.deviceUUID), std::end(idProperties.deviceUUID), uuid.begin());
+  return uuid;
+}
+
+static std::vector<VkPhysicalDevice> enumerate_devices(VkInstance a_instance)
+{
+  uint32_t devicesNum = 0;
+  vkEnumeratePhysicalDevices(a_instance, &devicesNum, nullptr);
+  std::vector<VkPhysicalDevice> devices(devicesNum);
+  vkEnumeratePhysicalDevices(a_instance, &devicesNum, devices.data());
+  return devices;
+}
 
 SimpleShadowmapRender::SimpleShadowmapRender(uint32_t a_width, uint32_t a_height) : m_width(a_width), m_height(a_height)
 {
@@ -23,7 +60,45 @@ void SimpleShadowmapRender::InitVulkan(const char** a_instanceExtensions, uint32
   #endif
 
   SetupDeviceExtensions();
-  
+  SetupDeviceFeatures();
+  SelectPhysicalDevice();
+  InitEtna();
+
+  // Vulkan doesn't promise the same device order in two instances, so the device picked in the query instance is
+  // looked up again in etna's by UUID and etna is started over if the index was another one. Devices usually come
+  // in the same order, a capable one at the wrong index only costs the restart.
+  if (m_physicalDeviceIndex.has_value() && device_uuid(m_context->getPhysicalDevice()) != m_physicalDeviceUuid)
+  {
+    const std::vector<VkPhysicalDevice> devices = enumerate_devices(m_context->getInstance());
+    auto selected = std::find_if(devices.begin(), devices.end(),
+      [this](VkPhysicalDevice a_device) { return device_uuid(a_device) == m_physicalDeviceUuid; });
+    if (selected == devices.end())
+      RUN_TIME_ERROR("The selected Vulkan device is not visible to etna's instance");
+
+    m_physicalDeviceIndex = uint32_t(selected - devices.begin());
+    etna::shutdown();
+    InitEtna();
+  }
+
+  m_maxDrawIndirectCount = m_context->getPhysicalDevice().getProperties().limits.maxDrawIndirectCount;
+  m_vkCmdDrawIndexedIndirectCountKHR = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+    vkGetDeviceProcAddr(m_context->getDevice(), "vkCmdDrawIndexedIndirectCountKHR"));
+  if (m_vkCmdDrawIndexedIndirectCountKHR == nullptr)
+    RUN_TIME_ERROR("vkCmdDrawIndexedIndirectCountKHR is not available");
+
+  // etna exposes a single queue, so uploads share it with rendering
+  m_pUploads = std::make_shared<UploadManager>(m_context->getDevice(), m_context->getPhysicalDevice(),
+    m_context->getQueueFamilyIdx(), m_context->getQueueFamilyIdx());
+
+  // scene and transparency geometry share the same memory blocks
+  m_pGeoHeap = std::make_shared<GeometryHeap>(m_context->getDevice(), m_context->getPhysicalDevice());
+
+  m_pScnMgr = std::make_shared<SceneManager>(
+    m_context->getDevice(), m_context->getPhysicalDevice(), m_pUploads, m_pGeoHeap, false);
+}
+
+void SimpleShadowmapRender::InitEtna()
+{
   etna::initialize(etna::InitParams
     {
       .applicationName = "ShadowmapSample",
@@ -35,19 +110,102 @@ void SimpleShadowmapRender::InitVulkan(const char** a_instanceExtensions, uint32
           .features = m_enabledDeviceFeatures
         },
       // Replace with an index if etna detects your preferred GPU incorrectly 
-      .physicalDeviceIndexOverride = {}
+      .physicalDeviceIndexOverride = m_physicalDeviceIndex
     });
-  
-  m_context = &etna::get_context();
 
-  m_pScnMgr = std::make_shared<SceneManager>(
-    m_context->getDevice(), m_context->getPhysicalDevice(),
-    m_context->getQueueFamilyIdx(), m_context->getQueueFamilyIdx(), false);
+  m_context = &etna::get_context();
 }
 
 void SimpleShadowmapRender::SetupDeviceExtensions()
 {
   m_deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  // core in Vulkan 1.2, but the feature bit can't be enabled through etna
+  m_deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+}
+
+void SimpleShadowmapRender::SetupDeviceFeatures()
+{
+  // the whole scene is drawn with a single vkCmdDrawIndexedIndirect,
+  // gl_InstanceIndex (firstInstance) selects the instance matrix
+  m_enabledDeviceFeatures.multiDrawIndirect = VK_TRUE;
+  m_enabledDeviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+  // bilateral_blur.comp writes images of any format
+  m_enabledDeviceFeatures.shaderStorageImageWriteWithoutFormat = VK_TRUE;
+}
+
+void SimpleShadowmapRender::SelectPhysicalDevice()
+{
+  // etna picks the device itself and fails to create it if a feature or an extension is missing, so the devices
+  // are queried first, from an instance with the extensions etna's has
+  VkApplicationInfo appInfo = {};
+  appInfo.sType      = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  appInfo.apiVersion = VK_API_VERSION_1_1;
+  VkInstanceCreateInfo instanceInfo = {};
+  instanceInfo.sType                   = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instanceInfo.pApplicationInfo        = &appInfo;
+  instanceInfo.enabledExtensionCount   = uint32_t(m_instanceExtensions.size());
+  instanceInfo.ppEnabledExtensionNames = m_instanceExtensions.data();
+  VkInstance instance = VK_NULL_HANDLE;
+  VK_CHECK_RESULT(vkCreateInstance(&instanceInfo, nullptr, &instance));
+
+  const std::vector<VkPhysicalDevice> devices = enumerate_devices(instance);
+  const uint32_t devicesNum = uint32_t(devices.size());
+
+  const VkPhysicalDeviceFeatures& enabled = m_enabledDeviceFeatures;
+  std::string missingReport;
+  std::optional<uint32_t> supporting;
+  bool supportingDiscrete = false;
+  bool allSupport = true;
+  for (uint32_t i = 0; i < devicesNum; ++i)
+  {
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(devices[i], &features);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(devices[i], &properties);
+
+    std::string missing;
+    for (const auto& feature : REQUIRED_DEVICE_FEATURES)
+    {
+      if (enabled.*feature.member && !(features.*feature.member))
+        missing += std::string(missing.empty() ? "" : ", ") + feature.name;
+    }
+
+    uint32_t extensionsNum = 0;
+    vkEnumerateDeviceExtensionProperties(devices[i], nullptr, &extensionsNum, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionsNum);
+    vkEnumerateDeviceExtensionProperties(devices[i], nullptr, &extensionsNum, extensions.data());
+    for (const char* required : m_deviceExtensions)
+    {
+      const bool found = std::any_of(extensions.begin(), extensions.end(),
+        [required](const VkExtensionProperties& a_extension) { return strcmp(a_extension.extensionName, required) == 0; });
+      if (!found)
+        missing += std::string(missing.empty() ? "" : ", ") + required;
+    }
+    if (!missing.empty())
+    {
+      allSupport = false;
+      missingReport += std::string("\n  ") + properties.deviceName + ": " + missing;
+      continue;
+    }
+    // the first discrete GPU is preferred, like etna does
+    const bool discrete = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+    if (!supporting.has_value() || (discrete && !supportingDiscrete))
+    {
+      supporting = i;
+      supportingDiscrete = discrete;
+    }
+  }
+  if (supporting.has_value())
+    m_physicalDeviceUuid = device_uuid(devices[*supporting]);
+  vkDestroyInstance(instance, nullptr);
+
+  if (!supporting.has_value())
+    RUN_TIME_ERROR(("No Vulkan device supports the features and extensions the sample needs:" + missingReport).c_str());
+  if (!allSupport)
+    std::cout << "Devices without the required features or extensions are skipped:" << missingReport << std::endl;
+
+  // with every device capable etna's own choice is kept
+  m_physicalDeviceIndex = allSupport ? std::optional<uint32_t>() : supporting;
 }
 
 void SimpleShadowmapRender::RecreateSwapChain()
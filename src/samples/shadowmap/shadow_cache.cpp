@@ -0,0 +1,310 @@
+#include "shadowmap_render.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include <etna/RenderTargetStates.hpp>
+
+
+static std::vector<VkImageView> create_layer_views(VkDevice a_device, VkImage a_image, uint32_t a_layersNum)
+{
+  std::vector<VkImageView> views(a_layersNum);
+  for (uint32_t layer = 0; layer < a_layersNum; ++layer)
+  {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType            = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image            = a_image;
+    viewInfo.viewType         = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format           = VK_FORMAT_D16_UNORM;
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, layer, 1};
+    VK_CHECK_RESULT(vkCreateImageView(a_device, &viewInfo, nullptr, &views[layer]));
+  }
+  return views;
+}
+
+void SimpleShadowmapRender::DestroyShadowMapViews()
+{
+  VkDevice device = m_context->getDevice();
+  for (VkImageView view : m_shadowMapViews)
+    vkDestroyImageView(device, view, nullptr);
+  for (VkImageView view : m_shadowStaticLayerViews)
+    vkDestroyImageView(device, view, nullptr);
+  m_shadowMapViews.clear();
+  m_shadowStaticLayerViews.clear();
+}
+
+void SimpleShadowmapRender::AllocateShadowMaps()
+{
+  DestroyShadowMapViews();
+
+  gBuffer.shadowMap = m_context->createImage(etna::Image::CreateInfo
+  {
+    .extent = vk::Extent3D{SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, 1},
+    .name = "shadow_map",
+    .format = vk::Format::eD16Unorm,
+    .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled
+                | vk::ImageUsageFlagBits::eTransferDst,
+    .layers = m_shadowCascadesNum
+  });
+  m_shadowMapViews = create_layer_views(m_context->getDevice(), gBuffer.shadowMap.get(), m_shadowCascadesNum);
+
+  if (m_shadowCache.layered)
+  {
+    gBuffer.shadowStaticLayer = m_context->createImage(etna::Image::CreateInfo
+    {
+      .extent = vk::Extent3D{SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, 1},
+      .name = "shadow_static_layer",
+      .format = vk::Format::eD16Unorm,
+      .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+      .layers = m_shadowCascadesNum
+    });
+    m_shadowStaticLayerViews = create_layer_views(m_context->getDevice(), gBuffer.shadowStaticLayer.get(),
+      m_shadowCascadesNum);
+  }
+  else
+    gBuffer.shadowStaticLayer.reset();
+
+  InvalidateShadowCache();
+}
+
+void SimpleShadowmapRender::AllocateShadowDrawLists()
+{
+  // lists of every cascade, so the cascade count can change without reallocating them
+  const uint32_t listsNum = m_framesInFlight * SHADOW_CASCADES_MAX * 2;
+  const VkDeviceSize listSize = std::max(1u, m_pScnMgr->InstanceCapacity()) * sizeof(VkDrawIndexedIndirectCommand);
+  m_shadowLayerDraws = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = listSize * listsNum,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+    .name = "shadow_layer_draws"
+  });
+  m_shadowLayerDrawsMapped = reinterpret_cast<VkDrawIndexedIndirectCommand*>(m_shadowLayerDraws.map());
+
+  m_shadowLayerCounts = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = sizeof(uint32_t) * listsNum,
+    .bufferUsage = vk::BufferUsageFlagBits::eIndirectBuffer,
+    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+    .name = "shadow_layer_counts"
+  });
+  m_shadowLayerCountsMapped = reinterpret_cast<uint32_t*>(m_shadowLayerCounts.map());
+  memset(m_shadowLayerCountsMapped, 0, sizeof(uint32_t) * listsNum);
+}
+
+void SimpleShadowmapRender::InvalidateShadowCache()
+{
+  m_shadowCache.staticDirty  = ~0u;
+  m_shadowCache.dynamicDirty = ~0u;
+}
+
+void SimpleShadowmapRender::SetShadowLayers(bool a_layered)
+{
+  if (a_layered == m_shadowCache.layered)
+    return;
+
+  ETNA_ASSERT(m_context->getDevice().waitIdle() == vk::Result::eSuccess);
+  m_shadowCache.layered = a_layered;
+  AllocateShadowMaps();
+  InvalidateCommandBuffers();
+}
+
+void SimpleShadowmapRender::SetShadowCascadesNum(uint32_t a_cascadesNum)
+{
+  a_cascadesNum = std::clamp(a_cascadesNum, 1u, uint32_t(SHADOW_CASCADES_MAX));
+  if (a_cascadesNum == m_shadowCascadesNum)
+    return;
+
+  ETNA_ASSERT(m_context->getDevice().waitIdle() == vk::Result::eSuccess);
+  m_shadowCascadesNum = a_cascadesNum;
+  AllocateShadowMaps();
+  UpdateShadowCascades();
+  InvalidateCommandBuffers();
+}
+
+void SimpleShadowmapRender::UpdateShadowCascades()
+{
+  const float aspect = float(m_width) / float(m_height);
+  float splits[SHADOW_CASCADES_MAX] = {};
+  FitShadowCascades(m_uniforms.viewInverse, m_cam.fov, aspect, 0.1f, 1000.0f, m_lightMatrix,
+    m_pScnMgr->GetSceneBbox(), m_shadowCascadesNum, SHADOW_CASCADE_SPLIT_LAMBDA, SHADOW_CASCADE_SIZE,
+    m_uniforms.shadowCascadeMatrices, splits);
+  m_uniforms.shadowCascadesNum   = m_shadowCascadesNum;
+  m_uniforms.shadowCascadeSplits = float4(splits[0], splits[1], splits[2], splits[3]);
+}
+
+void SimpleShadowmapRender::UpdateShadowCache()
+{
+  auto& cache = m_shadowCache;
+  // the cascades follow the camera, only the ones whose crop moved are rendered again, both layers of them
+  for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+  {
+    if (memcmp(&cache.cascadeMatrices[cascade], &m_uniforms.shadowCascadeMatrices[cascade], sizeof(float4x4)) != 0)
+    {
+      cache.cascadeMatrices[cascade] = m_uniforms.shadowCascadeMatrices[cascade];
+      cache.staticDirty  |= 1u << cascade;
+      cache.dynamicDirty |= 1u << cascade;
+    }
+  }
+
+  cache.dynamicInstances.resize(m_pScnMgr->InstancesNum(), false);
+  for (uint32_t instId : m_updatedInstances)
+  {
+    // an instance is static until it changes for the first time, then it leaves the static layer for good
+    if (!cache.dynamicInstances[instId])
+    {
+      cache.dynamicInstances[instId] = true;
+      cache.dynamicNum++;
+      cache.staticDirty = ~0u;
+    }
+    cache.dynamicDirty = ~0u;
+  }
+
+  const uint32_t cascadesMask = (1u << m_shadowCascadesNum) - 1;
+  cache.staticDrawMask = cache.layered ? cache.staticDirty & cascadesMask : 0;
+  cache.drawMask       = (cache.staticDirty | cache.dynamicDirty) & cascadesMask;
+  if (cache.drawMask == 0)
+    m_shadowUpdate = ShadowUpdate::NONE;
+  else if (!cache.layered)
+    m_shadowUpdate = ShadowUpdate::FULL;
+  else
+    m_shadowUpdate = cache.staticDrawMask != 0 ? ShadowUpdate::STATIC_AND_DYNAMIC : ShadowUpdate::DYNAMIC;
+
+  if (m_shadowUpdate == ShadowUpdate::NONE || m_shadowUpdate == ShadowUpdate::FULL)
+    return;
+
+  // the layers are drawn from their own lists, the cascade lists of CullScene have all the casters
+  const auto& drawCommands = m_pScnMgr->GetDrawCommands();
+  for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+  {
+    if ((cache.drawMask & (1u << cascade)) == 0)
+      continue;
+    m_frustumCuller.Cull(m_uniforms.shadowCascadeMatrices[cascade], m_visibleInstances);
+
+    const uint32_t firstList = (m_presentationResources.currentFrame * SHADOW_CASCADES_MAX + cascade) * 2;
+    VkDrawIndexedIndirectCommand* lists[2] =
+    {
+      m_shadowLayerDrawsMapped + firstList * m_pScnMgr->InstanceCapacity(),
+      m_shadowLayerDrawsMapped + (firstList + 1) * m_pScnMgr->InstanceCapacity()
+    };
+    uint32_t counts[2] = {};
+    for (uint32_t instId : m_visibleInstances)
+    {
+      if (drawCommands[instId].instanceCount == 0)
+        continue;
+      const uint32_t layer = cache.dynamicInstances[instId] ? 1 : 0;
+      lists[layer][counts[layer]++] = drawCommands[instId];
+    }
+    m_shadowLayerCountsMapped[firstList + 0] = counts[0];
+    m_shadowLayerCountsMapped[firstList + 1] = counts[1];
+  }
+}
+
+void SimpleShadowmapRender::FinishShadowFrame()
+{
+  if (m_shadowUpdate == ShadowUpdate::NONE)
+  {
+    m_shadowCache.reused++;
+    return;
+  }
+
+  // frames after this one are executed after it on the same queue and read what it rendered
+  m_shadowCache.rendered++;
+  m_shadowCache.cascadesRendered += uint32_t(std::popcount(m_shadowCache.drawMask));
+  m_shadowCache.staticDirty  &= ~m_shadowCache.drawMask;
+  m_shadowCache.dynamicDirty &= ~m_shadowCache.drawMask;
+}
+
+SimpleShadowmapRender::CulledDraws SimpleShadowmapRender::GetShadowLayerDraws(uint32_t a_cascade, uint32_t a_layer) const
+{
+  const uint32_t listIdx = (m_presentationResources.currentFrame * SHADOW_CASCADES_MAX + a_cascade) * 2 + a_layer;
+  return CulledDraws
+  {
+    .buffer      = m_shadowLayerDraws.get(),
+    .offset      = VkDeviceSize(listIdx) * m_pScnMgr->InstanceCapacity() * sizeof(VkDrawIndexedIndirectCommand),
+    .count       = m_pScnMgr->InstanceCapacity(),
+    .countBuffer = m_shadowLayerCounts.get(),
+    .countOffset = VkDeviceSize(listIdx) * sizeof(uint32_t)
+  };
+}
+
+void SimpleShadowmapRender::DrawShadowCasters(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants,
+  uint32_t a_cascade, etna::RenderTargetState::AttachmentParams a_depthTarget, const CulledDraws& a_draws)
+{
+  auto shadowInfo = etna::get_shader_program("shadowmap_producer");
+  VkDescriptorSet vkSet = CreateDescriptorSet(shadowInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  {
+    etna::Binding {0, a_frameConstants},
+    etna::Binding {1, m_pScnMgr->GetInstanceMatricesBuffer().genBinding()}
+  });
+
+  etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE}, {}, a_depthTarget);
+
+  vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipeline.getVkPipeline());
+  vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
+    m_shadowPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+  DrawSceneCmd(a_cmdBuff, a_cascade + 1, m_shadowPipeline.getVkPipelineLayout(), a_draws);
+}
+
+void SimpleShadowmapRender::RecordShadowCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants)
+{
+  if (m_shadowUpdate == ShadowUpdate::NONE)
+    return;
+
+  if (m_shadowUpdate == ShadowUpdate::FULL)
+  {
+    m_pGpuProfiler->BeginScope(a_cmdBuff, "Shadow map");
+    for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+      if (m_shadowCache.drawMask & (1u << cascade))
+        DrawShadowCasters(a_cmdBuff, a_frameConstants, cascade,
+          {gBuffer.shadowMap.get(), m_shadowMapViews[cascade]}, GetCulledDraws(1 + cascade));
+    m_pGpuProfiler->EndScope(a_cmdBuff);
+    return;
+  }
+
+  if (m_shadowUpdate == ShadowUpdate::STATIC_AND_DYNAMIC)
+  {
+    m_pGpuProfiler->BeginScope(a_cmdBuff, "Shadow static layer");
+    for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+      if (m_shadowCache.staticDrawMask & (1u << cascade))
+        DrawShadowCasters(a_cmdBuff, a_frameConstants, cascade,
+          {gBuffer.shadowStaticLayer.get(), m_shadowStaticLayerViews[cascade]}, GetShadowLayerDraws(cascade, 0));
+    m_pGpuProfiler->EndScope(a_cmdBuff);
+  }
+
+  //// dynamic casters on top of a copy of the static layer
+  //
+  m_pGpuProfiler->BeginScope(a_cmdBuff, "Shadow dynamic layer");
+  {
+    const vk::ImageSubresourceRange depthRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, m_shadowCascadesNum);
+    etna::set_state(a_cmdBuff, gBuffer.shadowStaticLayer.get(), vk::PipelineStageFlagBits2::eCopy,
+      vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eTransferSrcOptimal, depthRange);
+    etna::set_state(a_cmdBuff, gBuffer.shadowMap.get(), vk::PipelineStageFlagBits2::eCopy,
+      vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal, depthRange);
+    etna::flush_barriers(a_cmdBuff);
+
+    // the layers of the other cascades keep both their static and dynamic casters
+    std::vector<VkImageCopy> copies;
+    for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+    {
+      if ((m_shadowCache.drawMask & (1u << cascade)) == 0)
+        continue;
+      VkImageCopy copy = {};
+      copy.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, cascade, 1};
+      copy.dstSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, cascade, 1};
+      copy.extent         = {SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, 1};
+      copies.push_back(copy);
+    }
+    vkCmdCopyImage(a_cmdBuff, gBuffer.shadowStaticLayer.get(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      gBuffer.shadowMap.get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(copies.size()), copies.data());
+
+    for (uint32_t cascade = 0; cascade < m_shadowCascadesNum; ++cascade)
+      if (m_shadowCache.drawMask & (1u << cascade))
+        DrawShadowCasters(a_cmdBuff, a_frameConstants, cascade,
+          {gBuffer.shadowMap.get(), m_shadowMapViews[cascade], false}, GetShadowLayerDraws(cascade, 1));
+  }
+  m_pGpuProfiler->EndScope(a_cmdBuff);
+}
@@ -1,4 +1,5 @@
 #include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <random>
 
@@ -14,6 +15,9 @@
 #include "object.h"
 #include "shadowmap_render.h"
 
+// Projected bounding sphere diameter in pixels below which LOD i + 1 is used instead of LOD i
+static constexpr float TRANSPARENCY_LOD_SCREEN_SIZES[] = {384.f, 192.f, 96.f};
+
 static float get_random_float()
 {
   static std::random_device dev;
@@ -26,88 +30,21 @@ static float get_random_float()
 
 void SimpleShadowmapRender::AllocateResources()
 {
-  gBuffer.mainViewDepth = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "main_view_depth",
-    .format = vk::Format::eD32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment
-  });
+  AllocateShadowMaps();
 
-  gBuffer.shadowMap = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{2048, 2048, 1},
-    .name = "shadow_map",
-    .format = vk::Format::eD16Unorm,
-    .imageUsage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled
-  });
+  UpdateSsaoExtent();
 
-  gBuffer.position = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "gbuffer_position",
-    .format = vk::Format::eR32G32B32A32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage
-  });
+  AllocateDepthPyramid();
 
-  gBuffer.normal = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "gbuffer_normal",
-    .format = vk::Format::eR32G32B32A32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled
-  });
-
-  gBuffer.albedo = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "gbuffer_albedo",
-    .format = vk::Format::eR8G8B8A8Srgb,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled
-  });
-
-  gBuffer.ssao = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "ssao_tex",
-    .format = vk::Format::eR32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage
-  });
-
-  gBuffer.blurredSsao = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "blurred_ssao_tex",
-    .format = vk::Format::eR32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage
-  });
-
-  frameBeforeTransparency = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "frame_before_transparency",
-    .format = vk::Format::eR32G32B32A32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled
-  });
-
-  frameTransparencyOnly = m_context->createImage(etna::Image::CreateInfo
-  {
-    .extent = vk::Extent3D{m_width, m_height, 1},
-    .name = "frame_before_transparency",
-    .format = vk::Format::eR32G32B32A32Sfloat,
-    .imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled
-  });
+  // the images that only live within a frame are allocated when the first frame graph is compiled
+  m_pFrameGraph = std::make_unique<FrameGraph>();
+  m_frameGraphVersion = 0;
 
   defaultSampler = etna::Sampler(etna::Sampler::CreateInfo{.name = "default_sampler"});
-  constants = m_context->createBuffer(etna::Buffer::CreateInfo
-  {
-    .size = sizeof(UniformParams),
-    .bufferUsage = vk::BufferUsageFlagBits::eUniformBuffer,
-    .memoryUsage = VMA_MEMORY_USAGE_CPU_ONLY,
-    .name = "constants"
-  });
-
-  m_uboMappedMem = constants.map();
+  // uniforms and culling parameters of a frame are written while the previous one may still read its own
+  const auto& limits = m_context->getPhysicalDevice().getProperties().limits;
+  m_pFrameAllocator = std::make_unique<FrameAllocator>(64 * 1024, m_framesInFlight,
+    std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment));
 
   ssaoSamples = m_context->createBuffer(etna::Buffer::CreateInfo
   {
@@ -142,32 +79,24 @@ void SimpleShadowmapRender::AllocateResources()
   memcpy(ssaoNoiseMappedMem, ssaoNoiseVec.data(), m_uniforms.ssaoNoiseSize*m_uniforms.ssaoNoiseSize*sizeof(float4));
   ssaoNoise.unmap();
 
-  m_gaussian_kernel.resize(m_gaussian_kernel_length);
-  float kernel_radius = (static_cast<float>(m_gaussian_kernel_length) - 1.f) / 2.f;
-  float sigma = kernel_radius / 3.f;
-  float doubled_sigma2 = 2.f * sigma * sigma;
-  float sum = 0.f;
-
-  for (uint32_t i = 0; i < m_gaussian_kernel_length; i++) {
-    float delta = float(i) - kernel_radius;
-    m_gaussian_kernel[i] = std::exp(- delta * delta / doubled_sigma2);
-    sum += m_gaussian_kernel[i];
-  }  
-  for (uint32_t i = 0; i < m_gaussian_kernel_length; i++) {
-    m_gaussian_kernel[i] /= sum;
-  }
-
-  gaussianKernel = m_context->createBuffer(etna::Buffer::CreateInfo
+  m_ssaoTileStats = m_context->createBuffer(etna::Buffer::CreateInfo
   {
-    .size = sizeof(float) * m_gaussian_kernel_length,
-    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer,
-    .memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU,
-    .name = "gaussian_kernel"
+    .size        = SSAO_TILE_STATS_STRIDE * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eStorageBuffer
+                 | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY,
+    .name = "ssao_tile_stats"
   });
 
-  void *gaussianKernelMappedMem = gaussianKernel.map();
-  memcpy(gaussianKernelMappedMem, m_gaussian_kernel.data(), sizeof(float) * m_gaussian_kernel_length);
-  gaussianKernel.unmap();
+  m_ssaoTileStatsReadback = m_context->createBuffer(etna::Buffer::CreateInfo
+  {
+    .size        = 2 * sizeof(uint32_t) * m_framesInFlight,
+    .bufferUsage = vk::BufferUsageFlagBits::eTransferDst,
+    .memoryUsage = VMA_MEMORY_USAGE_GPU_TO_CPU,
+    .name = "ssao_tile_stats_readback"
+  });
+  m_ssaoTileStatsMapped = reinterpret_cast<uint32_t*>(m_ssaoTileStatsReadback.map());
+  memset(m_ssaoTileStatsMapped, 0, 2 * sizeof(uint32_t) * m_framesInFlight);
 }
 
 void SimpleShadowmapRender::loadBackgroundTexture()
@@ -175,13 +104,13 @@ void SimpleShadowmapRender::loadBackgroundTexture()
   int width, height, channels;
   uint8_t* pixels = loadImageLDR(VK_GRAPHICS_BASIC_ROOT"/resources/textures/shrek.jpg", width, height, channels);
 
-  backgroundTexture = etna::create_image_from_bytes(etna::Image::CreateInfo
+  backgroundTexture = m_pUploads->CreateImageFromBytes(etna::Image::CreateInfo
   {
     .extent = vk::Extent3D{static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1},
     .name = "shrek",
     .format = vk::Format::eR8G8B8A8Unorm,
     .imageUsage = vk::ImageUsageFlagBits::eSampled
-  }, m_textureCmdBuffer, pixels);
+  }, pixels);
 
   freeImageMemLDR(pixels);
 }
@@ -207,7 +136,7 @@ void SimpleShadowmapRender::loadEnvironmentMap()
   for (int i = 0; i < FACES_NUM; ++i)
     memcpy((uint8_t *)bytes + i * imageSize, (void *)pixels[i], imageSize);
 
-  environmentMap = etna::create_image_from_bytes(etna::Image::CreateInfo
+  environmentMap = m_pUploads->CreateImageFromBytes(etna::Image::CreateInfo
   {
     .extent = vk::Extent3D{static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1},
     .name = "skybox",
@@ -215,7 +144,7 @@ void SimpleShadowmapRender::loadEnvironmentMap()
     .format = vk::Format::eR8G8B8A8Unorm,
     .imageUsage = vk::ImageUsageFlagBits::eSampled,
     .layers = FACES_NUM,
-  }, m_textureCmdBuffer, bytes);
+  }, bytes);
 
   for (int i = 0; i < FACES_NUM; ++i)
     freeImageMemLDR(pixels[i]);
@@ -225,13 +154,22 @@ void SimpleShadowmapRender::loadEnvironmentMap()
 void SimpleShadowmapRender::LoadScene(const char* path, bool transpose_inst_matrices)
 {
   m_pScnMgr->LoadSceneXML(path, transpose_inst_matrices);
+  AllocateCullingResources();
+  m_sceneBvh.Build(*m_pScnMgr);
   // loadBackgroundTexture();
   loadEnvironmentMap();
+  // textures are copied while the transparency meshes are built
+  m_pUploads->Flush();
   makeAssets();
   transparencyScene = std::make_unique<TransparencyScene>();
 
   // TODO: Make a separate stage
   loadShaders();
+  m_pBilateralBlur = std::make_unique<BilateralBlur>(m_context->getDevice(),
+    [this](etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff, std::vector<etna::Binding> a_bindings)
+    {
+      return CreateDescriptorSet(a_layoutId, a_cmdBuff, std::move(a_bindings));
+    });
   PreparePipelines();
 
   auto loadedCam = m_pScnMgr->GetCamera(0);
@@ -244,22 +182,20 @@ void SimpleShadowmapRender::LoadScene(const char* path, bool transpose_inst_matr
 
 void SimpleShadowmapRender::DeallocateResources()
 {
-  gBuffer.mainViewDepth.reset(); // TODO: Make an etna method to reset all the resources
+  m_pFrameGraph.reset(); // TODO: Make an etna method to reset all the resources
+  DestroyShadowMapViews();
   gBuffer.shadowMap.reset();
-  gBuffer.position.reset();
-  gBuffer.normal.reset();
-  gBuffer.albedo.reset();
-  gBuffer.ssao.reset();
-  gBuffer.blurredSsao.reset();
-  frameBeforeTransparency.reset();
-  frameTransparencyOnly.reset();
+  gBuffer.shadowStaticLayer.reset();
+  m_depthPyramid.reset();
   m_swapchain.Cleanup();
   vkDestroySurfaceKHR(GetVkInstance(), m_surface, nullptr);  
 
-  constants = etna::Buffer();
+  m_pFrameAllocator.reset();
   ssaoSamples = etna::Buffer();
   ssaoNoise = etna::Buffer();
-  gaussianKernel = etna::Buffer();
+  m_ssaoTileStatsMapped = nullptr;
+  m_ssaoTileStatsReadback = etna::Buffer();
+  m_ssaoTileStats = etna::Buffer();
 }
 
 
@@ -271,6 +207,7 @@ void SimpleShadowmapRender::DeallocateResources()
 void SimpleShadowmapRender::PreparePipelines()
 {
   SetupSimplePipeline();
+  InvalidateCommandBuffers();
 }
 
 void SimpleShadowmapRender::loadShaders()
@@ -278,15 +215,15 @@ void SimpleShadowmapRender::loadShaders()
   etna::create_program("shadowmap_producer", {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/render_scene.vert.spv"});
   etna::create_program("prepare_gbuffer",
     {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/prepare_gbuffer.frag.spv", VK_GRAPHICS_BASIC_ROOT"/resources/shaders/render_scene.vert.spv"});
-  etna::create_program("calculate_ssao",
-    { VK_GRAPHICS_BASIC_ROOT"/resources/shaders/ssao.frag.spv", VK_GRAPHICS_BASIC_ROOT "/resources/shaders/fullscreen_quad.vert.spv" });
-  etna::create_program("gaussian_blur", {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/gaussian_blur.comp.spv"});
+  etna::create_program("calculate_ssao", {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/ssao.comp.spv"});
+  etna::create_program("ssao_upsample",
+    { VK_GRAPHICS_BASIC_ROOT"/resources/shaders/ssao_upsample.frag.spv", VK_GRAPHICS_BASIC_ROOT "/resources/shaders/fullscreen_quad.vert.spv" });
   etna::create_program("resolve_gbuffer",
     {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/resolve_gbuffer.frag.spv", VK_GRAPHICS_BASIC_ROOT"/resources/shaders/resolve_gbuffer.vert.spv"});
   etna::create_program("screen_space_transparency",
     {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/transparency.frag.spv", VK_GRAPHICS_BASIC_ROOT"/resources/shaders/transparency.vert.spv"});
-  etna::create_program("resolve_transparency",
-    {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/resolve_transparency.frag.spv", VK_GRAPHICS_BASIC_ROOT"/resources/shaders/resolve_transparency.vert.spv"});
+  etna::create_program("cull_instances", {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/cull_instances.comp.spv"});
+  etna::create_program("depth_pyramid", {VK_GRAPHICS_BASIC_ROOT"/resources/shaders/depth_pyramid.comp.spv"});
 }
 
 void SimpleShadowmapRender::SetupSimplePipeline()
@@ -330,11 +267,11 @@ void SimpleShadowmapRender::SetupSimplePipeline()
       .vertexShaderInput = sceneVertexInputDesc,
       .blendingConfig =
         {
-          .attachments = {blendAttachment, blendAttachment, blendAttachment}
+          .attachments = {blendAttachment, blendAttachment}
         },
       .fragmentShaderOutput =
         {
-          .colorAttachmentFormats = {vk::Format::eR32G32B32A32Sfloat, vk::Format::eR32G32B32A32Sfloat, vk::Format::eR8G8B8A8Srgb},
+          .colorAttachmentFormats = {vk::Format::eR16G16Snorm, vk::Format::eR8G8B8A8Srgb},
           .depthAttachmentFormat = vk::Format::eD32Sfloat
         }
     });
@@ -342,32 +279,26 @@ void SimpleShadowmapRender::SetupSimplePipeline()
     {
       .fragmentShaderOutput =
         {
-          .colorAttachmentFormats = { vk::Format::eR32G32B32A32Sfloat },
+          .colorAttachmentFormats = { GetColorTargetFormat() },
         }
     });
-  m_ssaoPipeline = pipelineManager.createGraphicsPipeline("calculate_ssao",
+  m_ssaoPipeline = pipelineManager.createComputePipeline("calculate_ssao", {});
+  m_ssaoUpsamplePipeline = pipelineManager.createGraphicsPipeline("ssao_upsample",
     {
       .fragmentShaderOutput =
         {
           .colorAttachmentFormats = {vk::Format::eR32Sfloat},
         }
     });
-  m_gaussianBlurPipeline = pipelineManager.createComputePipeline("gaussian_blur", {});
+  m_cullInstancesPipeline = pipelineManager.createComputePipeline("cull_instances", {});
+  m_depthPyramidPipeline = pipelineManager.createComputePipeline("depth_pyramid", {});
   m_screenSpaceTransparencyPipeline = pipelineManager.createGraphicsPipeline("screen_space_transparency",
-    {
-      .vertexShaderInput = transparencyVertexInputDesc,
-      .fragmentShaderOutput =
-        {
-          .colorAttachmentFormats = { vk::Format::eR32G32B32A32Sfloat },
-          .depthAttachmentFormat = vk::Format::eD32Sfloat
-        }
-    });
-  m_resolveTransparencyPipeline = pipelineManager.createGraphicsPipeline("resolve_transparency",
     {
       .vertexShaderInput = transparencyVertexInputDesc,
       .fragmentShaderOutput =
         {
           .colorAttachmentFormats = { static_cast<vk::Format>(m_swapchain.GetFormat()) },
+          .depthAttachmentFormat = vk::Format::eD32Sfloat
         }
     });
 }
@@ -375,8 +306,16 @@ void SimpleShadowmapRender::SetupSimplePipeline()
 
 /// COMMAND BUFFER FILLING
 
-void SimpleShadowmapRender::DrawSceneCmd(VkCommandBuffer a_cmdBuff, const float4x4& a_wvp, VkPipelineLayout a_pipelineLayout,
-  VkShaderStageFlags stageFlags)
+VkDescriptorSet SimpleShadowmapRender::CreateDescriptorSet(etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff,
+  std::vector<etna::Binding> a_bindings)
+{
+  if (m_recordingReusable)
+    return m_pPersistentSets->Create(a_layoutId, a_cmdBuff, std::move(a_bindings));
+  return etna::create_descriptor_set(a_layoutId, a_cmdBuff, std::move(a_bindings)).getVkSet();
+}
+
+void SimpleShadowmapRender::DrawSceneCmd(VkCommandBuffer a_cmdBuff, uint32_t a_lightMatrixIdx, VkPipelineLayout a_pipelineLayout,
+  const CulledDraws& a_draws)
 {
   VkDeviceSize zero_offset = 0u;
   VkBuffer vertexBuf = m_pScnMgr->GetVertexBuffer();
@@ -385,180 +324,298 @@ void SimpleShadowmapRender::DrawSceneCmd(VkCommandBuffer a_cmdBuff, const float4
   vkCmdBindVertexBuffers(a_cmdBuff, 0, 1, &vertexBuf, &zero_offset);
   vkCmdBindIndexBuffer(a_cmdBuff, indexBuf, 0, VK_INDEX_TYPE_UINT32);
 
-  pushConst2M.projView = a_wvp;
-  for (uint32_t i = 0; i < m_pScnMgr->InstancesNum(); ++i)
-  {
-    auto inst         = m_pScnMgr->GetInstanceInfo(i);
-    pushConst2M.model = m_pScnMgr->GetInstanceMatrix(i);
-    pushConst2M.colorNo = i;
-    vkCmdPushConstants(a_cmdBuff, a_pipelineLayout,
-      stageFlags, 0, sizeof(pushConst2M), &pushConst2M);
-
-    auto mesh_info = m_pScnMgr->GetMeshInfo(inst.mesh_id);
-    vkCmdDrawIndexed(a_cmdBuff, mesh_info.m_indNum, 1, mesh_info.m_indexOffset, mesh_info.m_vertexOffset, 0);
-  }
+  pushConst.lightMatrixIdx = a_lightMatrixIdx;
+  vkCmdPushConstants(a_cmdBuff, a_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConst), &pushConst);
+
+  // the number of visible instances is only known when the frame is culled, after the commands may have been recorded
+  m_vkCmdDrawIndexedIndirectCountKHR(a_cmdBuff, a_draws.buffer, a_draws.offset, a_draws.countBuffer, a_draws.countOffset,
+    std::min(a_draws.count, m_maxDrawIndirectCount), sizeof(VkDrawIndexedIndirectCommand));
 }
 
-void SimpleShadowmapRender::BuildCommandBufferSimple(VkCommandBuffer a_cmdBuff, VkImage a_targetImage, VkImageView a_targetImageView)
+void SimpleShadowmapRender::SetupFrameGraph()
 {
-  vkResetCommandBuffer(a_cmdBuff, 0);
-
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-  VK_CHECK_RESULT(vkBeginCommandBuffer(a_cmdBuff, &beginInfo));
-
-  //// draw scene to shadowmap
+  FrameGraph& graph = *m_pFrameGraph;
+  graph.Reset();
+
+  const vk::Extent3D fullExtent{m_width, m_height, 1};
+  const vk::Extent3D ssaoExtent{m_ssaoExtent.width, m_ssaoExtent.height, 1};
+  gBuffer.mainViewDepth   = graph.CreateImage("main_view_depth", {fullExtent, vk::Format::eD32Sfloat});
+  gBuffer.normal          = graph.CreateImage("gbuffer_normal", {fullExtent, vk::Format::eR16G16Snorm});
+  gBuffer.albedo          = graph.CreateImage("gbuffer_albedo", {fullExtent, vk::Format::eR8G8B8A8Srgb});
+  gBuffer.ssao            = graph.CreateImage("ssao_tex", {ssaoExtent, vk::Format::eR32Sfloat});
+  gBuffer.ssaoTemp        = graph.CreateImage("ssao_blur_tex", {ssaoExtent, vk::Format::eR32Sfloat});
+  gBuffer.upsampledSsao   = graph.CreateImage("upsampled_ssao_tex", {fullExtent, vk::Format::eR32Sfloat});
+  frameBeforeTransparency = graph.CreateImage("frame_before_transparency", {fullExtent, GetColorTargetFormat()});
+
+  const FrameGraph::ImageId shadowMap = graph.ImportImage("shadow_map", gBuffer.shadowMap,
+    {{SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, 1}, vk::Format::eD16Unorm, m_shadowCascadesNum});
+  const FrameGraph::ImageId shadowStaticLayer = m_shadowCache.layered
+    ? graph.ImportImage("shadow_static_layer", gBuffer.shadowStaticLayer,
+        {{SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, 1}, vk::Format::eD16Unorm, m_shadowCascadesNum})
+    : FrameGraph::INVALID_IMAGE;
+  const FrameGraph::ImageId depthPyramid = graph.ImportImage("depth_pyramid", m_depthPyramid,
+    {{m_depthPyramidExtent.width, m_depthPyramidExtent.height, 1}, vk::Format::eR32Sfloat, 1, m_depthPyramidMips});
+
+  // command buffers belong to a frame in flight, the uniforms are at the same offset of its segment every frame
+  auto frameConstants = [this]() { return m_pFrameAllocator->genBinding(m_uniformsAlloc); };
+
+  //// cull instances for the light and main view
   //
+  if (m_cullingMode == CullingMode::GPU)
   {
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, 2048, 2048}, {}, gBuffer.shadowMap);
-
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_shadowPipeline.getVkPipeline());
-    DrawSceneCmd(a_cmdBuff, m_lightMatrix, m_shadowPipeline.getVkPipelineLayout());
+    graph.AddPass("Culling",
+      [&](FrameGraph::PassBuilder& pass)
+      {
+        pass.Read(depthPyramid, FrameGraph::Usage::SAMPLED_COMPUTE); // of the previous frame
+        pass.SideEffect(); // draw lists
+      },
+      [this](VkCommandBuffer a_cmdBuff)
+      {
+        m_pGpuProfiler->BeginScope(a_cmdBuff, "Culling");
+        CullSceneGpuCmd(a_cmdBuff);
+        m_pGpuProfiler->EndScope(a_cmdBuff);
+      });
   }
 
-  //// prepare gbuffer
+  //// draw scene to shadowmap, unless the cached one is still valid
   //
+  // with the overlap it goes after the compute work it doesn't depend on, nothing in between waits for the SSAO
+  // dispatches since none of the images it touches is one of theirs
+  auto addShadowPass = [&]()
   {
-    auto prepareGbufferInfo = etna::get_shader_program("prepare_gbuffer");
-    auto set = etna::create_descriptor_set(prepareGbufferInfo.getDescriptorLayoutId(0), a_cmdBuff,
-    {
-      etna::Binding {0, constants.genBinding()}
-    });
-
-    VkDescriptorSet vkSet = set.getVkSet();
-
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {{gBuffer.position}, {gBuffer.normal}, {gBuffer.albedo}}, gBuffer.mainViewDepth);
-
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_prepareGbufferPipeline.getVkPipeline());
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
-      m_prepareGbufferPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
-
-    DrawSceneCmd(a_cmdBuff, m_worldViewProj, m_prepareGbufferPipeline.getVkPipelineLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-  }
+    if (m_shadowUpdate == ShadowUpdate::NONE)
+      return;
+    graph.AddPass("Shadow map",
+      [&](FrameGraph::PassBuilder& pass)
+      {
+        // see RecordShadowCmd: the dynamic casters are drawn on top of a copy of the static layer
+        if (m_shadowUpdate == ShadowUpdate::STATIC_AND_DYNAMIC)
+          pass.Write(shadowStaticLayer, FrameGraph::Usage::DEPTH_ATTACHMENT);
+        if (m_shadowUpdate != ShadowUpdate::FULL)
+        {
+          pass.Read(shadowStaticLayer, FrameGraph::Usage::TRANSFER_SRC);
+          pass.Write(shadowMap, FrameGraph::Usage::TRANSFER_DST);
+        }
+        pass.Write(shadowMap, FrameGraph::Usage::DEPTH_ATTACHMENT);
+      },
+      [this, frameConstants](VkCommandBuffer a_cmdBuff) { RecordShadowCmd(a_cmdBuff, frameConstants()); });
+  };
+  if (!m_overlapSsaoWithShadows)
+    addShadowPass();
 
-  //// calculate SSAO
+  //// prepare gbuffer
   //
-  {
-    auto ssaoInfo = etna::get_shader_program("calculate_ssao");
-    auto set = etna::create_descriptor_set(ssaoInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  graph.AddPass("G-buffer",
+    [&](FrameGraph::PassBuilder& pass)
+    {
+      pass.Write(gBuffer.mainViewDepth, FrameGraph::Usage::DEPTH_ATTACHMENT);
+      pass.Write(gBuffer.normal, FrameGraph::Usage::COLOR_ATTACHMENT);
+      pass.Write(gBuffer.albedo, FrameGraph::Usage::COLOR_ATTACHMENT);
+    },
+    [this, frameConstants](VkCommandBuffer a_cmdBuff)
     {
-      etna::Binding {0, constants.genBinding()},
-      etna::Binding {1, gBuffer.position.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {2, gBuffer.normal.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {3, ssaoSamples.genBinding()},
-      etna::Binding {4, ssaoNoise.genBinding()}
+      m_pGpuProfiler->BeginScope(a_cmdBuff, "G-buffer");
+      auto prepareGbufferInfo = etna::get_shader_program("prepare_gbuffer");
+      VkDescriptorSet vkSet = CreateDescriptorSet(prepareGbufferInfo.getDescriptorLayoutId(0), a_cmdBuff,
+      {
+        etna::Binding {0, frameConstants()},
+        etna::Binding {1, m_pScnMgr->GetInstanceMatricesBuffer().genBinding()}
+      });
+
+      {
+        etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height},
+          {{GetImage(gBuffer.normal)}, {GetImage(gBuffer.albedo)}}, GetImage(gBuffer.mainViewDepth));
+
+        vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_prepareGbufferPipeline.getVkPipeline());
+        vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
+          m_prepareGbufferPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+        DrawSceneCmd(a_cmdBuff, 0, m_prepareGbufferPipeline.getVkPipelineLayout(), GetCulledDraws(0));
+      }
+      m_pGpuProfiler->EndScope(a_cmdBuff);
     });
 
-    VkDescriptorSet vkSet = set.getVkSet();
-
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {{gBuffer.ssao}}, {});
-
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ssaoPipeline.getVkPipeline());
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
-      m_ssaoPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
-
-    vkCmdDraw(a_cmdBuff, 6, 1, 0, 0); // 6 vertices for 2 triangles in a quad
+  //// build depth pyramid for the next frame occlusion culling
+  //
+  if (m_cullingMode == CullingMode::GPU && m_occlusionCulling)
+  {
+    graph.AddPass("Depth pyramid",
+      [&](FrameGraph::PassBuilder& pass)
+      {
+        pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::SAMPLED_COMPUTE);
+        pass.Write(depthPyramid, FrameGraph::Usage::STORAGE_COMPUTE);
+      },
+      [this](VkCommandBuffer a_cmdBuff) { BuildDepthPyramidCmd(a_cmdBuff); });
   }
 
-  //// blur SSAO texture
+  //// calculate SSAO
   //
-  if (m_uniforms.ssaoEnabled)
-  {
-    auto gaussianBlurInfo = etna::get_shader_program("gaussian_blur");
-    auto set = etna::create_descriptor_set(gaussianBlurInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  // always declared, the graph drops these passes and their images when the resolve doesn't read the result
+  graph.AddPass("SSAO",
+    [&](FrameGraph::PassBuilder& pass)
     {
-      etna::Binding {0, gBuffer.ssao.genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral)},
-      etna::Binding {1, gBuffer.blurredSsao.genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral)},
-      etna::Binding {2, gBuffer.position.genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral)},
-      etna::Binding {3, gaussianKernel.genBinding()},
-    });
-    VkDescriptorSet vkSet = set.getVkSet();
-    etna::flush_barriers(a_cmdBuff);
-
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE,
-      m_gaussianBlurPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_gaussianBlurPipeline.getVkPipeline());
-    vkCmdDispatch(a_cmdBuff, m_width / 32 + 1, m_height / 32 + 1, 1);
+      pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::SAMPLED_COMPUTE);
+      pass.Read(gBuffer.normal, FrameGraph::Usage::SAMPLED_COMPUTE);
+      pass.Write(gBuffer.ssao, FrameGraph::Usage::STORAGE_COMPUTE);
+    },
+    [this, frameConstants](VkCommandBuffer a_cmdBuff) { RecordSsaoCmd(a_cmdBuff, frameConstants()); });
+
+  graph.AddPass("SSAO blur",
+    [&](FrameGraph::PassBuilder& pass)
+    {
+      pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::SAMPLED_COMPUTE);
+      pass.Read(gBuffer.ssao, FrameGraph::Usage::SAMPLED_COMPUTE);
+      pass.Write(gBuffer.ssao, FrameGraph::Usage::STORAGE_COMPUTE); // the second direction writes it back
+      pass.Write(gBuffer.ssaoTemp, FrameGraph::Usage::STORAGE_COMPUTE);
+      pass.Read(gBuffer.ssaoTemp, FrameGraph::Usage::SAMPLED_COMPUTE); // by the second direction
+    },
+    [this](VkCommandBuffer a_cmdBuff) { RecordSsaoBlurCmd(a_cmdBuff); });
+
+  if (m_overlapSsaoWithShadows)
+    addShadowPass();
+
+  if (m_ssaoResolution != SsaoResolution::FULL)
+  {
+    graph.AddPass("SSAO upsample",
+      [&](FrameGraph::PassBuilder& pass)
+      {
+        pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::SAMPLED_FRAGMENT);
+        pass.Read(gBuffer.ssao, FrameGraph::Usage::SAMPLED_FRAGMENT);
+        pass.Write(gBuffer.upsampledSsao, FrameGraph::Usage::COLOR_ATTACHMENT);
+      },
+      [this, frameConstants](VkCommandBuffer a_cmdBuff) { RecordSsaoUpsampleCmd(a_cmdBuff, frameConstants()); });
   }
 
   //// resolve gbuffer
   //
-  {
-    auto resolveGbufferInfo = etna::get_shader_program("resolve_gbuffer");
-    auto set = etna::create_descriptor_set(resolveGbufferInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  graph.AddPass("Resolve",
+    [&](FrameGraph::PassBuilder& pass)
+    {
+      pass.Read(shadowMap, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Read(gBuffer.normal, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Read(gBuffer.albedo, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      if (m_uniforms.ssaoEnabled)
+        pass.Read(GetSsaoResult(), FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Write(frameBeforeTransparency, FrameGraph::Usage::COLOR_ATTACHMENT);
+    },
+    [this, frameConstants](VkCommandBuffer a_cmdBuff)
     {
-      etna::Binding {0, constants.genBinding()},
-      etna::Binding {1, gBuffer.shadowMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {2, gBuffer.position.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {3, gBuffer.normal.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {4, gBuffer.albedo.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {5, gBuffer.blurredSsao.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      // etna::Binding {6, backgroundTexture.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 1, vk::ImageViewType::e2D})},
-      etna::Binding {7, environmentMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 6, vk::ImageViewType::eCube})},
+      m_pGpuProfiler->BeginScope(a_cmdBuff, "Resolve");
+      // without SSAO the shader doesn't sample binding 5, any image of the right kind keeps the set complete
+      const etna::Image& ssao = GetImage(m_uniforms.ssaoEnabled ? GetSsaoResult() : gBuffer.normal);
+      auto resolveGbufferInfo = etna::get_shader_program("resolve_gbuffer");
+      VkDescriptorSet vkSet = CreateDescriptorSet(resolveGbufferInfo.getDescriptorLayoutId(0), a_cmdBuff,
+      {
+        etna::Binding {0, frameConstants()},
+        etna::Binding {1, gBuffer.shadowMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal,
+          {0, 1, m_shadowCascadesNum, vk::ImageViewType::e2DArray})},
+        etna::Binding {2, GetImage(gBuffer.mainViewDepth).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        etna::Binding {3, GetImage(gBuffer.normal).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        etna::Binding {4, GetImage(gBuffer.albedo).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        etna::Binding {5, ssao.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        // etna::Binding {6, backgroundTexture.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 1, vk::ImageViewType::e2D})},
+        etna::Binding {7, environmentMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 6, vk::ImageViewType::eCube})},
+      });
+
+      {
+        etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {GetImage(frameBeforeTransparency)}, {});
+
+        vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolveGbufferPipeline.getVkPipeline());
+        vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
+          m_resolveGbufferPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+        vkCmdDraw(a_cmdBuff, 6, 1, 0, 0); // 6 vertices for 2 triangles in a quad
+      }
+      m_pGpuProfiler->EndScope(a_cmdBuff);
     });
-    VkDescriptorSet vkSet = set.getVkSet();
-
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {frameBeforeTransparency}, {});
 
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolveGbufferPipeline.getVkPipeline());
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
-      m_resolveGbufferPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
-
-    vkCmdDraw(a_cmdBuff, 6, 1, 0, 0); // 6 vertices for 2 triangles in a quad
-  }
-
-  //// render transparency
+  //// copy the opaque frame to the target and render transparency on top of it
   //
-  {
-    auto screenSpaceTransparencyInfo = etna::get_shader_program("screen_space_transparency");
-    auto set = etna::create_descriptor_set(screenSpaceTransparencyInfo.getDescriptorLayoutId(0), a_cmdBuff,
+  graph.AddPass("Transparency",
+    [&](FrameGraph::PassBuilder& pass)
     {
-      etna::Binding {0, constants.genBinding()},
-      etna::Binding {1, frameBeforeTransparency.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {2, gBuffer.position.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {3, gBuffer.albedo.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {4, environmentMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 6, vk::ImageViewType::eCube})},
+      pass.Read(frameBeforeTransparency, FrameGraph::Usage::TRANSFER_SRC);
+      pass.Read(frameBeforeTransparency, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Read(gBuffer.albedo, FrameGraph::Usage::SAMPLED_FRAGMENT);
+      pass.Read(gBuffer.mainViewDepth, FrameGraph::Usage::DEPTH_ATTACHMENT);
+      pass.SideEffect(); // the target image
+    },
+    [this, frameConstants](VkCommandBuffer a_cmdBuff)
+    {
+      m_pGpuProfiler->BeginScope(a_cmdBuff, "Transparency");
+      const etna::Image& opaqueFrame = GetImage(frameBeforeTransparency);
+      {
+        etna::set_state(a_cmdBuff, m_recordingTarget.image, vk::PipelineStageFlagBits2::eBlit,
+          vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eTransferDstOptimal,
+          vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+        etna::flush_barriers(a_cmdBuff);
+
+        // a blit rather than a copy converts the float target to the swapchain format
+        VkImageBlit blit = {};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.srcOffsets[1]  = {int32_t(m_width), int32_t(m_height), 1};
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.dstOffsets[1]  = {int32_t(m_width), int32_t(m_height), 1};
+        vkCmdBlitImage(a_cmdBuff, opaqueFrame.get(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          m_recordingTarget.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+      }
+
+      const etna::Image& depth = GetImage(gBuffer.mainViewDepth);
+      auto screenSpaceTransparencyInfo = etna::get_shader_program("screen_space_transparency");
+      VkDescriptorSet vkSet = CreateDescriptorSet(screenSpaceTransparencyInfo.getDescriptorLayoutId(0), a_cmdBuff,
+      {
+        etna::Binding {0, frameConstants()},
+        etna::Binding {1, opaqueFrame.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        etna::Binding {3, GetImage(gBuffer.albedo).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+        etna::Binding {4, environmentMap.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal, {0, 1, 6, vk::ImageViewType::eCube})},
+      });
+
+      {
+        // both attachments are loaded: the opaque frame is kept and transparency is depth tested against the scene
+        etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height},
+          {{m_recordingTarget.image, m_recordingTarget.view, false}}, {depth.get(), depth.getView({}), false});
+
+        vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_screenSpaceTransparencyPipeline.getVkPipeline());
+        vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
+          m_screenSpaceTransparencyPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+        prepareTransparency(a_cmdBuff);
+        uint32_t startInstance = 0;
+        for (const auto& [type, positions] : transparencyScene->positions)
+          renderTransparency(a_cmdBuff, type, startInstance, positions);
+      }
+      m_pGpuProfiler->EndScope(a_cmdBuff);
     });
-    VkDescriptorSet vkSet = set.getVkSet();
-
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {frameTransparencyOnly}, gBuffer.mainViewDepth);
 
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_screenSpaceTransparencyPipeline.getVkPipeline());
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
-      m_screenSpaceTransparencyPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+  graph.Compile();
+}
 
-    prepareTransparency(a_cmdBuff);
-    uint32_t startInstance = 0;
-		for (std::pair<meshTypes, std::vector<glm::vec3>> pair : transparencyScene->positions)
-			renderTransparency(
-				a_cmdBuff, pair.first, startInstance, static_cast<uint32_t>(pair.second.size())
-			);
-  }
+void SimpleShadowmapRender::BuildCommandBufferSimple(VkCommandBuffer a_cmdBuff, VkImage a_targetImage, VkImageView a_targetImageView,
+  uint32_t a_profilerSlot)
+{
+  vkResetCommandBuffer(a_cmdBuff, 0);
 
-  //// resolve transparency
-  //
-  {
-    auto resolveTransparencyInfo = etna::get_shader_program("resolve_transparency");
-    auto set = etna::create_descriptor_set(resolveTransparencyInfo.getDescriptorLayoutId(0), a_cmdBuff,
-    {
-      etna::Binding {0, frameBeforeTransparency.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-      etna::Binding {1, frameTransparencyOnly.genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
-    });
-    VkDescriptorSet vkSet = set.getVkSet();
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
-    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {{a_targetImage, a_targetImageView}}, {});
+  VK_CHECK_RESULT(vkBeginCommandBuffer(a_cmdBuff, &beginInfo));
+  m_pGpuProfiler->BeginSlot(a_cmdBuff, a_profilerSlot);
 
-    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_resolveTransparencyPipeline.getVkPipeline());
-    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
-      m_resolveTransparencyPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+  // with a single queue family there is nothing to acquire, otherwise the buffer is not kept for reuse
+  m_pUploads->RecordAcquireBarriers(a_cmdBuff);
 
-    vkCmdDraw(a_cmdBuff, 6, 1, 0, 0); // 6 vertices for 2 triangles in a quad
-  }
+  m_recordingTarget.image = a_targetImage;
+  m_recordingTarget.view  = a_targetImageView;
+  m_pFrameGraph->Execute(a_cmdBuff);
 
   if(m_input.drawFSQuad)
-    m_pQuad->RecordCommands(a_cmdBuff, a_targetImage, a_targetImageView, gBuffer.shadowMap, defaultSampler);
+    m_pQuad->RecordCommands(a_cmdBuff, a_targetImage, a_targetImageView, gBuffer.shadowMap, defaultSampler,
+      {0, 1, 1, vk::ImageViewType::e2D}); // the first cascade
+
+  if (m_colorCheck.stage != ColorCheckStage::IDLE)
+    RecordColorCapture(a_cmdBuff, a_targetImage);
 
   etna::set_state(a_cmdBuff, a_targetImage, vk::PipelineStageFlagBits2::eBottomOfPipe,
     vk::AccessFlags2(), vk::ImageLayout::ePresentSrcKHR,
@@ -596,7 +653,7 @@ void SimpleShadowmapRender::makeAssets()
 	}
 
   transparencyMeshes = std::make_unique<TransparencyMeshes>(m_context->getDevice(), m_context->getPhysicalDevice(),
-    m_context->getQueueFamilyIdx(), m_context->getQueueFamilyIdx());
+    m_pUploads, m_pGeoHeap);
 
   for (std::pair<meshTypes, ObjectMesh> pair : loaded_models)
 		transparencyMeshes->consume(pair.first, pair.second.vertices, pair.second.indices, model_filenames[pair.first] + ".sph", modelType);
@@ -614,11 +671,43 @@ void SimpleShadowmapRender::prepareTransparency(vk::CommandBuffer commandBuffer)
 	commandBuffer.bindIndexBuffer(indexBuf, 0, vk::IndexType::eUint32);
 }
 
-void SimpleShadowmapRender::renderTransparency(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance, uint32_t instanceCount)
+uint32_t SimpleShadowmapRender::selectTransparencyLod(meshTypes objectType, const glm::vec3& position) const
+{
+	const glm::vec4 sphere = transparencyMeshes->boundingSpheres.at(objectType);
+	const size_t lodCount = transparencyMeshes->lods.at(objectType).size();
+
+	float distance = glm::distance(position + glm::vec3(sphere), glm::vec3(m_cam.pos.x, m_cam.pos.y, m_cam.pos.z));
+	if (distance <= sphere.w)
+		return 0;
+
+	// Projected diameter of the bounding sphere in pixels
+	float screenSize = sphere.w / (distance * std::tan(0.5f * LiteMath::DEG_TO_RAD * m_cam.fov)) * float(m_height);
+	uint32_t lod = 0;
+	while (lod + 1 < lodCount && lod < std::size(TRANSPARENCY_LOD_SCREEN_SIZES) && screenSize < TRANSPARENCY_LOD_SCREEN_SIZES[lod])
+		lod++;
+	return lod;
+}
+
+void SimpleShadowmapRender::selectTransparencyLods(std::vector<uint32_t>& lods) const
 {
-	int indexCount = transparencyMeshes->indexCounts.find(objectType)->second;
-	int firstIndex = transparencyMeshes->firstIndices.find(objectType)->second;
-	commandBuffer.drawIndexed(indexCount, instanceCount, firstIndex, 0, startInstance);
-	startInstance += instanceCount;
+	lods.clear();
+	for (const auto& [type, positions] : transparencyScene->positions)
+		for (const glm::vec3& position : positions)
+			lods.push_back(selectTransparencyLod(type, position));
+}
+
+void SimpleShadowmapRender::renderTransparency(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance,
+	const std::vector<glm::vec3>& positions)
+{
+	const auto& lods = transparencyMeshes->lods.at(objectType);
+	// Instances are drawn one by one since each of them may use its own LOD,
+	// firstInstance keeps gl_InstanceIndex the same as with a single instanced draw.
+	// LODs are selected once per frame in UpdateRecordedState, a change of any of them records the commands again
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		const auto& lod = lods[m_recordedState.transparencyLods[startInstance]];
+		commandBuffer.drawIndexed(lod.indexCount, 1, lod.firstIndex, 0, startInstance);
+		startInstance++;
+	}
 }
 
@@ -2,8 +2,16 @@
 #define SIMPLE_SHADOWMAP_RENDER_H
 
 #include "../../render/scene_mgr.h"
+#include "../../render/frustum_culling.h"
+#include "../../render/scene_bvh.h"
 #include "../../render/render_common.h"
 #include "../../render/quad_renderer.h"
+#include "../../render/persistent_descriptors.h"
+#include "../../render/frame_allocator.h"
+#include "../../render/gpu_profiler.h"
+#include "../../render/bilateral_blur.h"
+#include "../../render/shadow_cascades.h"
+#include "../../render/frame_graph.h"
 #include "../../../resources/shaders/common.h"
 #include "etna/GraphicsPipeline.hpp"
 #include <geom/vk_mesh.h>
@@ -14,10 +22,14 @@
 #include <vk_images.h>
 #include <vk_swapchain.h>
 
+#include <array>
+#include <chrono>
+#include <optional>
 #include <string>
 #include <iostream>
 
 #include <etna/GlobalContext.hpp>
+#include <etna/RenderTargetStates.hpp>
 #include <etna/Sampler.hpp>
 
 
@@ -47,24 +59,120 @@ public:
 
 private:
   etna::GlobalContext* m_context;
+  // view space positions are reconstructed from mainViewDepth, see gbuffer_decode.h
+  // images that only live within a frame belong to m_pFrameGraph, they are allocated for the passes it keeps
   struct {
-    etna::Image position;
-    etna::Image albedo;
-    etna::Image normal;
-    etna::Image mainViewDepth;
-    etna::Image shadowMap;
-    etna::Image ssao;
-    etna::Image blurredSsao;
+    FrameGraph::ImageId albedo = FrameGraph::INVALID_IMAGE;
+    FrameGraph::ImageId normal = FrameGraph::INVALID_IMAGE; // octahedral view space normal
+    FrameGraph::ImageId mainViewDepth = FrameGraph::INVALID_IMAGE;
+    etna::Image shadowMap;         // a layer per cascade
+    etna::Image shadowStaticLayer; // only allocated with layered shadows, a layer per cascade
+    FrameGraph::ImageId ssao = FrameGraph::INVALID_IMAGE;     // at m_ssaoExtent, blurred in place
+    FrameGraph::ImageId ssaoTemp = FrameGraph::INVALID_IMAGE; // at m_ssaoExtent, between the blur passes
+    FrameGraph::ImageId upsampledSsao = FrameGraph::INVALID_IMAGE; // full resolution, used when SSAO is computed at a lower one
   } gBuffer;
-  etna::Image frameBeforeTransparency;
-  etna::Image frameTransparencyOnly;
+
+  // declared again whenever the command buffers are invalidated, the passes read per frame values when executed
+  std::unique_ptr<FrameGraph> m_pFrameGraph;
+  uint64_t m_frameGraphVersion = 0; // m_commandsVersion it was declared for
+  struct
+  {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+  } m_recordingTarget; // the swapchain image of the command buffer being recorded
+
+  enum class SsaoResolution
+  {
+    FULL,
+    HALF,
+    QUARTER
+  };
+  SsaoResolution m_ssaoResolution = SsaoResolution::HALF;
+  vk::Extent2D m_ssaoExtent {};
+
+  // shadowMap layers are rendered through their own views, etna's views cover all the layers
+  std::vector<VkImageView> m_shadowMapViews;
+  std::vector<VkImageView> m_shadowStaticLayerViews;
+  uint32_t m_shadowCascadesNum = 3;
+  // per cascade, three of them have fewer texels than the single 2048x2048 map they replaced
+  static constexpr uint32_t SHADOW_CASCADE_SIZE = 1024;
+  // blend of logarithmic (1) and uniform (0) cascade splits
+  static constexpr float SHADOW_CASCADE_SPLIT_LAMBDA = 0.75f;
+
+  // a cascade of the shadow map is only rendered again when its matrix or an instance changes,
+  // the update applies to the cascades of m_shadowCache.drawMask
+  enum class ShadowUpdate
+  {
+    NONE,               // the map of the previous frames is still valid
+    FULL,               // all the casters into shadowMap
+    STATIC_AND_DYNAMIC, // static casters into shadowStaticLayer for staticDrawMask, then as DYNAMIC
+    DYNAMIC             // shadowMap is a copy of shadowStaticLayer with the dynamic casters drawn on top
+  };
+  ShadowUpdate m_shadowUpdate = ShadowUpdate::FULL; // of the current frame
+  struct
+  {
+    bool layered = false;
+    // bit per cascade
+    uint32_t staticDirty = ~0u; // the whole cascade if not layered
+    uint32_t dynamicDirty = ~0u;
+    uint32_t drawMask = 0;       // of the current frame
+    uint32_t staticDrawMask = 0; // of the current frame, layered only
+    float4x4 cascadeMatrices[SHADOW_CASCADES_MAX]; // the cached map was rendered with
+    std::vector<bool> dynamicInstances; // per instance, changed at least once since the scene was loaded
+    uint32_t dynamicNum = 0;
+    uint32_t rendered = 0;
+    uint32_t reused = 0;
+    uint32_t cascadesRendered = 0;
+  } m_shadowCache;
+  etna::Buffer m_shadowLayerDraws;  // [frame in flight][cascade][static, dynamic][instance]
+  VkDrawIndexedIndirectCommand* m_shadowLayerDrawsMapped = nullptr;
+  etna::Buffer m_shadowLayerCounts; // [frame in flight][cascade][static, dynamic]
+  uint32_t* m_shadowLayerCountsMapped = nullptr;
+
+  FrameGraph::ImageId frameBeforeTransparency = FrameGraph::INVALID_IMAGE;
+
+  // format of frameBeforeTransparency, only rgb ends up in the swapchain image
+  enum class ColorPrecision
+  {
+    R11G11B10,
+    RGBA16F,
+    RGBA32F // reference for the image diff check
+  };
+  ColorPrecision m_colorPrecision = ColorPrecision::RGBA16F;
+
+  // renders a frame with RGBA32F targets and the next one with the selected precision, then compares them
+  enum class ColorCheckStage
+  {
+    IDLE,
+    REFERENCE,
+    TESTED
+  };
+  static constexpr float COLOR_CHECK_MAX_DIFF = 4.0f / 255.0f; // of the displayed colour
+  struct
+  {
+    ColorCheckStage stage = ColorCheckStage::IDLE;
+    ColorPrecision tested = ColorPrecision::RGBA16F;
+    etna::Buffer readback; // of the swapchain image
+    std::vector<uint8_t> reference;
+    bool hasResult = false;
+    ColorPrecision resultPrecision = ColorPrecision::RGBA16F;
+    float maxDiff = 0.0f;
+    float meanDiff = 0.0f;
+    float time = 0.0f; // both frames are drawn with it, the camera and the light are not updated meanwhile
+  } m_colorCheck;
   etna::Image backgroundTexture;
   etna::Image environmentMap;
   etna::Sampler defaultSampler;
-  etna::Buffer constants;
   etna::Buffer ssaoSamples;
   etna::Buffer ssaoNoise;
-  etna::Buffer gaussianKernel;
+  // kernel samples of ssao.comp read from its shared tile and fetched outside of it,
+  // the stride is the largest minStorageBufferOffsetAlignment the spec allows
+  static constexpr VkDeviceSize SSAO_TILE_STATS_STRIDE = 256;
+  etna::Buffer m_ssaoTileStats;         // [frame in flight], SSAO_TILE_STATS_STRIDE apart
+  etna::Buffer m_ssaoTileStatsReadback; // [frame in flight][hits, misses]
+  uint32_t* m_ssaoTileStatsMapped = nullptr;
+  uint32_t m_ssaoTileHits = 0;
+  uint32_t m_ssaoTileMisses = 0;
 
   VkCommandPool    m_commandPool    = VK_NULL_HANDLE;
 
@@ -72,34 +180,147 @@ private:
   {
     uint32_t    currentFrame      = 0u;
     VkQueue     queue             = VK_NULL_HANDLE;
-    VkSemaphore imageAvailable    = VK_NULL_HANDLE;
-    VkSemaphore renderingFinished = VK_NULL_HANDLE;
+    // per frame in flight
+    std::vector<VkSemaphore> imageAvailable;
+    std::vector<VkSemaphore> renderingFinished;
   } m_presentationResources;
 
   std::vector<VkFence> m_frameFences;
+  // fence of the frame that last rendered to each swapchain image, its GUI commands are rewritten on reuse
+  std::vector<VkFence> m_imagesInFlight;
+  // [frame in flight][swapchain image], each one is replayed until something it was recorded with changes
   std::vector<VkCommandBuffer> m_cmdBuffersDrawMain;
-  VkCommandBuffer m_textureCmdBuffer; // a command buffer specifically to load textures
+  std::vector<uint64_t> m_cmdBufferVersions; // m_commandsVersion they were recorded for, 0 if not reusable
+  std::vector<bool> m_swapchainImageUsed;
+  uint64_t m_commandsVersion = 1;
+  uint64_t m_persistentSetsVersion = 0;
+  uint32_t m_framesSinceInvalidation = 0;
+  bool m_reuseCommandBuffers = true;
+  bool m_recordingReusable = false;
+  std::unique_ptr<PersistentDescriptorPool> m_pPersistentSets;
+
+  // a slot per command buffer, collected once the frame that submitted it is complete
+  std::unique_ptr<GpuProfiler> m_pGpuProfiler;
+  std::vector<uint32_t> m_submittedCmdBuffers; // per frame in flight, UINT32_MAX before the first submit
+  bool m_showProfilerOverlay = true;
+
+  // SSAO and its blur are recorded between the G-buffer and the shadow pass with no barrier in between,
+  // so the GPU may run the compute dispatches while the shadow map is rasterized
+  bool m_overlapSsaoWithShadows = true;
+
+  // everything the command buffers depend on that is not a resource or uniform
+  struct RecordedState
+  {
+    int cullingMode = -1;
+    bool occlusionCulling = false;
+    bool ssaoEnabled = false;
+    bool drawFSQuad = false;
+    float cameraFov = 0.0f; // the blur depth unprojection is a push constant
+    int shadowUpdate = -1;
+    uint32_t shadowDrawMask = 0;
+    uint32_t shadowStaticDrawMask = 0;
+    bool overlapSsaoWithShadows = false;
+    std::vector<uint32_t> transparencyLods; // per transparent instance
+    bool operator==(const RecordedState&) const = default;
+  } m_recordedState;
 
   struct
   {
-    float4x4 projView;
-    float4x4 model;
-    uint colorNo;
-  } pushConst2M;
+    uint32_t recorded = 0;
+    uint32_t reused = 0;
+    float recordMs = 0.0f; // CPU time of the last recording
+  } m_commandStats;
+
+  struct
+  {
+    uint32_t lightMatrixIdx; // 0 for the main view, shadow cascade + 1, matrices are taken from UniformParams
+  } pushConst;
 
   float4x4 m_worldViewProj;
   float4x4 m_lightMatrix;    
 
+  enum class CullingMode
+  {
+    CPU, // SIMD frustum culling, lists are written to host visible memory
+    GPU  // compute frustum and Hi-Z occlusion culling, draw count stays on GPU
+  };
+  CullingMode m_cullingMode = CullingMode::GPU;
+  bool m_occlusionCulling = true;
+
+  // compact lists of visible instances, count is only the upper bound of the number stored in countBuffer
+  struct CulledDraws
+  {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    uint32_t count = 0;
+    VkBuffer countBuffer = VK_NULL_HANDLE;
+    VkDeviceSize countOffset = 0;
+  };
+  // the main view, then one per shadow cascade
+  static constexpr uint32_t CULLING_LISTS_NUM = 1 + SHADOW_CASCADES_MAX;
+  uint32_t m_cpuVisibleCounts[CULLING_LISTS_NUM] = {};
+
+  // mirrors uvec4 in cull_instances.comp
+  struct GpuDrawCounts
+  {
+    uint32_t drawCount = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    uint32_t pad = 0;
+  } m_gpuCullingStats[CULLING_LISTS_NUM];
+
+  FrustumCuller m_frustumCuller;
+  std::vector<uint32_t> m_visibleInstances;
+  std::vector<uint32_t> m_updatedInstances;
+  // picking and light queries on the CPU, refit together with m_frustumCuller
+  SceneBvh m_sceneBvh;
+  std::vector<uint32_t> m_queriedInstances;
+  etna::Buffer m_culledDrawCommands; // [frame in flight][camera, cascades][instance]
+  VkDrawIndexedIndirectCommand* m_culledDrawCommandsMapped = nullptr;
+  etna::Buffer m_culledDrawCounts;   // [frame in flight][camera, cascades]
+  uint32_t* m_culledDrawCountsMapped = nullptr;
+
+  etna::Buffer m_gpuCulledDrawCommands; // [frame in flight][camera, cascades][instance]
+  etna::Buffer m_gpuDrawCounts;         // [frame in flight][camera, cascades]
+  etna::Buffer m_gpuDrawCountsReadback;
+  GpuDrawCounts* m_gpuDrawCountsMapped = nullptr;
+  FrameAllocator::Allocation m_cullingParams; // [camera, cascades] of the current frame
+
+  // max depth pyramid of the previous frame main view
+  etna::Image m_depthPyramid;
+  vk::Extent2D m_depthPyramidExtent {};
+  uint32_t m_depthPyramidMips = 1;
+  bool m_depthPyramidValid = false;
+  float4x4 m_depthPyramidProjView;
+
+  PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCountKHR = nullptr;
+
   UniformParams m_uniforms {};
-  void* m_uboMappedMem = nullptr;
+  // per frame uniforms and parameters, reallocated every frame
+  std::unique_ptr<FrameAllocator> m_pFrameAllocator;
+  FrameAllocator::Allocation m_uniformsAlloc;
+
+  // CPU frame times with and without waiting for the GPU at the end of every frame
+  static constexpr uint32_t FRAME_PACING_BENCHMARK_FRAMES = 500;
+  struct
+  {
+    bool waitIdle = false; // the old behaviour, frames don't overlap
+    float frameMs[2] = {}; // moving averages [pipelined, wait idle]
+    std::chrono::high_resolution_clock::time_point lastFrame;
+    bool started = false;
+    uint32_t benchmarkFrames = 0; // frames left, the first half waits for the GPU
+    double benchmarkMs[2] = {};
+    float benchmarkResult[2] = {};
+  } m_framePacing;
 
   etna::GraphicsPipeline m_shadowPipeline {};
   etna::GraphicsPipeline m_prepareGbufferPipeline {};
-  etna::GraphicsPipeline m_ssaoPipeline {};
-  etna::ComputePipeline  m_gaussianBlurPipeline {};
+  etna::ComputePipeline  m_ssaoPipeline {};
+  etna::GraphicsPipeline m_ssaoUpsamplePipeline {};
   etna::GraphicsPipeline m_resolveGbufferPipeline {};
   etna::GraphicsPipeline m_screenSpaceTransparencyPipeline {};
-  etna::GraphicsPipeline m_resolveTransparencyPipeline {};
+  etna::ComputePipeline  m_cullInstancesPipeline {};
+  etna::ComputePipeline  m_depthPyramidPipeline {};
 
   VkSurfaceKHR m_surface = VK_NULL_HANDLE;
   VulkanSwapChain m_swapchain;
@@ -108,15 +329,18 @@ private:
   uint32_t m_width  = 1024u;
   uint32_t m_height = 1024u;
   uint32_t m_framesInFlight = 2u;
-  uint32_t m_gaussian_kernel_length = 23;
-  std::vector<float> m_gaussian_kernel;
-  uint m_gauss_window = 21;
   bool m_vsync = false;
 
   vk::PhysicalDeviceFeatures m_enabledDeviceFeatures = {};
+  // only set when etna could pick a device without the features or extensions, the index is one in etna's instance
+  std::optional<uint32_t> m_physicalDeviceIndex;
+  std::array<uint8_t, VK_UUID_SIZE> m_physicalDeviceUuid = {};
+  uint32_t m_maxDrawIndirectCount = 1;
   std::vector<const char*> m_deviceExtensions;
   std::vector<const char*> m_instanceExtensions;
 
+  std::shared_ptr<UploadManager> m_pUploads;
+  std::shared_ptr<GeometryHeap> m_pGeoHeap;
   std::shared_ptr<SceneManager> m_pScnMgr;
   std::shared_ptr<IRenderGUI> m_pGUIRender;
 
@@ -124,6 +348,7 @@ private:
   std::unique_ptr<TransparencyScene> transparencyScene;
   
   std::unique_ptr<QuadRenderer> m_pQuad;
+  std::unique_ptr<BilateralBlur> m_pBilateralBlur;
 
   struct InputControlMouseEtc
   {
@@ -154,14 +379,66 @@ private:
   } m_light;
  
   void DrawFrameSimple(bool draw_gui);
-
-  void BuildCommandBufferSimple(VkCommandBuffer a_cmdBuff, VkImage a_targetImage, VkImageView a_targetImageView);
-
-  void DrawSceneCmd(VkCommandBuffer a_cmdBuff, const float4x4& a_wvp, VkPipelineLayout a_pipelineLayout,
-    VkShaderStageFlags stageFlags = VK_SHADER_STAGE_VERTEX_BIT);
+  void UpdateFramePacing();
+
+  // declares the passes of a frame and compiles m_pFrameGraph, recordings execute it
+  void SetupFrameGraph();
+  const etna::Image& GetImage(FrameGraph::ImageId a_image) const { return m_pFrameGraph->GetImage(a_image); }
+  void BuildCommandBufferSimple(VkCommandBuffer a_cmdBuff, VkImage a_targetImage, VkImageView a_targetImageView,
+    uint32_t a_profilerSlot);
+
+  void DrawSceneCmd(VkCommandBuffer a_cmdBuff, uint32_t a_lightMatrixIdx, VkPipelineLayout a_pipelineLayout,
+    const CulledDraws& a_draws);
+  // sets of reusable command buffers go to m_pPersistentSets, the ones of single use ones to etna
+  VkDescriptorSet CreateDescriptorSet(etna::DescriptorLayoutId a_layoutId, VkCommandBuffer a_cmdBuff,
+    std::vector<etna::Binding> a_bindings);
+  void InvalidateCommandBuffers();
+  void UpdateRecordedState();
+  void AllocateCullingResources();
+  void AllocateDepthPyramid();
+  void CullScene();
+  // uploads instances changed through SceneManager and keeps m_frustumCuller and m_sceneBvh in sync
+  void UpdateSceneInstances();
+  uint32_t CullInstances(const float4x4& a_projView, uint32_t a_listNo);
+  // lists of the current frame slot, the count is read from countBuffer in both culling modes
+  CulledDraws GetCulledDraws(uint32_t a_listNo) const;
+  void CullSceneGpuCmd(VkCommandBuffer a_cmdBuff);
+  void BuildDepthPyramidCmd(VkCommandBuffer a_cmdBuff);
+
+  void AllocateShadowMaps();
+  void DestroyShadowMapViews();
+  void SetShadowCascadesNum(uint32_t a_cascadesNum);
+  // after the camera or the light moved
+  void UpdateShadowCascades();
+  void AllocateShadowDrawLists();
+  void InvalidateShadowCache();
+  void SetShadowLayers(bool a_layered);
+  // after the instances are updated: decides m_shadowUpdate and writes the layer lists it draws
+  void UpdateShadowCache();
+  // after the frame is submitted
+  void FinishShadowFrame();
+  CulledDraws GetShadowLayerDraws(uint32_t a_cascade, uint32_t a_layer) const;
+  void DrawShadowCasters(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants, uint32_t a_cascade,
+    etna::RenderTargetState::AttachmentParams a_depthTarget, const CulledDraws& a_draws);
+  void RecordShadowCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants);
+
+  void UpdateSsaoExtent();
+  void SetSsaoResolution(SsaoResolution a_resolution);
+  // compute only, the bilateral blur is a pass of its own
+  void RecordSsaoCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants);
+  void RecordSsaoBlurCmd(VkCommandBuffer a_cmdBuff);
+  // after the frame fence, the counts of the last SSAO pass in this frame slot
+  void CollectSsaoTileStats(uint32_t a_frame);
+  // graphics, only declared below the full resolution
+  void RecordSsaoUpsampleCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants);
+  // the full resolution occlusion resolve_gbuffer reads
+  FrameGraph::ImageId GetSsaoResult() const;
 
   void prepareTransparency(vk::CommandBuffer commandBuffer);
-  void renderTransparency(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance, uint32_t instanceCount);
+  void renderTransparency(vk::CommandBuffer commandBuffer, meshTypes objectType, uint32_t& startInstance,
+    const std::vector<glm::vec3>& positions);
+  void selectTransparencyLods(std::vector<uint32_t>& lods) const;
+  uint32_t selectTransparencyLod(meshTypes objectType, const glm::vec3& position) const;
 
   void makeAssets();
   void loadShaders();
@@ -169,12 +446,24 @@ private:
   void loadEnvironmentMap();
 
   void SetupSimplePipeline();
+
+  vk::Format GetColorTargetFormat() const;
+  void SetColorPrecision(ColorPrecision a_precision);
+  void StartColorCheck();
+  // before the frame is recorded: switches to the precision the frame has to be captured with
+  void PrepareColorCheckFrame();
+  void RecordColorCapture(VkCommandBuffer a_cmdBuff, VkImage a_targetImage);
+  // after the capture frame is submitted
+  void FinishColorCheckFrame();
   void RecreateSwapChain();
 
   void UpdateUniformBuffer(float a_time);
 
 
   void SetupDeviceExtensions();
+  void SetupDeviceFeatures();
+  void SelectPhysicalDevice();
+  void InitEtna();
 
   void AllocateResources();
   void PreparePipelines();
@@ -184,6 +473,7 @@ private:
   void InitPresentStuff();
   void ResetPresentStuff();
   void SetupGUIElements();
+  void DrawProfilerOverlay();
 };
 
 
@@ -0,0 +1,134 @@
+#include "shadowmap_render.h"
+
+#include <algorithm>
+
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include <etna/RenderTargetStates.hpp>
+
+
+static const char* SSAO_SCOPE_NAMES[] = {"SSAO full", "SSAO half", "SSAO quarter"};
+// in full resolution pixels
+static constexpr uint32_t SSAO_BLUR_RADIUS = 11;
+
+void SimpleShadowmapRender::UpdateSsaoExtent()
+{
+  const uint32_t downscale = 1u << static_cast<uint32_t>(m_ssaoResolution);
+  m_ssaoExtent = vk::Extent2D{std::max(m_width / downscale, 1u), std::max(m_height / downscale, 1u)};
+  m_uniforms.ssaoDownscale = downscale;
+}
+
+void SimpleShadowmapRender::SetSsaoResolution(SsaoResolution a_resolution)
+{
+  if (a_resolution == m_ssaoResolution)
+    return;
+
+  // the frame graph is declared again with the new sizes, it waits for the images it replaces
+  m_ssaoResolution = a_resolution;
+  UpdateSsaoExtent();
+  InvalidateCommandBuffers();
+}
+
+FrameGraph::ImageId SimpleShadowmapRender::GetSsaoResult() const
+{
+  return m_ssaoResolution == SsaoResolution::FULL ? gBuffer.ssao : gBuffer.upsampledSsao;
+}
+
+void SimpleShadowmapRender::RecordSsaoCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants)
+{
+  m_pGpuProfiler->BeginScope(a_cmdBuff, SSAO_SCOPE_NAMES[static_cast<int>(m_ssaoResolution)]);
+
+  {
+    const VkDeviceSize statsOffset = m_presentationResources.currentFrame * SSAO_TILE_STATS_STRIDE;
+    vkCmdFillBuffer(a_cmdBuff, m_ssaoTileStats.get(), statsOffset, 2 * sizeof(uint32_t), 0);
+
+    VkMemoryBarrier clearBarrier = {};
+    clearBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(a_cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+      1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+    auto ssaoInfo = etna::get_shader_program("calculate_ssao");
+    VkDescriptorSet vkSet = CreateDescriptorSet(ssaoInfo.getDescriptorLayoutId(0), a_cmdBuff,
+    {
+      etna::Binding {0, a_frameConstants},
+      etna::Binding {1, GetImage(gBuffer.mainViewDepth).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+      etna::Binding {2, GetImage(gBuffer.normal).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+      etna::Binding {3, ssaoSamples.genBinding()},
+      etna::Binding {4, ssaoNoise.genBinding()},
+      etna::Binding {5, GetImage(gBuffer.ssao).genBinding(defaultSampler.get(), vk::ImageLayout::eGeneral)},
+      etna::Binding {6, m_ssaoTileStats.genBinding(statsOffset, 2 * sizeof(uint32_t))}
+    });
+    etna::flush_barriers(a_cmdBuff);
+
+    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE,
+      m_ssaoPipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, m_ssaoPipeline.getVkPipeline());
+    // 16x16 tiles, see ssao.comp
+    vkCmdDispatch(a_cmdBuff, (m_ssaoExtent.width + 15) / 16, (m_ssaoExtent.height + 15) / 16, 1);
+
+    VkMemoryBarrier statsBarrier = {};
+    statsBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    statsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    statsBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(a_cmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+      1, &statsBarrier, 0, nullptr, 0, nullptr);
+
+    const VkBufferCopy statsCopy = {statsOffset, m_presentationResources.currentFrame * 2 * sizeof(uint32_t),
+      2 * sizeof(uint32_t)};
+    vkCmdCopyBuffer(a_cmdBuff, m_ssaoTileStats.get(), m_ssaoTileStatsReadback.get(), 1, &statsCopy);
+  }
+
+  m_pGpuProfiler->EndScope(a_cmdBuff);
+}
+
+void SimpleShadowmapRender::CollectSsaoTileStats(uint32_t a_frame)
+{
+  // stays at the last SSAO pass of the slot while SSAO is off
+  m_ssaoTileHits   = m_ssaoTileStatsMapped[a_frame * 2];
+  m_ssaoTileMisses = m_ssaoTileStatsMapped[a_frame * 2 + 1];
+}
+
+void SimpleShadowmapRender::RecordSsaoBlurCmd(VkCommandBuffer a_cmdBuff)
+{
+  //// blur SSAO texture
+  //
+  m_pGpuProfiler->BeginScope(a_cmdBuff, "SSAO blur");
+  {
+    // the kernel covers about the same part of the screen at every resolution
+    const uint32_t downscale = 1u << static_cast<uint32_t>(m_ssaoResolution);
+    BilateralBlur::Config blurConfig;
+    blurConfig.radius = (SSAO_BLUR_RADIUS + downscale - 1) / downscale;
+    m_pBilateralBlur->RecordCommands(a_cmdBuff, blurConfig, GetImage(gBuffer.ssao), GetImage(gBuffer.ssaoTemp),
+      m_ssaoExtent, GetImage(gBuffer.mainViewDepth), downscale, m_uniforms.projInverse, defaultSampler);
+  }
+
+  m_pGpuProfiler->EndScope(a_cmdBuff);
+}
+
+void SimpleShadowmapRender::RecordSsaoUpsampleCmd(VkCommandBuffer a_cmdBuff, const etna::BufferBinding& a_frameConstants)
+{
+  //// depth aware upsampling to the full resolution
+  //
+  m_pGpuProfiler->BeginScope(a_cmdBuff, "SSAO upsample");
+  {
+    auto upsampleInfo = etna::get_shader_program("ssao_upsample");
+    VkDescriptorSet vkSet = CreateDescriptorSet(upsampleInfo.getDescriptorLayoutId(0), a_cmdBuff,
+    {
+      etna::Binding {0, a_frameConstants},
+      etna::Binding {1, GetImage(gBuffer.mainViewDepth).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+      etna::Binding {2, GetImage(gBuffer.ssao).genBinding(defaultSampler.get(), vk::ImageLayout::eShaderReadOnlyOptimal)},
+    });
+
+    etna::RenderTargetState renderTargets(a_cmdBuff, {0, 0, m_width, m_height}, {{GetImage(gBuffer.upsampledSsao)}}, {});
+
+    vkCmdBindPipeline(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ssaoUpsamplePipeline.getVkPipeline());
+    vkCmdBindDescriptorSets(a_cmdBuff, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      m_ssaoUpsamplePipeline.getVkPipelineLayout(), 0, 1, &vkSet, 0, VK_NULL_HANDLE);
+
+    vkCmdDraw(a_cmdBuff, 6, 1, 0, 0); // 6 vertices for 2 triangles in a quad
+  }
+
+  m_pGpuProfiler->EndScope(a_cmdBuff);
+}
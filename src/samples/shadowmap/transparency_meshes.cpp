@@ -8,24 +8,31 @@
 
 #include <etna/VertexInput.hpp>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <vk_buffers.h>
-#include <vk_copy.h>
 
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
 #include "object.h"
 #include "preprocessing_common.h"
 #include "transparency_meshes.h"
 
-TransparencyMeshes::TransparencyMeshes(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId, uint32_t a_graphicsQId)
+// Conservative estimate of the post-transform cache size of current GPUs
+static constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Simplification grid resolution of LODs 1..3, in cells along the bounding box diagonal
+static constexpr float LOD_GRID_RESOLUTIONS[] = {48.f, 24.f, 12.f};
+// A LOD is dropped if it does not remove at least a quarter of the triangles of the previous one
+static constexpr float LOD_MAX_TRIANGLE_RATIO = 0.75f;
+
+TransparencyMeshes::TransparencyMeshes(VkDevice a_device, VkPhysicalDevice a_physDevice, std::shared_ptr<UploadManager> a_pUploads,
+	std::shared_ptr<GeometryHeap> a_pGeoHeap)
 	: indexOffset(0)
 	, m_device(a_device)
 	, m_physDevice(a_physDevice)
-	, m_transferQId(a_transferQId)
-	, m_graphicsQId(a_graphicsQId)
+	, m_pUploads(std::move(a_pUploads))
+	, m_pGeoHeap(std::move(a_pGeoHeap))
 {
-	vkGetDeviceQueue(a_device, a_transferQId, 0, &m_transferQ);
-	vkGetDeviceQueue(a_device, a_graphicsQId, 0, &m_graphicsQ);
-	VkDeviceSize scratchMemSize = 64 * 1024 * 1024;
-	m_pCopyHelper = std::make_shared<vk_utils::PingPongCopyHelper>(a_physDevice, a_device, m_transferQ, m_transferQId, scratchMemSize);
 }
 
 // Möller–Trumbore ray-triangle intersection algorithm:
@@ -69,10 +76,6 @@ void TransparencyMeshes::consume(meshTypes type, std::vector<float>& vertexData,
 {
 	int indexCount = static_cast<int>(indexData.size());
 	int vertexCount = static_cast<int>(vertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
-	int lastIndex = static_cast<int>(indexLump.size());
-
-	firstIndices.insert(std::make_pair(type, lastIndex));
-	indexCounts.insert(std::make_pair(type, indexCount));
 
 	bool calculateSphCoefs = !std::filesystem::exists(sphCoefFilePath);
 	if (!calculateSphCoefs)
@@ -234,6 +237,59 @@ void TransparencyMeshes::consume(meshTypes type, std::vector<float>& vertexData,
 		sphCoefFile.close();
 	}
 
+	glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+	for (int vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+	{
+		glm::vec3 pos = glm::make_vec3(&vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + VERTEX_POSITION_START]);
+		boxMin = glm::min(boxMin, pos);
+		boxMax = glm::max(boxMax, pos);
+	}
+	glm::vec3 center = (boxMin + boxMax) * 0.5f;
+	float radius = 0.f;
+	for (int vertexNo = 0; vertexNo < vertexCount; vertexNo++)
+		radius = std::max(radius, glm::distance(center,
+			glm::make_vec3(&vertexData[SINGLE_VERTEX_FLOAT_NUM * vertexNo + VERTEX_POSITION_START])));
+	boundingSpheres[type] = glm::vec4(center, radius);
+
+	lods[type].clear();
+	append(type, vertexData, indexData);
+
+	// Coarser LODs reuse the full-resolution bake instead of baking their own coefficients
+	float diagonal = glm::distance(boxMin, boxMax);
+	// all vertices in one point give a zero cell size, there is nothing to simplify then
+	if (!(diagonal > 0.f))
+		return;
+	size_t previousIndexCount = indexData.size();
+	for (float resolution : LOD_GRID_RESOLUTIONS)
+	{
+		std::vector<float> lodVertexData;
+		std::vector<uint32_t> lodIndexData;
+		simplify_mesh(vertexData, indexData, diagonal / resolution, lodVertexData, lodIndexData);
+		if (lodIndexData.empty() || float(lodIndexData.size()) > LOD_MAX_TRIANGLE_RATIO * float(previousIndexCount))
+			continue;
+
+		transfer_sh_coefficients(vertexData, indexData, lodVertexData);
+		previousIndexCount = lodIndexData.size();
+		append(type, lodVertexData, lodIndexData);
+	}
+}
+
+void TransparencyMeshes::append(meshTypes type, std::vector<float>& vertexData, std::vector<uint32_t>& indexData)
+{
+	int vertexCount = static_cast<int>(vertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
+
+	// Reordering is done only after the coefficients are read or baked,
+	// since .sph files store them in the original vertex order.
+	float acmrBefore = calculate_acmr(indexData, vertexCount, VERTEX_CACHE_SIZE);
+	std::vector<uint32_t> clusterStarts = optimize_vertex_cache(indexData, vertexCount, VERTEX_CACHE_SIZE);
+	optimize_overdraw(indexData, clusterStarts, vertexData, SINGLE_VERTEX_FLOAT_NUM, VERTEX_POSITION_START);
+	optimize_vertex_fetch(indexData, vertexData, SINGLE_VERTEX_FLOAT_NUM);
+	vertexCount = static_cast<int>(vertexData.size() / SINGLE_VERTEX_FLOAT_NUM);
+	std::cout << "LOD " << lods[type].size() << ": " << indexData.size() / 3 << " triangles, ACMR: " << acmrBefore
+		<< " -> " << calculate_acmr(indexData, vertexCount, VERTEX_CACHE_SIZE) << " (" << clusterStarts.size() << " clusters)" << std::endl;
+
+	lods[type].push_back(MeshLod{static_cast<int>(indexLump.size()), static_cast<int>(indexData.size())});
+
 	for (float attribute : vertexData)
 		vertexLump.push_back(attribute);
 
@@ -248,14 +304,12 @@ void TransparencyMeshes::finalize()
 	VkDeviceSize vertexBufSize = sizeof(float) * vertexLump.size();
   VkDeviceSize indexBufSize  = sizeof(uint32_t) * indexLump.size();
 
-  m_geoVertBuf  = vk_utils::createBuffer(m_device, vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-  m_geoIdxBuf   = vk_utils::createBuffer(m_device, indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  m_geoVertBuf  = m_pGeoHeap->CreateBuffer(vertexBufSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoVertAlloc);
+  m_geoIdxBuf   = m_pGeoHeap->CreateBuffer(indexBufSize,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_geoIdxAlloc);
 
-  VkMemoryAllocateFlags allocFlags {};
-  m_geoMemAlloc = vk_utils::allocateAndBindWithPadding(m_device, m_physDevice, {m_geoVertBuf, m_geoIdxBuf}, allocFlags);
-
-  m_pCopyHelper->UpdateBuffer(m_geoVertBuf, 0, vertexLump.data(), vertexBufSize);
-  m_pCopyHelper->UpdateBuffer(m_geoIdxBuf,  0, indexLump.data(), indexBufSize);
+  m_pUploads->UploadBuffer(m_geoVertBuf, 0, vertexLump.data(), vertexBufSize);
+  m_pUploads->UploadBuffer(m_geoIdxBuf,  0, indexLump.data(), indexBufSize);
+  m_pUploads->Flush();
 
 	vertexLump.clear();
 	indexLump.clear();
@@ -263,23 +317,10 @@ void TransparencyMeshes::finalize()
 
 TransparencyMeshes::~TransparencyMeshes()
 {
-  if(m_geoVertBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_geoVertBuf, nullptr);
-    m_geoVertBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_geoIdxBuf != VK_NULL_HANDLE)
-  {
-    vkDestroyBuffer(m_device, m_geoIdxBuf, nullptr);
-    m_geoIdxBuf = VK_NULL_HANDLE;
-  }
-
-  if(m_geoMemAlloc != VK_NULL_HANDLE)
-  {
-    vkFreeMemory(m_device, m_geoMemAlloc, nullptr);
-    m_geoMemAlloc = VK_NULL_HANDLE;
-  }
+  m_pUploads->WaitIdle();
+
+  m_pGeoHeap->DestroyBuffer(m_geoVertBuf, m_geoVertAlloc);
+  m_pGeoHeap->DestroyBuffer(m_geoIdxBuf,  m_geoIdxAlloc);
 }
 
 etna::VertexByteStreamFormatDescription TransparencyMeshes::getTransparencyVertexAttributeDescriptions()
@@ -2,19 +2,31 @@
 
 #include <etna/Buffer.hpp>
 #include <vk_utils.h>
+#include <glm/glm.hpp>
 
 #include "transparency_scene.h"
+#include "../../render/upload_manager.h"
+#include "../../render/geometry_heap.h"
 
 class TransparencyMeshes {
 	public:
-		TransparencyMeshes(VkDevice a_device, VkPhysicalDevice a_physDevice, uint32_t a_transferQId, uint32_t a_graphicsQId);
+		TransparencyMeshes(VkDevice a_device, VkPhysicalDevice a_physDevice, std::shared_ptr<UploadManager> a_pUploads,
+			std::shared_ptr<GeometryHeap> a_pGeoHeap);
 		~TransparencyMeshes();
 		void consume(meshTypes type, std::vector<float>& vertexData, std::vector<uint32_t>& indexData,
 			const std::string &sphCoefFilePath, ModelFillType fillType);
 		void finalize();
 
-		std::unordered_map<meshTypes, int> firstIndices;
-		std::unordered_map<meshTypes, int> indexCounts;
+		struct MeshLod
+		{
+			int firstIndex;
+			int indexCount;
+		};
+
+		// LOD 0 is the full-resolution mesh, every next one is coarser
+		std::unordered_map<meshTypes, std::vector<MeshLod>> lods;
+		// Object space center and radius
+		std::unordered_map<meshTypes, glm::vec4> boundingSpheres;
 
 		VkBuffer GetVertexBuffer() const { return m_geoVertBuf; }
   	VkBuffer GetIndexBuffer()  const { return m_geoIdxBuf; }
@@ -22,20 +34,19 @@ class TransparencyMeshes {
 		etna::VertexByteStreamFormatDescription getTransparencyVertexAttributeDescriptions();
 		
 	private:
+		void append(meshTypes type, std::vector<float>& vertexData, std::vector<uint32_t>& indexData);
+
 		int indexOffset;
 		std::vector<float> vertexLump;
 		std::vector<uint32_t> indexLump;
 
-		VkDeviceMemory m_geoMemAlloc = VK_NULL_HANDLE;
+		GeometryHeap::Allocation m_geoVertAlloc;
+		GeometryHeap::Allocation m_geoIdxAlloc;
 		VkBuffer m_geoVertBuf = VK_NULL_HANDLE;
   	VkBuffer m_geoIdxBuf  = VK_NULL_HANDLE;
 
 		VkDevice m_device = VK_NULL_HANDLE;
 		VkPhysicalDevice m_physDevice = VK_NULL_HANDLE;
-		uint32_t m_transferQId = UINT32_MAX;
-		VkQueue m_transferQ = VK_NULL_HANDLE;
-
-		uint32_t m_graphicsQId = UINT32_MAX;
-		VkQueue m_graphicsQ = VK_NULL_HANDLE;
-		std::shared_ptr<vk_utils::ICopyEngine> m_pCopyHelper;
+		std::shared_ptr<UploadManager> m_pUploads;
+		std::shared_ptr<GeometryHeap> m_pGeoHeap;
 };
\ No newline at end of file
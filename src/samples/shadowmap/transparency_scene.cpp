@@ -9,7 +9,8 @@ TransparencyScene::TransparencyScene()
 	// positions.insert({ meshTypes::SKULL, {} });
 	// positions.insert({ meshTypes::VIKING_ROOM, {} });
 	positions.insert({ meshTypes::CUBE, {} });
-	positions[meshTypes::CUBE].push_back(glm::vec3(0.f, 0.f, 0.f));
+	// Instances are placed by MOVE_TRANSFORM in transparency.vert, positions have to match it
+	positions[meshTypes::CUBE].push_back(glm::vec3(0.f, 0.f, 5.f));
 	// positions[meshTypes::CUBE].push_back(glm::vec3(0.f, 0.f, 0.f));
 
 	// positions[meshTypes::GROUND].push_back(glm::vec3(10.f, 0.f, 0.f));
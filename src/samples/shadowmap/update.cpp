@@ -5,6 +5,10 @@
 
 void SimpleShadowmapRender::UpdateCamera(const Camera* cams, uint32_t a_camsNumber)
 {
+  // the frames of a color check are compared pixel by pixel
+  if (m_colorCheck.stage != ColorCheckStage::IDLE)
+    return;
+
   m_cam = cams[0];
   if(a_camsNumber >= 2)
     m_light.cam = cams[1];
@@ -22,6 +26,8 @@ void SimpleShadowmapRender::UpdateView()
   auto mWorldViewProj = mProjFix * mProj * mLookAt;
   m_uniforms.view = mLookAt;
   m_uniforms.proj = mProjFix * mProj;
+  m_uniforms.projInverse = LiteMath::inverse4x4(m_uniforms.proj);
+  m_uniforms.projView = mWorldViewProj;
   m_uniforms.viewInverse = LiteMath::inverse4x4(mLookAt);
 
   m_uniforms.camForward = m_cam.forward();
@@ -45,15 +51,16 @@ void SimpleShadowmapRender::UpdateView()
   
   mLookAt       = LiteMath::lookAt(m_light.cam.pos, m_light.cam.pos + m_light.cam.forward()*10.0f, m_light.cam.up);
   m_lightMatrix = mProjFix*mProj*mLookAt;
+
+  UpdateShadowCascades();
 }
 
 void SimpleShadowmapRender::UpdateUniformBuffer(float a_time)
 {
   m_uniforms.lightMatrix = m_lightMatrix;
   m_uniforms.lightPos    = m_light.cam.pos; //LiteMath::float3(sinf(a_time), 1.0f, cosf(a_time));
-  m_uniforms.time        = a_time;
-
-  memcpy(m_uboMappedMem, &m_uniforms, sizeof(m_uniforms));
+  m_uniforms.time        = m_colorCheck.stage != ColorCheckStage::IDLE ? m_colorCheck.time : a_time;
+  // copied to the frame allocator in DrawFrameSimple, once the previous use of the frame segment has finished
 }
 
 void SimpleShadowmapRender::ProcessInput(const AppInput &input)
@@ -61,6 +68,9 @@ void SimpleShadowmapRender::ProcessInput(const AppInput &input)
   // add keyboard controls here
   // camera movement is processed separately
   //
+  if (m_colorCheck.stage != ColorCheckStage::IDLE)
+    return;
+
   if(input.keyReleased[GLFW_KEY_Q])
     m_input.drawFSQuad = !m_input.drawFSQuad;
 
@@ -76,11 +86,11 @@ void SimpleShadowmapRender::ProcessInput(const AppInput &input)
     std::system("cd resources/shaders && python3 compile_shadowmap_shaders.py");
 #endif
 
+    // pipelines of the frames in flight are about to be destroyed
+    ETNA_ASSERT(m_context->getDevice().waitIdle() == vk::Result::eSuccess);
     etna::reload_shaders();
-
-    for (uint32_t i = 0; i < m_framesInFlight; ++i)
-    {
-      BuildCommandBufferSimple(m_cmdBuffersDrawMain[i], m_swapchain.GetAttachment(i).image, m_swapchain.GetAttachment(i).view);
-    }
+    m_pBilateralBlur->Reload();
+    // pipelines are recreated, the next frames record their command buffers again
+    InvalidateCommandBuffers();
   }
 }
@@ -60,8 +60,10 @@ void SimpleRender::InitVulkan(const char** a_instanceExtensions, uint32_t a_inst
     VK_CHECK_RESULT(vkCreateFence(m_device, &fenceInfo, nullptr, &m_frameFences[i]));
   }
 
-  m_pScnMgr = std::make_shared<SceneManager>(m_device, m_physicalDevice, m_queueFamilyIDXs.transfer,
-                                             m_queueFamilyIDXs.graphics, false);
+  auto pUploads = std::make_shared<UploadManager>(m_device, m_physicalDevice, m_queueFamilyIDXs.transfer,
+                                                  m_queueFamilyIDXs.graphics);
+  auto pGeoHeap = std::make_shared<GeometryHeap>(m_device, m_physicalDevice);
+  m_pScnMgr = std::make_shared<SceneManager>(m_device, m_physicalDevice, pUploads, pGeoHeap, false);
 }
 
 void SimpleRender::InitPresentation(VkSurfaceKHR &a_surface, bool initGUI)
@@ -210,6 +212,8 @@ void SimpleRender::BuildCommandBufferSimple(VkCommandBuffer a_cmdBuff, VkFramebu
 
   VK_CHECK_RESULT(vkBeginCommandBuffer(a_cmdBuff, &beginInfo));
 
+  m_pScnMgr->GetUploadManager()->RecordAcquireBarriers(a_cmdBuff);
+
   vk_utils::setDefaultViewport(a_cmdBuff, static_cast<float>(m_width), static_cast<float>(m_height));
   vk_utils::setDefaultScissor(a_cmdBuff, m_width, m_height);
 
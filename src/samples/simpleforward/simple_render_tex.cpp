@@ -1,4 +1,5 @@
 #include <vk_pipeline.h>
+#include <vk_copy.h>
 #include "simple_render_tex.h"
 #include "loader_utils/images.h"
 #include "imgui/misc/cpp/imgui_stdlib.h"
@@ -54,9 +55,12 @@ void SimpleRenderTexture::LoadTexture()
     vkDestroySampler(m_device, m_textureSampler, VK_NULL_HANDLE);
   }
 
+  // vk-utils textures also record layout transitions, so they go through a graphics queue copy helper
   int mipLevels = 1;
+  auto pCopyHelper = std::make_shared<vk_utils::SimpleCopyHelper>(m_physicalDevice, m_device, m_graphicsQueue,
+    m_queueFamilyIDXs.graphics, w * h * 4);
   m_texture = allocateColorTextureFromDataLDR(m_device, m_physicalDevice, pixels, w, h, mipLevels,
-           VK_FORMAT_R8G8B8A8_UNORM, m_pScnMgr->GetCopyHelper());
+           VK_FORMAT_R8G8B8A8_UNORM, pCopyHelper);
   m_textureSampler = vk_utils::createSampler(m_device, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT,
     VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK);
 